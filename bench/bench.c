@@ -0,0 +1,243 @@
+/**********************************************************************
+ * bench: benchmark driver for the simulators
+ *
+ * Run each kernel in bench/ through
+ *
+ *  - the functional core of pa2 (common/core.h) for host MIPS,
+ *  - the pipeline timing model (mc with one core) for simulated cycles
+ *    and host cycles per second, and
+ *  - the assembler of pa1 (common/asm.h) for lines per second,
+ *
+ * check its result in $v0, and print everything in JSON on stdout.
+ *
+ *   bench [-d kernel directory] [-t seconds per measurement] [-l label] [kernel ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/asm.h"
+#include "../common/core.h"
+#include "../common/loader.h"
+#include "../common/tokenize.h"
+#include "../mc/machine.h"
+
+struct kernel {
+	const char* name;
+	const char* description;
+	unsigned int expected;		/* $v0 at halt */
+};
+
+static const struct kernel kernels[] = {
+	{ "memcpy",  "copy 16KB 16 times with lw/sw",              8386560 },
+	{ "matmul",  "24x24 matrix multiply with mult/mflo",       662400 },
+	{ "list",    "walk a 2048-node ring 20 times",             41922560 },
+	{ "sort",    "insertion sort of 512 words",                15949324 },
+	{ "strings", "djb2 hash of 8KB with lbu, 8 passes",        2131889461u },
+	{ "memcpy_simd",  "memcpy with lq/sq",                         8386560 },
+	{ "strings_simd", "strings with lq and packed compares",       2131889461u },
+};
+
+#define NR_KERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+
+static double __now(void)
+{
+	struct timespec now;
+
+	timespec_get(&now, TIME_UTC);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Run the kernel on the functional core as many times as fit in @seconds.
+ * Returns the instructions per run and sets @mips and @result.
+ */
+static unsigned long long __bench_functional(const unsigned char* image, double seconds,
+	double* mips, unsigned int* result)
+{
+	unsigned char* memory = malloc(CORE_MEMORY_SIZE);
+	unsigned long long instructions = 0;
+	unsigned long long total = 0;
+	double start = __now();
+	double elapsed;
+
+	do {
+		struct mips_core core = { .pc = ENTRY_PC, .memory = memory };
+		struct mips_retire retire;
+
+		memcpy(memory, image, CORE_MEMORY_SIZE);
+		core.registers[29] = STACK_TOP;
+
+		for (instructions = 0; core_step(&core, &retire); instructions++);
+		total += instructions;
+		*result = core.registers[2];
+	} while ((elapsed = __now() - start) < seconds);
+
+	*mips = total / elapsed / 1e6;
+	free(memory);
+
+	return instructions;
+}
+
+/* Same for the timing model. Returns the simulated cycles per run */
+static unsigned long long __bench_timing(const unsigned char* image, double seconds,
+	double* cycles_per_sec, double* ipc, unsigned int* result)
+{
+	struct mc_config config = mc_default_config;
+	unsigned long long cycles = 0;
+	unsigned long long total = 0;
+	double start = __now();
+	double elapsed;
+
+	config.nr_cores = 1;
+	do {
+		struct machine machine;
+
+		machine_init(&machine, &config, image);
+		cycles = machine_run(&machine);
+		total += cycles;
+		*ipc = (double)machine.cores[0].instructions / cycles;
+		*result = machine.cores[0].cpu.registers[2];
+		machine_destroy(&machine);
+	} while ((elapsed = __now() - start) < seconds);
+
+	*cycles_per_sec = total / elapsed;
+
+	return cycles;
+}
+
+/* Assemble the lines of @filename over and over as pa1 does */
+static double __bench_assembler(const char* filename, double seconds)
+{
+	FILE* file = fopen(filename, "r");
+	struct arena arena = { NULL };
+	struct arena lines_arena = { NULL };
+	char** lines = NULL;
+	size_t nr_lines = 0;
+	unsigned long long total = 0;
+	double start;
+	double elapsed;
+	char* line;
+
+	if (!file) return 0;
+
+	while ((line = arena_getline(&lines_arena, file))) {
+		lines = realloc(lines, sizeof(*lines) * (nr_lines + 1));
+		lines[nr_lines++] = line;
+	}
+	fclose(file);
+
+	start = __now();
+	do {
+		for (size_t i = 0; i < nr_lines; i++) {
+			size_t len = strlen(lines[i]) + 1;
+			char* copy = memcpy(arena_alloc(&arena, len), lines[i], len);
+			char** tokens;
+			int nr_tokens = tokenize(&arena, copy, TOKENIZE_LOWER | TOKENIZE_COMMENTS, &tokens);
+			unsigned int instr;
+
+			if (nr_tokens && !assemble(nr_tokens, tokens, &instr)) {
+				fprintf(stderr, "%s: unable to assemble %s", filename, lines[i]);
+			}
+			arena_reset(&arena);
+		}
+		total += nr_lines;
+	} while ((elapsed = __now() - start) < seconds);
+
+	arena_destroy(&arena);
+	arena_destroy(&lines_arena);
+	free(lines);
+
+	return total / elapsed;
+}
+
+static void __usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-d kernel directory] [-t seconds per measurement] [-l label] [kernel ...]\n", name);
+	fprintf(stderr, "Kernels:");
+	for (size_t i = 0; i < NR_KERNELS; i++) fprintf(stderr, " %s", kernels[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char* argv[])
+{
+	static unsigned char image[CORE_MEMORY_SIZE];
+	const char* directory = "bench";
+	const char* label = NULL;
+	double seconds = 0.2;
+	bool first = true;
+	int failures = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:l:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			directory = optarg;
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		default:
+			__usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	printf("{\n");
+	if (label) printf("  \"label\": \"%s\",\n", label);
+	printf("  \"seconds_per_measurement\": %.3f,\n", seconds);
+	printf("  \"kernels\": [");
+
+	for (size_t i = 0; i < NR_KERNELS; i++) {
+		const struct kernel* k = &kernels[i];
+		char filename[4096];
+		unsigned long long instructions, cycles;
+		unsigned int functional_result, timing_result;
+		double mips, cycles_per_sec, ipc, lines_per_sec;
+		bool selected = optind == argc;
+
+		for (int j = optind; j < argc; j++) {
+			if (strcmp(argv[j], k->name) == 0) selected = true;
+		}
+		if (!selected) continue;
+
+		snprintf(filename, sizeof(filename), "%s/%s.s", directory, k->name);
+		memset(image, 0, sizeof(image));
+		if (load_image(image, ENTRY_PC, filename) < 0) {
+			fprintf(stderr, "No input file %s\n", filename);
+			return EXIT_FAILURE;
+		}
+
+		instructions = __bench_functional(image, seconds, &mips, &functional_result);
+		cycles = __bench_timing(image, seconds, &cycles_per_sec, &ipc, &timing_result);
+		lines_per_sec = __bench_assembler(filename, seconds);
+
+		if (functional_result != k->expected || timing_result != k->expected) {
+			fprintf(stderr, "%s: $v0 is 0x%08x (functional) and 0x%08x (timing), expected 0x%08x\n",
+				k->name, functional_result, timing_result, k->expected);
+			failures++;
+		}
+
+		printf("%s\n    {\n", first ? "" : ",");
+		printf("      \"name\": \"%s\",\n", k->name);
+		printf("      \"description\": \"%s\",\n", k->description);
+		printf("      \"ok\": %s,\n", functional_result == k->expected && timing_result == k->expected ? "true" : "false");
+		printf("      \"instructions\": %llu,\n", instructions);
+		printf("      \"pa2_mips\": %.2f,\n", mips);
+		printf("      \"pa3_cycles\": %llu,\n", cycles);
+		printf("      \"pa3_ipc\": %.4f,\n", ipc);
+		printf("      \"pa3_cycles_per_sec\": %.0f,\n", cycles_per_sec);
+		printf("      \"pa1_lines_per_sec\": %.0f\n", lines_per_sec);
+		printf("    }");
+		first = false;
+	}
+
+	printf("\n  ]\n}\n");
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
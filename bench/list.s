@@ -0,0 +1,29 @@
+ori s7 zero 2048        # nodes
+addi s6 s7 -1           # slot mask
+ori s5 zero 1021        # stride, odd so that every slot is visited
+ori s0 zero 1
+sll s0 s0 16            # nodes at 0x10000, 16 bytes each
+addi t0 zero 0          # k
+addi t1 zero 0          # slot of node k
+add t2 s0 zero          # node 0 is in slot 0
+add t1 t1 s5
+and t1 t1 s6            # slot of node k + 1, wraps to slot 0 at the end
+sll t3 t1 4
+add t3 t3 s0
+sw t3 0 t2              # node k -> node k + 1
+sw t0 4 t2              # value of node k
+add t2 t3 zero
+addi t0 t0 1
+bne t0 s7 -9
+addi v0 zero 0
+addi s4 zero 20         # walks around the ring
+add t2 s0 zero
+add t0 s7 zero
+lw t3 4 t2
+add v0 v0 t3
+lw t2 0 t2
+addi t0 t0 -1
+bne t0 zero -5
+addi s4 s4 -1
+bne s4 zero -9
+halt
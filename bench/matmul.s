@@ -0,0 +1,58 @@
+addi s7 zero 24         # N
+sll s6 s7 2             # row size in bytes
+ori s0 zero 1
+sll s0 s0 16            # A = 0x10000
+ori s1 zero 2
+sll s1 s1 16            # B = 0x20000
+ori s2 zero 3
+sll s2 s2 16            # C = 0x30000
+add t0 s0 zero
+add t1 s1 zero
+addi t2 zero 0          # i
+addi t3 zero 0          # j
+add t4 t2 t3
+sw t4 0 t0              # A[i][j] = i + j
+sub t4 t2 t3
+sw t4 0 t1              # B[i][j] = i - j
+addi t0 t0 4
+addi t1 t1 4
+addi t3 t3 1
+bne t3 s7 -8
+addi t2 t2 1
+bne t2 s7 -11
+add t5 s0 zero          # &A[i][0]
+add t6 s2 zero          # &C[i][0]
+addi t2 zero 0          # i
+addi t3 zero 0          # j
+sll t7 t3 2
+add a0 t5 zero          # &A[i][k]
+add a1 s1 t7            # &B[k][j]
+addi a2 zero 0          # k
+addi v1 zero 0          # sum
+lw a3 0 a0
+lw t8 0 a1
+mult a3 t8
+mflo t9
+add v1 v1 t9
+addi a0 a0 4
+add a1 a1 s6
+addi a2 a2 1
+bne a2 s7 -9
+sw v1 0 t6              # C[i][j] = sum
+addi t6 t6 4
+addi t3 t3 1
+sll t7 t3 2
+bne t3 s7 -18
+add t5 t5 s6
+addi t2 t2 1
+bne t2 s7 -23
+mult s7 s7
+mflo t1
+add t2 s2 zero
+addi v0 zero 0
+lw t3 0 t2              # v0 = sum of C
+add v0 v0 t3
+addi t2 t2 4
+addi t1 t1 -1
+bne t1 zero -5
+halt
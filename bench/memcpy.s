@@ -0,0 +1,34 @@
+ori s0 zero 1
+sll s0 s0 16            # src = 0x10000
+ori s1 zero 2
+sll s1 s1 16            # dst = 0x20000
+ori s2 zero 4096        # words to copy
+add t0 s0 zero
+addi t1 zero 0
+sw t1 0 t0              # src[i] = i
+addi t0 t0 4
+addi t1 t1 1
+bne t1 s2 -4
+addi s3 zero 16         # copy 16 times
+add t0 s0 zero
+add t2 s1 zero
+add t1 s2 zero
+lw t3 0 t0
+lw t4 4 t0
+sw t3 0 t2
+sw t4 4 t2
+addi t0 t0 8
+addi t2 t2 8
+addi t1 t1 -2
+bne t1 zero -8
+addi s3 s3 -1
+bne s3 zero -13
+add t2 s1 zero
+add t1 s2 zero
+addi v0 zero 0
+lw t3 0 t2              # v0 = sum of dst
+add v0 v0 t3
+addi t2 t2 4
+addi t1 t1 -1
+bne t1 zero -5
+halt
@@ -0,0 +1,35 @@
+ori s0 zero 1
+sll s0 s0 16            # src = 0x10000
+ori s1 zero 2
+sll s1 s1 16            # dst = 0x20000
+ori s2 zero 4096        # words to copy
+add t0 s0 zero
+addi t1 zero 0
+sw t1 0 t0              # src[i] = i
+addi t0 t0 4
+addi t1 t1 1
+bne t1 s2 -4
+addi s3 zero 16         # copy 16 times
+add t0 s0 zero
+add t2 s1 zero
+add t1 s2 zero
+lq t3 0 t0              # t3-t6 = src[i .. i + 3]
+sq t3 0 t2
+addi t0 t0 16
+addi t2 t2 16
+addi t1 t1 -4
+bne t1 zero -6
+addi s3 s3 -1
+bne s3 zero -11
+add t2 s1 zero
+add t1 s2 zero
+addi v0 zero 0
+lq t3 0 t2              # v0 = sum of dst, four words at a time
+add v0 v0 t3
+add v0 v0 t4
+add v0 v0 t5
+add v0 v0 t6
+addi t2 t2 16
+addi t1 t1 -4
+bne t1 zero -8
+halt
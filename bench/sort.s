@@ -0,0 +1,46 @@
+ori s7 zero 512         # elements
+ori s0 zero 1
+sll s0 s0 16            # array at 0x10000
+ori s1 zero 0x41c6
+sll s1 s1 16
+ori s1 s1 0x4e6d        # LCG multiplier 1103515245
+ori s2 zero 0xffff      # keep 16 bits of each number
+addi t0 zero 1          # seed
+add t1 s0 zero
+add t2 s7 zero
+mult t0 s1
+mflo t0
+addi t0 t0 12345
+srl t3 t0 8
+and t3 t3 s2
+sw t3 0 t1
+addi t1 t1 4
+addi t2 t2 -1
+bne t2 zero -9
+addi t0 zero 1          # insertion sort, i = 1
+sll t1 t0 2
+add t1 t1 s0            # &a[i]
+lw t2 0 t1              # key
+lw t3 -4 t1             # i >= 1, so a[i - 1] is there the first time
+slt t4 t2 t3
+beq t4 zero 3
+sw t3 0 t1
+addi t1 t1 -4
+bne t1 s0 -6            # down to a[0]
+sw t2 0 t1
+addi t0 t0 1
+bne t0 s7 -12
+add t1 s0 zero          # v0 = sum if sorted, 0 otherwise
+addi t2 s7 -1
+lw v0 0 t1
+lw t3 0 t1
+lw t4 4 t1
+slt t5 t4 t3
+bne t5 zero 5
+add v0 v0 t4
+addi t1 t1 4
+addi t2 t2 -1
+bne t2 zero -8
+halt
+addi v0 zero 0
+halt
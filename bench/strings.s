@@ -0,0 +1,33 @@
+ori s7 zero 2048        # words of text, 8KB
+ori s0 zero 1
+sll s0 s0 16            # text at 0x10000
+ori s1 zero 0x41c6
+sll s1 s1 16
+ori s1 s1 0x4e6d        # LCG multiplier 1103515245
+addi t0 zero 7          # seed
+add t1 s0 zero
+add t2 s7 zero
+mult t0 s1
+mflo t0
+addi t0 t0 12345
+sw t0 0 t1
+addi t1 t1 4
+addi t2 t2 -1
+bne t2 zero -7
+addi s3 zero 8          # passes
+ori v0 zero 5381
+add t1 s0 zero
+sll t2 s7 2             # bytes
+addi v1 zero 0          # bytes below 0x20
+lbu t3 0 t1
+sll t4 v0 5             # djb2, h = h * 33 + c
+add v0 v0 t4
+add v0 v0 t3
+slti t5 t3 0x20
+add v1 v1 t5
+addi t1 t1 1
+addi t2 t2 -1
+bne t2 zero -9
+addi s3 s3 -1
+bne s3 zero -14
+halt
@@ -0,0 +1,122 @@
+ori s7 zero 2048        # words of text, 8KB
+ori s0 zero 1
+sll s0 s0 16            # text at 0x10000
+ori s1 zero 0x41c6
+sll s1 s1 16
+ori s1 s1 0x4e6d        # LCG multiplier 1103515245
+addi t0 zero 7          # seed
+add t1 s0 zero
+add t2 s7 zero
+mult t0 s1
+mflo t0
+addi t0 t0 12345
+sw t0 0 t1
+addi t1 t1 4
+addi t2 t2 -1
+bne t2 zero -7
+addi s3 zero 8          # passes
+ori v0 zero 5381
+ori s4 zero 0x1f1f
+sll s4 s4 16
+ori s4 s4 0x1f1f        # 0x1f in every byte
+ori s6 zero 0x0101
+sll s6 s6 16
+ori s6 s6 0x0101        # 0x01 in every byte
+add t1 s0 zero
+sll t2 s7 2             # bytes
+addi v1 zero 0          # bytes below 0x20
+lq t3 0 t1              # t3-t6 = the next 16 bytes
+pminub t9 t3 s4         # 0xff in the bytes up to 0x1f
+pcmpeqb t9 t9 t3
+psubb s5 zero t9        # count them per byte
+pminub t9 t4 s4
+pcmpeqb t9 t9 t4
+psubb s5 s5 t9
+pminub t9 t5 s4
+pcmpeqb t9 t9 t5
+psubb s5 s5 t9
+pminub t9 t6 s4
+pcmpeqb t9 t9 t6
+psubb s5 s5 t9
+mult s5 s6
+mflo t9
+srl t9 t9 24            # add up the four counts
+add v1 v1 t9
+srl t7 t3 24            # djb2 of the bytes, most significant first
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t3 16
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t3 8
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+andi t7 t3 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t4 24
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t4 16
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t4 8
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+andi t7 t4 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t5 24
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t5 16
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t5 8
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+andi t7 t5 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t6 24
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t6 16
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+srl t7 t6 8
+andi t7 t7 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+andi t7 t6 0xff
+sll t8 v0 5
+add v0 v0 t8
+add v0 v0 t7
+addi t1 t1 16
+addi t2 t2 -16
+bne t2 zero -92
+addi s3 s3 -1
+bne s3 zero -97
+halt
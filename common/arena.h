@@ -0,0 +1,122 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Bump allocator for things that live as long as one input line. Memory is
+ * handed out from the current block and never freed individually; the
+ * whole arena is recycled by arena_reset(). Blocks are only added while a
+ * line is bigger than anything seen before, and they are folded into one
+ * block on the next reset, so the footprint stays at the size of the
+ * longest line no matter how much input goes through it.
+ */
+struct arena_block {
+	struct arena_block* prev;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct arena {
+	struct arena_block* block;
+	size_t total;	/* Sum of the sizes of all blocks */
+};
+
+#define ARENA_ALIGN(size)	(((size) + 7) & ~(size_t)7)
+#define ARENA_MIN_BLOCK		4096
+
+static inline void* arena_alloc(struct arena* arena, size_t size)
+{
+	struct arena_block* block = arena->block;
+
+	size = ARENA_ALIGN(size);
+	if (!block || block->used + size > block->size) {
+		size_t block_size = arena->total * 2;
+
+		if (block_size < ARENA_MIN_BLOCK) block_size = ARENA_MIN_BLOCK;
+		if (block_size < size) block_size = size;
+
+		block = malloc(sizeof(*block) + block_size);
+		if (!block) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		block->prev = arena->block;
+		block->size = block_size;
+		block->used = 0;
+		arena->block = block;
+		arena->total += block_size;
+	}
+
+	block->used += size;
+	return block->data + block->used - size;
+}
+
+/***********************************************************************
+ * arena_extend(arena, ptr, old_size, new_size)
+ *
+ * DESCRIPTION
+ *   Grow the latest allocation @ptr to @new_size bytes. It is grown in
+ *   place when the block has room; otherwise the contents are copied to a
+ *   fresh allocation.
+ *
+ * RETURN VALUE
+ *   Address of the grown allocation
+ */
+static inline void* arena_extend(struct arena* arena, void* ptr, size_t old_size, size_t new_size)
+{
+	struct arena_block* block = arena->block;
+	void* grown;
+
+	old_size = ARENA_ALIGN(old_size);
+	new_size = ARENA_ALIGN(new_size);
+
+	if ((char*)ptr + old_size == block->data + block->used &&
+		block->used - old_size + new_size <= block->size) {
+		block->used = block->used - old_size + new_size;
+		return ptr;
+	}
+
+	grown = arena_alloc(arena, new_size);
+	memcpy(grown, ptr, old_size);
+	return grown;
+}
+
+/**
+ * Forget everything allocated so far. O(1) unless the previous line
+ * needed extra blocks, in which case they are merged into one.
+ */
+static inline void arena_reset(struct arena* arena)
+{
+	struct arena_block* block = arena->block;
+
+	if (block && block->prev) {
+		size_t total = arena->total;
+
+		while (block) {
+			struct arena_block* prev = block->prev;
+			free(block);
+			block = prev;
+		}
+		arena->block = NULL;
+		arena->total = 0;
+		arena_alloc(arena, total);
+		block = arena->block;
+	}
+	if (block) block->used = 0;
+}
+
+static inline void arena_destroy(struct arena* arena)
+{
+	while (arena->block) {
+		struct arena_block* prev = arena->block->prev;
+		free(arena->block);
+		arena->block = prev;
+	}
+	arena->total = 0;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef __ASM_H__
+#define __ASM_H__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+
+/***********************************************************************
+ * asm_register(token)
+ *
+ * DESCRIPTION
+ *   Parse a register operand. Accepts the names in @isa_register_names
+ *   with or without the leading '$', "zr" for $zero, and plain register
+ *   numbers such as "$8". A trailing ',' is ignored.
+ *
+ * RETURN VALUE
+ *   Register number, or -1 if @token is not a register.
+ */
+static inline int asm_register(const char* token)
+{
+	char name[8];
+	size_t len;
+
+	if (*token == '$') token++;
+
+	len = strlen(token);
+	if (len && token[len - 1] == ',') len--;
+	if (len == 0 || len >= sizeof(name)) return -1;
+
+	memcpy(name, token, len);
+	name[len] = '\0';
+
+	if (name[0] >= '0' && name[0] <= '9') {
+		char* end;
+		long nr = strtol(name, &end, 10);
+		return (*end == '\0' && nr >= 0 && nr < 32) ? (int)nr : -1;
+	}
+	if (strcmp(name, "zr") == 0) return 0;
+
+	for (int i = 0; i < 32; i++) {
+		if (strcmp(name, isa_register_names[i]) == 0) return i;
+	}
+	return -1;
+}
+
+/***********************************************************************
+ * asm_immediate(token, value)
+ *
+ * DESCRIPTION
+ *   Parse a decimal or 0x-prefixed hexadecimal constant, optionally with
+ *   a leading '-'. The same rule pa1 has always used.
+ *
+ * RETURN VALUE
+ *   true if @token is a number.
+ */
+static inline bool asm_immediate(const char* token, long* value)
+{
+	const char* digits = token[0] == '-' || token[0] == '+' ? token + 1 : token;
+	char* end;
+
+	if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+		*value = strtol(token, &end, 16);
+	}
+	else {
+		*value = strtol(token, &end, 10);
+	}
+	return end != token && (*end == '\0' || *end == ',');
+}
+
+/***********************************************************************
+ * asm_lookup(mnemonic)
+ *
+ * RETURN VALUE
+ *   Entry in @isa_table for @mnemonic, or ISA_INVALID if unknown.
+ */
+static inline enum isa_id asm_lookup(const char* mnemonic)
+{
+	for (int i = ISA_INVALID + 1; i < NR_ISA; i++) {
+		if (strcmp(mnemonic, isa_table[i].name) == 0) return (enum isa_id)i;
+	}
+	return ISA_INVALID;
+}
+
+static inline unsigned int asm_encode_r(unsigned int funct, unsigned int rs, unsigned int rt, unsigned int rd, unsigned int shamt)
+{
+	return (rs << 21) | (rt << 16) | (rd << 11) | ((shamt & 0x1f) << 6) | funct;
+}
+
+static inline unsigned int asm_encode_i(unsigned int opcode, unsigned int rs, unsigned int rt, long imm)
+{
+	return (opcode << 26) | (rs << 21) | (rt << 16) | ((unsigned int)imm & 0xffff);
+}
+
+/***********************************************************************
+ * assemble(nr_tokens, tokens[], instr)
+ *
+ * DESCRIPTION
+ *   Translate one line of assembly in @tokens[] into a MIPS instruction
+ *   using the encodings in @isa_table and put it into @instr. Memory
+ *   operands may be written either as "lw t0 4 sp" (pa1 syntax) or as
+ *   "lw t0 4(sp)".
+ *
+ * RETURN VALUE
+ *   true if the line is translated
+ *   false if translation is not possible. 0 is a valid instruction
+ *   ("sll zero zero 0"), so it cannot tell failures apart.
+ */
+static inline bool assemble(int nr_tokens, char* tokens[], unsigned int* instr)
+{
+	enum isa_id id;
+	const struct isa_entry* e;
+	int r[3] = { 0 };
+	long imm = 0;
+	char offset[32];
+
+	if (nr_tokens <= 0) return false;
+
+	id = asm_lookup(tokens[0]);
+	if (id == ISA_INVALID) return false;
+	e = &isa_table[id];
+
+	/* Split "off(rs)" into two operands */
+	if (e->layout == LAYOUT_RT_OFF_RS && nr_tokens == 3) {
+		char* open = strchr(tokens[2], '(');
+		char* close = open ? strchr(open, ')') : NULL;
+		size_t len = open ? (size_t)(open - tokens[2]) : 0;
+
+		if (!close || len >= sizeof(offset)) return false;
+		memcpy(offset, tokens[2], len);
+		offset[len] = '\0';
+		if (len == 0) strcpy(offset, "0");
+		*close = '\0';
+
+		r[0] = asm_register(tokens[1]);
+		r[1] = asm_register(open + 1);
+		*close = ')';
+		if (r[0] < 0 || r[1] < 0 || !asm_immediate(offset, &imm) ||
+			((id == ISA_LQ || id == ISA_SQ) && !ISA_REG_QUAD(r[0]))) return false;
+		*instr = asm_encode_i(e->opcode, r[1], r[0], imm);
+		return true;
+	}
+
+	switch (e->layout) {
+	case LAYOUT_NONE:
+		if (nr_tokens != 1) return false;
+		*instr = e->opcode ? (unsigned int)e->opcode << 26 : e->funct;
+		return true;
+	case LAYOUT_RD_RS_RT:
+		if (nr_tokens != 4) return false;
+		r[0] = asm_register(tokens[1]);
+		r[1] = asm_register(tokens[2]);
+		r[2] = asm_register(tokens[3]);
+		if (r[0] < 0 || r[1] < 0 || r[2] < 0) return false;
+		*instr = ((unsigned int)e->opcode << 26) | asm_encode_r(e->funct, r[1], r[2], r[0], 0);
+		return true;
+	case LAYOUT_RD_RT_SHAMT:
+		if (nr_tokens != 4) return false;
+		r[0] = asm_register(tokens[1]);
+		r[1] = asm_register(tokens[2]);
+		if (r[0] < 0 || r[1] < 0 || !asm_immediate(tokens[3], &imm)) return false;
+		*instr = asm_encode_r(e->funct, 0, r[1], r[0], (unsigned int)imm);
+		return true;
+	case LAYOUT_RS_RT:
+		if (nr_tokens != 3) return false;
+		r[0] = asm_register(tokens[1]);
+		r[1] = asm_register(tokens[2]);
+		if (r[0] < 0 || r[1] < 0) return false;
+		*instr = asm_encode_r(e->funct, r[0], r[1], 0, 0);
+		return true;
+	case LAYOUT_RD:
+		if (nr_tokens != 2 || (r[0] = asm_register(tokens[1])) < 0) return false;
+		*instr = asm_encode_r(e->funct, 0, 0, r[0], 0);
+		return true;
+	case LAYOUT_RS:
+		if (nr_tokens != 2 || (r[0] = asm_register(tokens[1])) < 0) return false;
+		*instr = asm_encode_r(e->funct, r[0], 0, 0, 0);
+		return true;
+	case LAYOUT_RT_RS_SIMM:
+	case LAYOUT_RT_RS_UIMM:
+	case LAYOUT_RT_RS_BOFF:
+		if (nr_tokens != 4) return false;
+		r[0] = asm_register(tokens[1]);
+		r[1] = asm_register(tokens[2]);
+		if (r[0] < 0 || r[1] < 0 || !asm_immediate(tokens[3], &imm)) return false;
+		*instr = asm_encode_i(e->opcode, r[1], r[0], imm);
+		return true;
+	case LAYOUT_RT_OFF_RS:
+		if (nr_tokens != 4) return false;
+		r[0] = asm_register(tokens[1]);
+		r[1] = asm_register(tokens[3]);
+		if (r[0] < 0 || r[1] < 0 || !asm_immediate(tokens[2], &imm) ||
+			((id == ISA_LQ || id == ISA_SQ) && !ISA_REG_QUAD(r[0]))) return false;
+		*instr = asm_encode_i(e->opcode, r[1], r[0], imm);
+		return true;
+	case LAYOUT_TARGET:
+		if (nr_tokens != 2 || !asm_immediate(tokens[1], &imm)) return false;
+		*instr = ((unsigned int)e->opcode << 26) | (((unsigned long)imm >> 2) & 0x03ffffff);
+		return true;
+	default:
+		return false;
+	}
+}
+
+#endif
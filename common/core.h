@@ -0,0 +1,288 @@
+#ifndef __CORE_H__
+#define __CORE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "isa.h"
+
+/**
+ * Functional model of one MIPS hart. This is the instruction semantics of
+ * pa2's process_instruction() working on an explicit context instead of
+ * globals, so that several harts (mc), a reference model next to the
+ * pipeline (pa3) and pa2 itself all execute exactly the same code.
+ */
+#define CORE_MEMORY_SIZE	(1 << 20)	/* Every machine has 1MB of memory */
+#define CORE_MEMORY_MASK	(CORE_MEMORY_SIZE - 1)
+
+struct mips_core {
+	unsigned int registers[32];
+	unsigned int hi;
+	unsigned int lo;
+	unsigned int pc;
+	unsigned char* memory;			/* CORE_MEMORY_SIZE bytes, may be shared */
+
+	bool link_valid;				/* ll/sc reservation */
+	unsigned int link_addr;
+
+	/**
+	 * Called for syscall with @syscall_data, e.g., syscall_core() of
+	 * common/syscall.h. Returning false stops the core like halt. Without
+	 * it, syscall is an unknown instruction.
+	 */
+	bool (*syscall)(struct mips_core* core, void* data);
+	void* syscall_data;
+};
+
+/**
+ * Architectural effects of one executed instruction. Timing models, the
+ * co-simulation checker and tracers look at this instead of decoding the
+ * instruction again.
+ */
+struct mips_retire {
+	unsigned int pc;				/* Address of the instruction */
+	unsigned int instr;
+	enum isa_id id;
+
+	int write_reg;					/* -1 if no register is written */
+	unsigned int write_value;
+
+	unsigned char mem_size;			/* 0 if memory is not accessed */
+	bool mem_store;
+	unsigned int mem_addr;
+	unsigned int mem_value;			/* Loaded or stored value, the first word of lq/sq */
+
+	bool taken;						/* Control transfer changed @pc */
+};
+
+static inline unsigned int core_load_word(const unsigned char* memory, unsigned int addr)
+{
+	return (memory[addr & CORE_MEMORY_MASK] << 24) | (memory[(addr + 1) & CORE_MEMORY_MASK] << 16) |
+		(memory[(addr + 2) & CORE_MEMORY_MASK] << 8) | memory[(addr + 3) & CORE_MEMORY_MASK];
+}
+
+static inline void core_store_word(unsigned char* memory, unsigned int addr, unsigned int value)
+{
+	memory[addr & CORE_MEMORY_MASK] = (value >> 24) & 0xff;
+	memory[(addr + 1) & CORE_MEMORY_MASK] = (value >> 16) & 0xff;
+	memory[(addr + 2) & CORE_MEMORY_MASK] = (value >> 8) & 0xff;
+	memory[(addr + 3) & CORE_MEMORY_MASK] = value & 0xff;
+}
+
+/***********************************************************************
+ * core_packed(id, a, b)
+ *
+ * DESCRIPTION
+ *   Lane by lane result of the packed instruction @id on @a and @b: four
+ *   bytes for the b forms, two halfwords for the h forms.
+ *
+ * RETURN VALUE
+ *   The packed result, 0 if @id is not a packed instruction.
+ */
+static inline unsigned int core_packed(enum isa_id id, unsigned int a, unsigned int b)
+{
+	unsigned int bits = id == ISA_PADDH || id == ISA_PSUBH || id == ISA_PCMPEQH ||
+		id == ISA_PMINSH || id == ISA_PMAXSH ? 16 : 8;
+	unsigned int mask = (1U << bits) - 1;
+	unsigned int result = 0;
+
+	for (unsigned int shift = 0; shift < 32; shift += bits) {
+		unsigned int x = (a >> shift) & mask;
+		unsigned int y = (b >> shift) & mask;
+		int sx = (int16_t)x;
+		int sy = (int16_t)y;
+		unsigned int lane;
+
+		switch (id) {
+		case ISA_PADDB: case ISA_PADDH:     lane = x + y; break;
+		case ISA_PSUBB: case ISA_PSUBH:     lane = x - y; break;
+		case ISA_PCMPEQB: case ISA_PCMPEQH: lane = x == y ? mask : 0; break;
+		case ISA_PMINUB: lane = x < y ? x : y; break;
+		case ISA_PMAXUB: lane = x > y ? x : y; break;
+		case ISA_PMINSH: lane = sx < sy ? x : y; break;
+		case ISA_PMAXSH: lane = sx > sy ? x : y; break;
+		default: return 0;
+		}
+		result |= (lane & mask) << shift;
+	}
+	return result;
+}
+
+/* Fetch the instruction at @core->pc */
+static inline unsigned int core_fetch(const struct mips_core* core)
+{
+	return core_load_word(core->memory, core->pc);
+}
+
+/***********************************************************************
+ * core_execute(core, instr, retire)
+ *
+ * DESCRIPTION
+ *   Execute @instr on @core. As in pa2, @core->pc should already point to
+ *   the next instruction, i.e., the caller fetches, adds 4 to the pc and
+ *   then calls this. @retire is filled with what the instruction did.
+ *
+ * RETURN VALUE
+ *   true if the instruction is executed.
+ *   false on halt, on an unknown instruction, or when a syscall exits.
+ */
+static inline bool core_execute(struct mips_core* core, unsigned int instr, struct mips_retire* retire)
+{
+	unsigned int* registers = core->registers;
+	unsigned int rs = ISA_RS(instr);
+	unsigned int rt = ISA_RT(instr);
+	unsigned int rd = ISA_RD(instr);
+	unsigned int addr = registers[rs] + ISA_SIMM(instr);
+	int write_reg = -1;
+	unsigned int value = 0;
+
+	retire->pc = core->pc - 4;
+	retire->instr = instr;
+	retire->id = isa_decode(instr);
+	retire->mem_size = 0;
+	retire->mem_addr = 0;
+	retire->mem_store = false;
+	retire->taken = false;
+
+	switch (retire->id) {
+	case ISA_ADD:  write_reg = rd; value = registers[rs] + registers[rt]; break;
+	case ISA_SUB:  write_reg = rd; value = registers[rs] - registers[rt]; break;
+	case ISA_AND:  write_reg = rd; value = registers[rs] & registers[rt]; break;
+	case ISA_OR:   write_reg = rd; value = registers[rs] | registers[rt]; break;
+	case ISA_NOR:  write_reg = rd; value = ~(registers[rs] | registers[rt]); break;
+	case ISA_SLT:  write_reg = rd; value = (int)registers[rs] < (int)registers[rt]; break;
+	case ISA_SLL:  write_reg = rd; value = registers[rt] << ISA_SHAMT(instr); break;
+	case ISA_SRL:  write_reg = rd; value = registers[rt] >> ISA_SHAMT(instr); break;
+	case ISA_SRA:  write_reg = rd; value = (unsigned int)((int)registers[rt] >> ISA_SHAMT(instr)); break;
+	case ISA_MULT:
+	{
+		int64_t result = (int64_t)(int)registers[rs] * (int64_t)(int)registers[rt];
+		core->hi = (unsigned int)((uint64_t)result >> 32);
+		core->lo = (unsigned int)result;
+		break;
+	}
+	case ISA_MFHI: write_reg = rd; value = core->hi; break;
+	case ISA_MFLO: write_reg = rd; value = core->lo; break;
+	case ISA_JR:
+		core->pc = registers[rs];
+		retire->taken = true;
+		break;
+	case ISA_ADDI: write_reg = rt; value = registers[rs] + ISA_SIMM(instr); break;
+	case ISA_ANDI: write_reg = rt; value = registers[rs] & ISA_UIMM(instr); break;
+	case ISA_ORI:  write_reg = rt; value = registers[rs] | ISA_UIMM(instr); break;
+	case ISA_SLTI: write_reg = rt; value = (int)registers[rs] < ISA_SIMM(instr); break;
+	case ISA_LW:
+	case ISA_LL:
+		write_reg = rt;
+		value = core_load_word(core->memory, addr);
+		retire->mem_size = 4;
+		if (retire->id == ISA_LL) {
+			core->link_valid = true;
+			core->link_addr = addr;
+		}
+		break;
+	case ISA_LBU:
+		write_reg = rt;
+		value = core->memory[addr & CORE_MEMORY_MASK];
+		retire->mem_size = 1;
+		break;
+	case ISA_SW:
+		core_store_word(core->memory, addr, registers[rt]);
+		retire->mem_size = 4;
+		retire->mem_store = true;
+		retire->mem_value = registers[rt];
+		break;
+	case ISA_SC:
+		write_reg = rt;
+		value = core->link_valid && core->link_addr == addr;
+		if (value) {
+			core_store_word(core->memory, addr, registers[rt]);
+			retire->mem_size = 4;
+			retire->mem_store = true;
+			retire->mem_value = registers[rt];
+		}
+		core->link_valid = false;
+		break;
+	case ISA_LQ:
+		if (rt > 28) goto invalid;
+		addr &= ~15U;
+		write_reg = rt;
+		value = core_load_word(core->memory, addr);
+		for (unsigned int i = 1; i < 4; i++) registers[rt + i] = core_load_word(core->memory, addr + 4 * i);
+		retire->mem_size = 16;
+		break;
+	case ISA_SQ:
+		if (rt > 28) goto invalid;
+		addr &= ~15U;
+		for (unsigned int i = 0; i < 4; i++) core_store_word(core->memory, addr + 4 * i, registers[rt + i]);
+		retire->mem_size = 16;
+		retire->mem_store = true;
+		retire->mem_value = registers[rt];
+		break;
+	case ISA_PADDB:
+	case ISA_PADDH:
+	case ISA_PSUBB:
+	case ISA_PSUBH:
+	case ISA_PCMPEQB:
+	case ISA_PCMPEQH:
+	case ISA_PMINUB:
+	case ISA_PMAXUB:
+	case ISA_PMINSH:
+	case ISA_PMAXSH:
+		write_reg = rd;
+		value = core_packed(retire->id, registers[rs], registers[rt]);
+		break;
+	case ISA_BEQ:
+	case ISA_BNE:
+		if ((registers[rs] == registers[rt]) == (retire->id == ISA_BEQ)) {
+			core->pc += (unsigned int)ISA_SIMM(instr) << 2;
+			retire->taken = true;
+		}
+		break;
+	case ISA_JAL:
+		write_reg = 31;
+		value = core->pc;
+		/* fall through */
+	case ISA_J:
+		core->pc = (core->pc & 0xf0000000) | (ISA_TARGET(instr) << 2);
+		retire->taken = true;
+		break;
+	case ISA_SYSCALL:
+		if (!core->syscall || !core->syscall(core, core->syscall_data)) {
+			retire->write_reg = -1;
+			return false;
+		}
+		write_reg = 2;	/* Results come back in $v0 */
+		value = registers[2];
+		break;
+	case ISA_HALT:
+	default:
+	invalid:
+		retire->write_reg = -1;
+		return false;
+	}
+
+	if (retire->mem_size) {
+		retire->mem_addr = addr;
+		if (!retire->mem_store) retire->mem_value = value;
+	}
+
+	if (write_reg > 0) registers[write_reg] = value;	/* $zero stays zero */
+	retire->write_reg = write_reg > 0 ? write_reg : -1;
+	retire->write_value = value;
+
+	return true;
+}
+
+/**
+ * Execute the instruction at @core->pc
+ */
+static inline bool core_step(struct mips_core* core, struct mips_retire* retire)
+{
+	unsigned int instr = core_fetch(core);
+
+	core->pc += 4;
+	return core_execute(core, instr, retire);
+}
+
+#endif
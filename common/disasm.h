@@ -0,0 +1,127 @@
+#ifndef __DISASM_H__
+#define __DISASM_H__
+
+#include "isa.h"
+
+/**
+ * Size of the buffer disasm() requires, including the trailing '\0'
+ */
+#define DISASM_MAX	40
+
+static inline char* __disasm_str(char* p, const char* s)
+{
+	while (*s) *p++ = *s++;
+	return p;
+}
+
+static inline char* __disasm_reg(char* p, unsigned int reg)
+{
+	*p++ = ' ';
+	return __disasm_str(p, isa_register_names[reg]);
+}
+
+static inline char* __disasm_dec(char* p, int value)
+{
+	char digits[12];
+	int n = 0;
+	unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+	*p++ = ' ';
+	if (value < 0) *p++ = '-';
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n) *p++ = digits[--n];
+	return p;
+}
+
+static inline char* __disasm_hex(char* p, unsigned int value, int width)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	*p++ = ' ';
+	*p++ = '0';
+	*p++ = 'x';
+	for (int shift = (width - 1) * 4; shift >= 0; shift -= 4) {
+		*p++ = hex[(value >> shift) & 0xf];
+	}
+	return p;
+}
+
+/***********************************************************************
+ * disasm(instr, pc, buf)
+ *
+ * DESCRIPTION
+ *   Format the machine instruction @instr located at @pc into @buf in the
+ *   syntax the translator accepts, e.g., "lw t0 4 sp". @buf should be able
+ *   to hold DISASM_MAX bytes. Nothing is allocated and no stdio is used so
+ *   that it can annotate huge traces.
+ *
+ * RETURN VALUE
+ *   Number of characters written, excluding the trailing '\0'.
+ */
+static inline int disasm(unsigned int instr, unsigned int pc, char* buf)
+{
+	enum isa_id id = isa_decode(instr);
+	const struct isa_entry* e = &isa_table[id];
+	char* p = buf;
+
+	if (id == ISA_INVALID) {
+		p = __disasm_str(p, ".word");
+		p = __disasm_hex(p, instr, 8);
+		*p = '\0';
+		return (int)(p - buf);
+	}
+
+	p = __disasm_str(p, e->name);
+
+	switch (e->layout) {
+	case LAYOUT_RD_RS_RT:
+		p = __disasm_reg(p, ISA_RD(instr));
+		p = __disasm_reg(p, ISA_RS(instr));
+		p = __disasm_reg(p, ISA_RT(instr));
+		break;
+	case LAYOUT_RD_RT_SHAMT:
+		p = __disasm_reg(p, ISA_RD(instr));
+		p = __disasm_reg(p, ISA_RT(instr));
+		p = __disasm_dec(p, ISA_SHAMT(instr));
+		break;
+	case LAYOUT_RS_RT:
+		p = __disasm_reg(p, ISA_RS(instr));
+		p = __disasm_reg(p, ISA_RT(instr));
+		break;
+	case LAYOUT_RD:
+		p = __disasm_reg(p, ISA_RD(instr));
+		break;
+	case LAYOUT_RS:
+		p = __disasm_reg(p, ISA_RS(instr));
+		break;
+	case LAYOUT_RT_RS_SIMM:
+	case LAYOUT_RT_RS_BOFF:
+		p = __disasm_reg(p, ISA_RT(instr));
+		p = __disasm_reg(p, ISA_RS(instr));
+		p = __disasm_dec(p, ISA_SIMM(instr));
+		break;
+	case LAYOUT_RT_RS_UIMM:
+		p = __disasm_reg(p, ISA_RT(instr));
+		p = __disasm_reg(p, ISA_RS(instr));
+		p = __disasm_hex(p, ISA_UIMM(instr), 4);
+		break;
+	case LAYOUT_RT_OFF_RS:
+		p = __disasm_reg(p, ISA_RT(instr));
+		p = __disasm_dec(p, ISA_SIMM(instr));
+		p = __disasm_reg(p, ISA_RS(instr));
+		break;
+	case LAYOUT_TARGET:
+		p = __disasm_hex(p, ((pc + 4) & 0xf0000000) | (ISA_TARGET(instr) << 2), 8);
+		break;
+	default:
+		break;
+	}
+	*p = '\0';
+
+	return (int)(p - buf);
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef __INTERVAL_H__
+#define __INTERVAL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Interval statistics shared by pa2, pa3 and mc. The simulator keeps its
+ * own running counters and hands a copy of them to interval_sample() every
+ * @period units of its time base (instructions or cycles). The copies go
+ * into a ring buffer, and a background thread takes them out and writes
+ * one CSV line per interval with the time at its end, what each counter
+ * added up to in it, and the ratios asked for (IPC, say). The simulator
+ * only copies the counters, and waits only if the writer falls a whole
+ * ring behind.
+ *
+ * The ring has one producer and one consumer: the simulator moves @head
+ * and the writer moves @tail. The writer wakes up every
+ * INTERVAL_WAKEUP_MS or when a quarter of the ring is full, so the file
+ * can be plotted while the simulation is still running.
+ */
+#define INTERVAL_MAX_COUNTERS	16
+#define INTERVAL_MAX_RATIOS		4
+#define INTERVAL_RING			1024	/* Samples, a power of two */
+#define INTERVAL_WAKEUP_MS		200
+
+/* Column @name is counter @num over counter @den, both per interval; -1 is the time base */
+struct interval_ratio {
+	const char* name;
+	int num;
+	int den;
+};
+
+struct interval_sample {
+	unsigned long long time;
+	unsigned long long values[INTERVAL_MAX_COUNTERS];
+};
+
+struct interval {
+	FILE* file;
+	unsigned long long period;
+	unsigned long long next;		/* Time of the next sample */
+	int nr_counters;
+	const struct interval_ratio* ratios;
+	int nr_ratios;
+
+	struct interval_sample ring[INTERVAL_RING];
+	atomic_ullong head;				/* Samples taken */
+	atomic_ullong tail;				/* Samples written */
+	struct interval_sample last;	/* The writer subtracts it from the next one */
+
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;			/* The writer has work */
+	pthread_cond_t space;			/* The simulator may go on */
+	bool closing;
+};
+
+static inline void __interval_write(struct interval* iv, const struct interval_sample* s)
+{
+	unsigned long long delta[INTERVAL_MAX_COUNTERS + 1];
+
+	delta[0] = s->time - iv->last.time;
+	for (int i = 0; i < iv->nr_counters; i++) delta[i + 1] = s->values[i] - iv->last.values[i];
+
+	fprintf(iv->file, "%llu", s->time);
+	for (int i = 0; i < iv->nr_counters; i++) fprintf(iv->file, ",%llu", delta[i + 1]);
+	for (int i = 0; i < iv->nr_ratios; i++) {
+		unsigned long long den = delta[iv->ratios[i].den + 1];
+
+		fprintf(iv->file, ",%.4f", den ? (double)delta[iv->ratios[i].num + 1] / den : 0.0);
+	}
+	fprintf(iv->file, "\n");
+	iv->last = *s;
+}
+
+static inline void* __interval_writer(void* arg)
+{
+	struct interval* iv = arg;
+
+	while (true) {
+		unsigned long long tail = atomic_load_explicit(&iv->tail, memory_order_relaxed);
+		unsigned long long head;
+
+		pthread_mutex_lock(&iv->lock);
+		if (tail == atomic_load_explicit(&iv->head, memory_order_acquire)) {
+			struct timespec until;
+
+			if (iv->closing) {
+				pthread_mutex_unlock(&iv->lock);
+				break;
+			}
+			timespec_get(&until, TIME_UTC);
+			until.tv_nsec += INTERVAL_WAKEUP_MS * 1000000L;
+			until.tv_sec += until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&iv->wake, &iv->lock, &until);
+		}
+		pthread_mutex_unlock(&iv->lock);
+
+		head = atomic_load_explicit(&iv->head, memory_order_acquire);
+		if (tail == head) continue;
+
+		for (; tail != head; tail++) __interval_write(iv, &iv->ring[tail % INTERVAL_RING]);
+		fflush(iv->file);
+
+		atomic_store_explicit(&iv->tail, tail, memory_order_release);
+		pthread_mutex_lock(&iv->lock);
+		pthread_cond_signal(&iv->space);
+		pthread_mutex_unlock(&iv->lock);
+	}
+	return NULL;
+}
+
+/***********************************************************************
+ * interval_open(iv, filename, period, time_name, names, nr_counters,
+ *               ratios, nr_ratios)
+ *
+ * DESCRIPTION
+ *   Start writing the intervals of @period to @filename. The CSV header
+ *   is @time_name, the @names of the counters and the names of the
+ *   @ratios. @names and @ratios have to stay around until interval_close().
+ *
+ * RETURN VALUE
+ *   false if @filename cannot be written or the writer cannot be started
+ */
+static inline bool interval_open(struct interval* iv, const char* filename, unsigned long long period,
+	const char* time_name, const char* const* names, int nr_counters,
+	const struct interval_ratio* ratios, int nr_ratios)
+{
+	memset(iv, 0, sizeof(*iv));
+	iv->file = fopen(filename, "w");
+	if (!iv->file) return false;
+
+	iv->period = period ? period : 1;
+	iv->next = iv->period;
+	iv->nr_counters = nr_counters < INTERVAL_MAX_COUNTERS ? nr_counters : INTERVAL_MAX_COUNTERS;
+	iv->ratios = ratios;
+	iv->nr_ratios = nr_ratios < INTERVAL_MAX_RATIOS ? nr_ratios : INTERVAL_MAX_RATIOS;
+
+	fprintf(iv->file, "%s", time_name);
+	for (int i = 0; i < iv->nr_counters; i++) fprintf(iv->file, ",%s", names[i]);
+	for (int i = 0; i < iv->nr_ratios; i++) fprintf(iv->file, ",%s", ratios[i].name);
+	fprintf(iv->file, "\n");
+
+	atomic_init(&iv->head, 0);
+	atomic_init(&iv->tail, 0);
+	pthread_mutex_init(&iv->lock, NULL);
+	pthread_cond_init(&iv->wake, NULL);
+	pthread_cond_init(&iv->space, NULL);
+	if (pthread_create(&iv->writer, NULL, __interval_writer, iv) != 0) {
+		pthread_mutex_destroy(&iv->lock);
+		pthread_cond_destroy(&iv->wake);
+		pthread_cond_destroy(&iv->space);
+		fclose(iv->file);
+		iv->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+/***********************************************************************
+ * interval_sample(iv, time, values)
+ *
+ * DESCRIPTION
+ *   Take the sample of the interval ending at @time, with the running
+ *   counters in @values. Call it once @time reaches @iv->next.
+ */
+static inline void interval_sample(struct interval* iv, unsigned long long time, const unsigned long long* values)
+{
+	unsigned long long head = atomic_load_explicit(&iv->head, memory_order_relaxed);
+	struct interval_sample* s;
+
+	if (head - atomic_load_explicit(&iv->tail, memory_order_acquire) == INTERVAL_RING) {
+		pthread_mutex_lock(&iv->lock);
+		pthread_cond_signal(&iv->wake);
+		while (head - atomic_load_explicit(&iv->tail, memory_order_acquire) == INTERVAL_RING) {
+			pthread_cond_wait(&iv->space, &iv->lock);
+		}
+		pthread_mutex_unlock(&iv->lock);
+	}
+
+	s = &iv->ring[head % INTERVAL_RING];
+	s->time = time;
+	memcpy(s->values, values, iv->nr_counters * sizeof(*values));
+	atomic_store_explicit(&iv->head, head + 1, memory_order_release);
+
+	if ((head + 1) % (INTERVAL_RING / 4) == 0) {
+		pthread_mutex_lock(&iv->lock);
+		pthread_cond_signal(&iv->wake);
+		pthread_mutex_unlock(&iv->lock);
+	}
+	iv->next = time - time % iv->period + iv->period;
+}
+
+/***********************************************************************
+ * interval_close(iv, time, values)
+ *
+ * DESCRIPTION
+ *   Take the sample of the last, partial interval if anything happened
+ *   since the previous one, and wait for the writer to finish the file.
+ */
+static inline void interval_close(struct interval* iv, unsigned long long time, const unsigned long long* values)
+{
+	unsigned long long head;
+
+	if (!iv->file) return;
+
+	head = atomic_load_explicit(&iv->head, memory_order_relaxed);
+	if (time > (head ? iv->ring[(head - 1) % INTERVAL_RING].time : 0)) interval_sample(iv, time, values);
+
+	pthread_mutex_lock(&iv->lock);
+	iv->closing = true;
+	pthread_cond_signal(&iv->wake);
+	pthread_mutex_unlock(&iv->lock);
+	pthread_join(iv->writer, NULL);
+
+	pthread_mutex_destroy(&iv->lock);
+	pthread_cond_destroy(&iv->wake);
+	pthread_cond_destroy(&iv->space);
+	fclose(iv->file);
+	iv->file = NULL;
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef __ISA_H__
+#define __ISA_H__
+
+/**
+ * Instruction set shared by the translator (pa1), the emulator (pa2) and
+ * the pipeline (pa3). Everything here is a constant table so that both
+ * decoding and encoding are a couple of array lookups.
+ *
+ * Besides the MIPS subset there is a packed-SIMD extension that programs
+ * may use or not. The packed instructions take opcode 0x1c (SPECIAL2)
+ * with a funct and treat a register as 4 bytes (b) or 2 halfwords (h):
+ * paddb/paddh and psubb/psubh wrap around, pcmpeqb/pcmpeqh set the equal
+ * lanes to all ones and the others to zero, pminub/pmaxub compare bytes
+ * unsigned and pminsh/pmaxsh halfwords signed. lq and sq move 16 bytes
+ * at the address rounded down to a multiple of 16 between memory and
+ * the four registers from rt on (rt up to 28), the lowest address in rt.
+ */
+
+/**
+ * Operand layouts. The order of the operands follows the assembly syntax
+ * accepted by pa1, e.g., "lw t0 4 sp" and "beq t1 t0 -3".
+ */
+enum isa_layout {
+	LAYOUT_NONE = 0,		/* halt */
+	LAYOUT_RD_RS_RT,		/* add  rd rs rt */
+	LAYOUT_RD_RT_SHAMT,		/* sll  rd rt shamt */
+	LAYOUT_RS_RT,			/* mult rs rt */
+	LAYOUT_RD,				/* mfhi rd */
+	LAYOUT_RS,				/* jr   rs */
+	LAYOUT_RT_RS_SIMM,		/* addi rt rs simm */
+	LAYOUT_RT_RS_UIMM,		/* andi rt rs uimm */
+	LAYOUT_RT_OFF_RS,		/* lw   rt offset rs */
+	LAYOUT_RT_RS_BOFF,		/* beq  rt rs offset */
+	LAYOUT_TARGET,			/* j    target address */
+};
+
+enum isa_id {
+	ISA_INVALID = 0,
+	ISA_ADD, ISA_SUB, ISA_AND, ISA_OR, ISA_NOR, ISA_SLT,
+	ISA_SLL, ISA_SRL, ISA_SRA,
+	ISA_MULT, ISA_MFHI, ISA_MFLO, ISA_JR,
+	ISA_ADDI, ISA_ANDI, ISA_ORI, ISA_SLTI,
+	ISA_LW, ISA_SW, ISA_LBU,
+	ISA_LL, ISA_SC,
+	ISA_BEQ, ISA_BNE,
+	ISA_J, ISA_JAL,
+	ISA_SYSCALL, ISA_HALT,
+	ISA_PADDB, ISA_PADDH, ISA_PSUBB, ISA_PSUBH,
+	ISA_PCMPEQB, ISA_PCMPEQH,
+	ISA_PMINUB, ISA_PMAXUB, ISA_PMINSH, ISA_PMAXSH,
+	ISA_LQ, ISA_SQ,
+	NR_ISA,
+};
+
+#define ISA_SPECIAL2	0x1c	/* Opcode of the packed instructions */
+
+struct isa_entry {
+	const char* name;
+	unsigned char opcode;
+	unsigned char funct;	/* Valid only when @opcode is 0 or ISA_SPECIAL2 */
+	unsigned char layout;
+};
+
+static const struct isa_entry isa_table[NR_ISA] = {
+	[ISA_INVALID] = { NULL,   0x00, 0x00, LAYOUT_NONE },
+	[ISA_ADD]     = { "add",  0x00, 0x20, LAYOUT_RD_RS_RT },
+	[ISA_SUB]     = { "sub",  0x00, 0x22, LAYOUT_RD_RS_RT },
+	[ISA_AND]     = { "and",  0x00, 0x24, LAYOUT_RD_RS_RT },
+	[ISA_OR]      = { "or",   0x00, 0x25, LAYOUT_RD_RS_RT },
+	[ISA_NOR]     = { "nor",  0x00, 0x27, LAYOUT_RD_RS_RT },
+	[ISA_SLT]     = { "slt",  0x00, 0x2a, LAYOUT_RD_RS_RT },
+	[ISA_SLL]     = { "sll",  0x00, 0x00, LAYOUT_RD_RT_SHAMT },
+	[ISA_SRL]     = { "srl",  0x00, 0x02, LAYOUT_RD_RT_SHAMT },
+	[ISA_SRA]     = { "sra",  0x00, 0x03, LAYOUT_RD_RT_SHAMT },
+	[ISA_MULT]    = { "mult", 0x00, 0x18, LAYOUT_RS_RT },
+	[ISA_MFHI]    = { "mfhi", 0x00, 0x10, LAYOUT_RD },
+	[ISA_MFLO]    = { "mflo", 0x00, 0x12, LAYOUT_RD },
+	[ISA_JR]      = { "jr",   0x00, 0x08, LAYOUT_RS },
+	[ISA_ADDI]    = { "addi", 0x08, 0x00, LAYOUT_RT_RS_SIMM },
+	[ISA_ANDI]    = { "andi", 0x0c, 0x00, LAYOUT_RT_RS_UIMM },
+	[ISA_ORI]     = { "ori",  0x0d, 0x00, LAYOUT_RT_RS_UIMM },
+	[ISA_SLTI]    = { "slti", 0x0a, 0x00, LAYOUT_RT_RS_SIMM },
+	[ISA_LW]      = { "lw",   0x23, 0x00, LAYOUT_RT_OFF_RS },
+	[ISA_SW]      = { "sw",   0x2b, 0x00, LAYOUT_RT_OFF_RS },
+	[ISA_LBU]     = { "lbu",  0x24, 0x00, LAYOUT_RT_OFF_RS },
+	[ISA_LL]      = { "ll",   0x30, 0x00, LAYOUT_RT_OFF_RS },
+	[ISA_SC]      = { "sc",   0x38, 0x00, LAYOUT_RT_OFF_RS },
+	[ISA_BEQ]     = { "beq",  0x04, 0x00, LAYOUT_RT_RS_BOFF },
+	[ISA_BNE]     = { "bne",  0x05, 0x00, LAYOUT_RT_RS_BOFF },
+	[ISA_J]       = { "j",    0x02, 0x00, LAYOUT_TARGET },
+	[ISA_JAL]     = { "jal",  0x03, 0x00, LAYOUT_TARGET },
+	[ISA_SYSCALL] = { "syscall", 0x00, 0x0c, LAYOUT_NONE },
+	[ISA_HALT]    = { "halt", 0x3f, 0x00, LAYOUT_NONE },
+	[ISA_PADDB]   = { "paddb",   ISA_SPECIAL2, 0x10, LAYOUT_RD_RS_RT },
+	[ISA_PADDH]   = { "paddh",   ISA_SPECIAL2, 0x11, LAYOUT_RD_RS_RT },
+	[ISA_PSUBB]   = { "psubb",   ISA_SPECIAL2, 0x12, LAYOUT_RD_RS_RT },
+	[ISA_PSUBH]   = { "psubh",   ISA_SPECIAL2, 0x13, LAYOUT_RD_RS_RT },
+	[ISA_PCMPEQB] = { "pcmpeqb", ISA_SPECIAL2, 0x14, LAYOUT_RD_RS_RT },
+	[ISA_PCMPEQH] = { "pcmpeqh", ISA_SPECIAL2, 0x15, LAYOUT_RD_RS_RT },
+	[ISA_PMINUB]  = { "pminub",  ISA_SPECIAL2, 0x18, LAYOUT_RD_RS_RT },
+	[ISA_PMAXUB]  = { "pmaxub",  ISA_SPECIAL2, 0x19, LAYOUT_RD_RS_RT },
+	[ISA_PMINSH]  = { "pminsh",  ISA_SPECIAL2, 0x1a, LAYOUT_RD_RS_RT },
+	[ISA_PMAXSH]  = { "pmaxsh",  ISA_SPECIAL2, 0x1b, LAYOUT_RD_RS_RT },
+	[ISA_LQ]      = { "lq",   0x36, 0x00, LAYOUT_RT_OFF_RS },
+	[ISA_SQ]      = { "sq",   0x3e, 0x00, LAYOUT_RT_OFF_RS },
+};
+
+/* opcode -> instruction for non-zero opcodes */
+static const unsigned char isa_primary[64] = {
+	[0x02] = ISA_J,    [0x03] = ISA_JAL,
+	[0x04] = ISA_BEQ,  [0x05] = ISA_BNE,
+	[0x08] = ISA_ADDI, [0x0a] = ISA_SLTI,
+	[0x0c] = ISA_ANDI, [0x0d] = ISA_ORI,
+	[0x23] = ISA_LW,   [0x24] = ISA_LBU,
+	[0x2b] = ISA_SW,   [0x30] = ISA_LL,
+	[0x36] = ISA_LQ,   [0x38] = ISA_SC,
+	[0x3e] = ISA_SQ,   [0x3f] = ISA_HALT,
+};
+
+/* funct -> instruction for opcode 0 */
+static const unsigned char isa_special[64] = {
+	[0x00] = ISA_SLL,  [0x02] = ISA_SRL,  [0x03] = ISA_SRA,
+	[0x08] = ISA_JR,   [0x0c] = ISA_SYSCALL,
+	[0x10] = ISA_MFHI, [0x12] = ISA_MFLO, [0x18] = ISA_MULT,
+	[0x20] = ISA_ADD,  [0x22] = ISA_SUB,
+	[0x24] = ISA_AND,  [0x25] = ISA_OR,   [0x27] = ISA_NOR,
+	[0x2a] = ISA_SLT,
+};
+
+/* funct -> instruction for ISA_SPECIAL2 */
+static const unsigned char isa_special2[64] = {
+	[0x10] = ISA_PADDB,   [0x11] = ISA_PADDH,
+	[0x12] = ISA_PSUBB,   [0x13] = ISA_PSUBH,
+	[0x14] = ISA_PCMPEQB, [0x15] = ISA_PCMPEQH,
+	[0x18] = ISA_PMINUB,  [0x19] = ISA_PMAXUB,
+	[0x1a] = ISA_PMINSH,  [0x1b] = ISA_PMAXSH,
+};
+
+/**
+ * Register names in the pa1 syntax. pa2 calls $zero "zr", which the
+ * translator accepts as well.
+ */
+static const char* const isa_register_names[32] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+static inline enum isa_id isa_decode(unsigned int instr)
+{
+	unsigned int opcode = instr >> 26;
+
+	if (opcode == ISA_SPECIAL2) return (enum isa_id)isa_special2[instr & 0x3f];
+	if (opcode) return (enum isa_id)isa_primary[opcode];
+	return (enum isa_id)isa_special[instr & 0x3f];
+}
+
+#define ISA_RS(instr)		(((instr) >> 21) & 0x1f)
+#define ISA_RT(instr)		(((instr) >> 16) & 0x1f)
+#define ISA_RD(instr)		(((instr) >> 11) & 0x1f)
+#define ISA_SHAMT(instr)	(((instr) >> 6) & 0x1f)
+#define ISA_SIMM(instr)		((int)(short)((instr) & 0xffff))
+#define ISA_UIMM(instr)		((instr) & 0xffff)
+#define ISA_TARGET(instr)	((instr) & 0x03ffffff)
+
+/**
+ * Registers an instruction reads and writes, as bit masks of the register
+ * numbers with hi and lo as ISA_REG_HI and ISA_REG_LO. $zero is never
+ * written. Used by the passes that move or drop instructions.
+ */
+#define ISA_REG_HI	32
+#define ISA_REG_LO	33
+#define ISA_REG(r)	(1ULL << (r))
+
+/* The four registers lq and sq move, none if @rt is past 28 */
+#define ISA_REG_QUAD(rt)	((rt) <= 28 ? 0xfULL << (rt) : 0)
+
+static inline unsigned long long isa_uses(unsigned int instr)
+{
+	enum isa_id id = isa_decode(instr);
+
+	/* Service number and arguments, see common/syscall.h */
+	if (id == ISA_SYSCALL) return ISA_REG(2) | ISA_REG(4) | ISA_REG(5) | ISA_REG(6);
+
+	switch (isa_table[id].layout) {
+	case LAYOUT_RD_RS_RT:
+	case LAYOUT_RS_RT:
+	case LAYOUT_RT_RS_BOFF:
+		return ISA_REG(ISA_RS(instr)) | ISA_REG(ISA_RT(instr));
+	case LAYOUT_RD_RT_SHAMT:
+		return ISA_REG(ISA_RT(instr));
+	case LAYOUT_RD:
+		return ISA_REG(id == ISA_MFHI ? ISA_REG_HI : ISA_REG_LO);
+	case LAYOUT_RS:
+	case LAYOUT_RT_RS_SIMM:
+	case LAYOUT_RT_RS_UIMM:
+		return ISA_REG(ISA_RS(instr));
+	case LAYOUT_RT_OFF_RS:
+		if (id == ISA_SW || id == ISA_SC) return ISA_REG(ISA_RS(instr)) | ISA_REG(ISA_RT(instr));
+		if (id == ISA_SQ) return ISA_REG(ISA_RS(instr)) | ISA_REG_QUAD(ISA_RT(instr));
+		return ISA_REG(ISA_RS(instr));
+	default:
+		return 0;
+	}
+}
+
+static inline unsigned long long isa_defs(unsigned int instr)
+{
+	enum isa_id id = isa_decode(instr);
+	unsigned long long defs;
+
+	switch (isa_table[id].layout) {
+	case LAYOUT_RD_RS_RT:
+	case LAYOUT_RD_RT_SHAMT:
+	case LAYOUT_RD:
+		defs = ISA_REG(ISA_RD(instr));
+		break;
+	case LAYOUT_RS_RT:
+		return ISA_REG(ISA_REG_HI) | ISA_REG(ISA_REG_LO);
+	case LAYOUT_RT_RS_SIMM:
+	case LAYOUT_RT_RS_UIMM:
+		defs = ISA_REG(ISA_RT(instr));
+		break;
+	case LAYOUT_RT_OFF_RS:
+		if (id == ISA_SW || id == ISA_SQ) return 0;
+		defs = id == ISA_LQ ? ISA_REG_QUAD(ISA_RT(instr)) : ISA_REG(ISA_RT(instr));
+		break;
+	case LAYOUT_TARGET:
+		return id == ISA_JAL ? ISA_REG(31) : 0;
+	default:
+		return id == ISA_SYSCALL ? ISA_REG(2) : 0;
+	}
+	return defs & ~ISA_REG(0);
+}
+
+#endif
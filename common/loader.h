@@ -0,0 +1,69 @@
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "asm.h"
+#include "core.h"
+#include "tokenize.h"
+
+/***********************************************************************
+ * load_image(memory, start_addr, filename)
+ *
+ * DESCRIPTION
+ *   Load the program in @filename onto @memory starting at @start_addr in
+ *   big endian. Each line is either a machine instruction (with or without
+ *   the 0x prefix) or a line of assembly, optionally followed by "//" or
+ *   "#" comments. This is the format pa2's load command accepts. Lines
+ *   that are neither are reported on stderr and loaded as 0.
+ *
+ * RETURN VALUE
+ *   Number of loaded instructions, or -1 if @filename cannot be opened
+ */
+static inline int load_image(unsigned char* memory, unsigned int start_addr, const char* filename)
+{
+	FILE* file = fopen(filename, "r");
+	struct arena arena = { NULL };
+	unsigned int addr = start_addr;
+	char** tokens;
+	int nr_tokens;
+	int line = 0;
+
+	if (!file) return -1;
+
+	while ((nr_tokens = read_tokens(&arena, file, TOKENIZE_LOWER | TOKENIZE_COMMENTS, &tokens)) >= 0) {
+		unsigned int instr = 0;
+		bool ok = true;
+
+		line++;
+
+		/* "add" is also a hexadecimal number, so check mnemonics first */
+		if (nr_tokens > 0 && asm_lookup(tokens[0]) != ISA_INVALID) {
+			ok = assemble(nr_tokens, tokens, &instr);
+		}
+		else if (nr_tokens > 0) {
+			char* end;
+
+			instr = strtoul(tokens[0], &end, 16);
+			ok = nr_tokens == 1 && end != tokens[0] && *end == '\0';
+		}
+		if (!ok) {
+			fprintf(stderr, "%s:%d: unable to translate \"%s", filename, line, tokens[0]);
+			for (int i = 1; i < nr_tokens; i++) fprintf(stderr, " %s", tokens[i]);
+			fprintf(stderr, "\"\n");
+			instr = 0;
+		}
+		arena_reset(&arena);
+
+		core_store_word(memory, addr, instr);
+		addr += 4;
+	}
+
+	arena_destroy(&arena);
+	fclose(file);
+
+	return (addr - start_addr) / 4;
+}
+
+#endif
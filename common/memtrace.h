@@ -0,0 +1,116 @@
+#ifndef __MEMTRACE_H__
+#define __MEMTRACE_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+
+/**
+ * Memory reference trace written by pa2 and read by tools/stackdist. The
+ * file is MEMTRACE_MAGIC followed by one little-endian 32-bit word per
+ * reference, the kind in the top two bits and the address in the rest.
+ * Addresses are within CORE_MEMORY_SIZE, so nothing is lost.
+ */
+#define MEMTRACE_MAGIC		"MIPSMT01"
+#define MEMTRACE_BUFFER		4096	/* References */
+
+enum memtrace_kind {
+	MEMTRACE_FETCH = 0,
+	MEMTRACE_LOAD,
+	MEMTRACE_STORE,
+	NR_MEMTRACE_KINDS,
+};
+
+#define MEMTRACE_KIND(ref)	((enum memtrace_kind)((ref) >> 30))
+#define MEMTRACE_ADDR(ref)	((ref) & CORE_MEMORY_MASK)
+
+struct memtrace {
+	FILE* file;
+	unsigned int nr_refs;
+	unsigned char buffer[MEMTRACE_BUFFER * 4];
+	unsigned long long counts[NR_MEMTRACE_KINDS];
+};
+
+static inline bool memtrace_open(struct memtrace* mt, const char* filename)
+{
+	memset(mt, 0, sizeof(*mt));
+	mt->file = fopen(filename, "wb");
+	if (!mt->file) return false;
+
+	fwrite(MEMTRACE_MAGIC, 1, strlen(MEMTRACE_MAGIC), mt->file);
+	return true;
+}
+
+static inline void __memtrace_flush(struct memtrace* mt)
+{
+	fwrite(mt->buffer, 4, mt->nr_refs, mt->file);
+	mt->nr_refs = 0;
+}
+
+static inline void memtrace_close(struct memtrace* mt)
+{
+	if (!mt->file) return;
+
+	__memtrace_flush(mt);
+	fclose(mt->file);
+	mt->file = NULL;
+}
+
+static inline void memtrace_ref(struct memtrace* mt, enum memtrace_kind kind, unsigned int addr)
+{
+	unsigned int ref = ((unsigned int)kind << 30) | (addr & CORE_MEMORY_MASK);
+	unsigned char* p = mt->buffer + mt->nr_refs * 4;
+
+	p[0] = ref;
+	p[1] = ref >> 8;
+	p[2] = ref >> 16;
+	p[3] = ref >> 24;
+	mt->counts[kind]++;
+	if (++mt->nr_refs == MEMTRACE_BUFFER) __memtrace_flush(mt);
+}
+
+/***********************************************************************
+ * memtrace_load(filename, nr_refs)
+ *
+ * DESCRIPTION
+ *   Read the whole trace in @filename.
+ *
+ * RETURN VALUE
+ *   The references (to be freed by the caller) with their number in
+ *   @nr_refs, or NULL if @filename is not a readable trace
+ */
+static inline unsigned int* memtrace_load(const char* filename, size_t* nr_refs)
+{
+	FILE* file = fopen(filename, "rb");
+	char magic[sizeof(MEMTRACE_MAGIC)] = { 0 };
+	unsigned int* refs = NULL;
+	long len;
+
+	if (!file) return NULL;
+
+	if (fread(magic, 1, strlen(MEMTRACE_MAGIC), file) != strlen(MEMTRACE_MAGIC) ||
+		strcmp(magic, MEMTRACE_MAGIC) != 0 || fseek(file, 0, SEEK_END) != 0 || (len = ftell(file)) < 0) {
+		fclose(file);
+		return NULL;
+	}
+
+	*nr_refs = (len - strlen(MEMTRACE_MAGIC)) / 4;
+	fseek(file, strlen(MEMTRACE_MAGIC), SEEK_SET);
+	refs = malloc((*nr_refs ? *nr_refs : 1) * sizeof(*refs));
+	if (refs) {
+		*nr_refs = fread(refs, 4, *nr_refs, file);
+		for (size_t i = 0; i < *nr_refs; i++) {
+			const unsigned char* p = (const unsigned char*)&refs[i];
+
+			refs[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+		}
+	}
+	fclose(file);
+
+	return refs;
+}
+
+#endif
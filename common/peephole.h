@@ -0,0 +1,321 @@
+#ifndef __PEEPHOLE_H__
+#define __PEEPHOLE_H__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "isa.h"
+#include "sched.h"
+
+/**
+ * Peephole optimizer and dead-code elimination over a translated program.
+ * The rewrites are applied over and over until none of them changes
+ * anything:
+ *
+ *  - Copy propagation within a basic block. After a move such as
+ *    "add rd rs zero", "or rd rs zero" or "addi rd rs 0", later reads of
+ *    rd read rs instead, until either of them is written again.
+ *  - Store-to-load forwarding within a block. "lw rt off(base)" right
+ *    after "sw rs off(base)" with nothing stored in between becomes the
+ *    move "add rt rs zero", which copy propagation then takes apart.
+ *  - Dead-code elimination with liveness over the control flow graph.
+ *    Instructions without side effects whose results are not live are
+ *    dropped, which covers writes to $zero and the moves nobody reads any
+ *    more, and so are moves of a register to itself ("addi rx rx 0").
+ *
+ * Removed instructions shift the rest of the program, so branch offsets
+ * and j/jal targets (loaded at SCHED_BASE) are rewritten at the end. At a
+ * halt, the registers in @live_at_halt are live since the simulators show
+ * them; everything is live wherever control goes somewhere unknown (jr,
+ * jal, the end of the program).
+ */
+#define PEEPHOLE_ALL_LIVE	(((1ULL << (ISA_REG_LO + 1)) - 1) & ~ISA_REG(0))
+#define PEEPHOLE_MAX_ROUNDS	16
+
+struct peephole_stats {
+	unsigned int propagated;	/* Register reads rewritten by copy propagation */
+	unsigned int forwarded;		/* Reloads turned into moves */
+	unsigned int removed;		/* Instructions eliminated */
+};
+
+/* Replace the source register @from of @instr with @to */
+static inline unsigned int __peephole_rename(unsigned int instr, unsigned int from, unsigned int to)
+{
+	enum isa_id id = isa_decode(instr);
+	bool rs = false;
+	bool rt = false;
+
+	switch (isa_table[id].layout) {
+	case LAYOUT_RD_RS_RT:
+	case LAYOUT_RS_RT:
+	case LAYOUT_RT_RS_BOFF:
+		rs = rt = true;
+		break;
+	case LAYOUT_RD_RT_SHAMT:
+		rt = true;
+		break;
+	case LAYOUT_RS:
+	case LAYOUT_RT_RS_SIMM:
+	case LAYOUT_RT_RS_UIMM:
+		rs = true;
+		break;
+	case LAYOUT_RT_OFF_RS:
+		rs = true;
+		rt = id == ISA_SW;	/* sc writes its rt as well, which has to stay where it is */
+		break;
+	default:
+		break;
+	}
+
+	if (rs && ISA_RS(instr) == from) instr = (instr & ~(0x1fU << 21)) | (to << 21);
+	if (rt && ISA_RT(instr) == from) instr = (instr & ~(0x1fU << 16)) | (to << 16);
+	return instr;
+}
+
+/**
+ * If @instr only copies a register, return its source and put the
+ * destination into @dest. Returns -1 otherwise.
+ */
+static inline int __peephole_move(unsigned int instr, unsigned int* dest)
+{
+	enum isa_id id = isa_decode(instr);
+
+	switch (id) {
+	case ISA_ADD:
+	case ISA_OR:
+	case ISA_SUB:
+		*dest = ISA_RD(instr);
+		if (ISA_RT(instr) == 0) return ISA_RS(instr);
+		if (ISA_RS(instr) == 0 && id != ISA_SUB) return ISA_RT(instr);
+		return -1;
+	case ISA_SLL:
+	case ISA_SRL:
+	case ISA_SRA:
+		*dest = ISA_RD(instr);
+		return ISA_SHAMT(instr) == 0 ? (int)ISA_RT(instr) : -1;
+	case ISA_ADDI:
+	case ISA_ORI:
+		*dest = ISA_RT(instr);
+		return ISA_UIMM(instr) == 0 ? (int)ISA_RS(instr) : -1;
+	default:
+		return -1;
+	}
+}
+
+/* Whether dropping @instr changes nothing but the registers it writes */
+static inline bool __peephole_pure(unsigned int instr)
+{
+	enum isa_id id = isa_decode(instr);
+
+	if (id == ISA_INVALID || id == ISA_LL || id == ISA_SC || id == ISA_SW || id == ISA_SQ ||
+		id == ISA_HALT) return false;
+	return !__sched_is_terminator(id);
+}
+
+/* Copy propagation and store-to-load forwarding in the block [start, end) */
+static inline bool __peephole_block(unsigned int* insts, int start, int end, struct peephole_stats* stats)
+{
+	int copy[ISA_REG_LO + 1];				/* copy[r] = s if r holds the value of s */
+	bool stored = false;					/* The last store, while it is still the last */
+	unsigned int store_base = 0, store_value = 0;
+	int store_offset = 0;
+	bool changed = false;
+
+	for (int r = 0; r <= ISA_REG_LO; r++) copy[r] = -1;
+
+	for (int i = start; i < end; i++) {
+		unsigned int instr = insts[i];
+		enum isa_id id;
+		unsigned long long defs;
+		unsigned int dest;
+		int source;
+
+		for (int r = 1; r < 32; r++) {
+			if (copy[r] >= 0 && (isa_uses(instr) & ISA_REG(r))) {
+				instr = __peephole_rename(instr, r, copy[r]);
+			}
+		}
+		if (instr != insts[i]) {
+			stats->propagated++;
+			insts[i] = instr;
+			changed = true;
+		}
+
+		id = isa_decode(instr);
+		if (id == ISA_LW && stored && ISA_RS(instr) == store_base && ISA_SIMM(instr) == store_offset) {
+			instr = asm_encode_r(isa_table[ISA_ADD].funct, store_value, 0, ISA_RT(instr), 0);
+			stats->forwarded++;
+			insts[i] = instr;
+			changed = true;
+			id = ISA_ADD;
+		}
+
+		defs = isa_defs(instr);
+		if (__sched_is_store(id)) stored = false;
+		if (defs & (ISA_REG(store_base) | ISA_REG(store_value))) stored = false;
+		if (id == ISA_SW) {
+			stored = true;
+			store_base = ISA_RS(instr);
+			store_value = ISA_RT(instr);
+			store_offset = ISA_SIMM(instr);
+		}
+
+		/* Forget the copies this instruction breaks, then record its own */
+		for (int r = 1; r <= ISA_REG_LO; r++) {
+			if (copy[r] >= 0 && ((defs & ISA_REG(r)) || (defs & ISA_REG(copy[r])))) copy[r] = -1;
+		}
+		source = __peephole_move(instr, &dest);
+		if (source >= 0 && dest && (unsigned int)source != dest) copy[dest] = source;
+	}
+	return changed;
+}
+
+/* Registers live after each instruction, into @live_out */
+static inline void __peephole_liveness(const unsigned int* insts, int nr_insts, unsigned long long live_at_halt,
+	unsigned long long* live_out)
+{
+	unsigned long long* live_in = calloc(nr_insts + 1, sizeof(*live_in));
+	bool changed = true;
+
+	if (!live_in) {
+		for (int i = 0; i < nr_insts; i++) live_out[i] = PEEPHOLE_ALL_LIVE;
+		return;
+	}
+	live_in[nr_insts] = PEEPHOLE_ALL_LIVE;	/* Falling off the end */
+
+	while (changed) {
+		changed = false;
+
+		for (int i = nr_insts - 1; i >= 0; i--) {
+			unsigned int instr = insts[i];
+			enum isa_id id = isa_decode(instr);
+			unsigned long long out;
+			unsigned long long in;
+			long target;
+
+			switch (isa_table[id].layout) {
+			case LAYOUT_RT_RS_BOFF:
+				target = i + 1 + ISA_SIMM(instr);
+				out = live_in[i + 1] | (target >= 0 && target <= nr_insts ? live_in[target] : PEEPHOLE_ALL_LIVE);
+				break;
+			case LAYOUT_TARGET:
+				target = ((long)ISA_TARGET(instr) * 4 - SCHED_BASE) / 4;
+				if (id == ISA_JAL || target < 0 || target > nr_insts) out = PEEPHOLE_ALL_LIVE;
+				else out = live_in[target];
+				break;
+			default:
+				if (id == ISA_HALT) out = live_at_halt;
+				else if (id == ISA_SYSCALL) out = live_in[i + 1] | live_at_halt;	/* May exit */
+				else if (id == ISA_JR || id == ISA_INVALID) out = PEEPHOLE_ALL_LIVE;
+				else out = live_in[i + 1];
+				break;
+			}
+
+			in = (out & ~isa_defs(instr)) | (isa_uses(instr) & ~ISA_REG(0));
+			if (in != live_in[i] || out != live_out[i]) changed = true;
+			live_in[i] = in;
+			live_out[i] = out;
+		}
+	}
+	free(live_in);
+}
+
+/* Drop the instructions marked in @dead, fixing branch offsets and jump targets */
+static inline int __peephole_compact(unsigned int* insts, int nr_insts, const bool* dead)
+{
+	int* place = malloc((nr_insts + 1) * sizeof(*place));
+	int n = 0;
+
+	if (!place) return nr_insts;
+
+	/* A removed instruction hands its place over to the next one */
+	for (int i = 0; i < nr_insts; i++) {
+		place[i] = n;
+		if (!dead[i]) n++;
+	}
+	place[nr_insts] = n;
+
+	for (int i = 0; i < nr_insts; i++) {
+		unsigned int instr = insts[i];
+		enum isa_id id = isa_decode(instr);
+		long target;
+
+		if (dead[i]) continue;
+
+		if (isa_table[id].layout == LAYOUT_RT_RS_BOFF) {
+			target = i + 1 + ISA_SIMM(instr);
+			if (target >= 0 && target <= nr_insts) {
+				instr = (instr & 0xffff0000) | ((place[target] - (place[i] + 1)) & 0xffff);
+			}
+		}
+		else if (isa_table[id].layout == LAYOUT_TARGET) {
+			target = ((long)ISA_TARGET(instr) * 4 - SCHED_BASE) / 4;
+			if (ISA_TARGET(instr) * 4 >= SCHED_BASE && target <= nr_insts) {
+				instr = (instr & 0xfc000000) | (((SCHED_BASE + place[target] * 4) >> 2) & 0x03ffffff);
+			}
+		}
+		insts[place[i]] = instr;
+	}
+
+	free(place);
+	return n;
+}
+
+/***********************************************************************
+ * peephole_program(insts, nr_insts, live_at_halt, stats)
+ *
+ * DESCRIPTION
+ *   Optimize the program in @insts in place. Registers in @live_at_halt
+ *   (a mask of ISA_REG()) are considered read after the program halts.
+ *
+ * RETURN VALUE
+ *   Number of instructions left
+ */
+static inline int peephole_program(unsigned int* insts, int nr_insts, unsigned long long live_at_halt,
+	struct peephole_stats* stats)
+{
+	bool* leaders = malloc((nr_insts + 1) * sizeof(*leaders));
+	bool* dead = malloc((nr_insts + 1) * sizeof(*dead));
+	unsigned long long* live_out = malloc((nr_insts + 1) * sizeof(*live_out));
+
+	memset(stats, 0, sizeof(*stats));
+	if (!leaders || !dead || !live_out) goto out;
+	memset(live_out, 0, (nr_insts + 1) * sizeof(*live_out));
+
+	for (int round = 0; round < PEEPHOLE_MAX_ROUNDS; round++) {
+		bool changed = false;
+		int n;
+
+		__sched_find_leaders(insts, nr_insts, leaders);
+		for (int start = 0, end; start < nr_insts; start = end) {
+			for (end = start + 1; end < nr_insts && !leaders[end]; end++);
+			if (__peephole_block(insts, start, end, stats)) changed = true;
+		}
+
+		__peephole_liveness(insts, nr_insts, live_at_halt, live_out);
+		for (int i = 0; i < nr_insts; i++) {
+			unsigned int dest = 0;
+
+			dead[i] = __peephole_pure(insts[i]) &&
+				(!(isa_defs(insts[i]) & live_out[i]) || __peephole_move(insts[i], &dest) == (int)dest);
+		}
+
+		n = __peephole_compact(insts, nr_insts, dead);
+		if (n != nr_insts) {
+			stats->removed += nr_insts - n;
+			nr_insts = n;
+			changed = true;
+		}
+		if (!changed) break;
+	}
+
+out:
+	free(leaders);
+	free(dead);
+	free(live_out);
+	return nr_insts;
+}
+
+#endif
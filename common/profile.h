@@ -0,0 +1,349 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "disasm.h"
+
+/**
+ * Guest profiler shared by pa2 and pa3. The simulators report every
+ * retired instruction with profile_retire() and every stall they insert
+ * with profile_stall(). The profiler keeps
+ *
+ *  - per-PC execution counts and stall cycles in flat arrays indexed by
+ *    the word address, so the hot path is a couple of increments, and
+ *  - a calling context tree built from jal (call) and jr $ra (return),
+ *    where each node is one path of calls from the entry point.
+ *
+ * With @period > 1 only every @period-th instruction is counted (and
+ * weighted by @period), while calls and returns are always followed so
+ * that the tree stays right. Stalls are rare and always counted.
+ */
+#define PROFILE_NR_PCS		(CORE_MEMORY_SIZE >> 2)
+#define PROFILE_MAX_DEPTH	128		/* Deeper calls are charged to the caller */
+
+struct profile_node {
+	unsigned int entry;				/* Address of the function */
+	int parent;
+	int child;						/* Latest callee */
+	int sibling;
+	int depth;
+
+	unsigned long long calls;
+	unsigned long long self;		/* Instructions executed in the function */
+	unsigned long long self_stalls;
+	unsigned long long inclusive;	/* self + self_stalls of the whole subtree */
+};
+
+struct profile {
+	unsigned int period;
+	unsigned int countdown;
+
+	unsigned long long* counts;		/* PROFILE_NR_PCS each */
+	unsigned long long* stalls;
+
+	struct profile_node* nodes;		/* nodes[0] is the entry point */
+	int nr_nodes;
+	int max_nodes;
+	int current;
+
+	unsigned long long instructions;	/* Exact, whatever @period is */
+	unsigned long long stall_cycles;
+};
+
+static inline void profile_init(struct profile* prof, unsigned int entry, unsigned int period)
+{
+	memset(prof, 0, sizeof(*prof));
+	prof->period = period ? period : 1;
+	prof->countdown = prof->period;
+	prof->counts = calloc(PROFILE_NR_PCS, sizeof(*prof->counts));
+	prof->stalls = calloc(PROFILE_NR_PCS, sizeof(*prof->stalls));
+	prof->max_nodes = 256;
+	prof->nodes = calloc(prof->max_nodes, sizeof(*prof->nodes));
+	if (!prof->counts || !prof->stalls || !prof->nodes) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	prof->nr_nodes = 1;
+	prof->nodes[0].entry = entry;
+	prof->nodes[0].parent = prof->nodes[0].child = prof->nodes[0].sibling = -1;
+	prof->nodes[0].calls = 1;
+}
+
+static inline void profile_destroy(struct profile* prof)
+{
+	free(prof->counts);
+	free(prof->stalls);
+	free(prof->nodes);
+	memset(prof, 0, sizeof(*prof));
+}
+
+/* Count one in @period instructions from now on. What is counted keeps its weight */
+static inline void profile_set_period(struct profile* prof, unsigned int period)
+{
+	prof->period = period ? period : 1;
+	if (prof->countdown > prof->period) prof->countdown = prof->period;
+}
+
+/* The program starts over from its entry point */
+static inline void profile_rewind(struct profile* prof)
+{
+	prof->current = 0;
+}
+
+static inline void __profile_call(struct profile* prof, unsigned int target)
+{
+	struct profile_node* caller = &prof->nodes[prof->current];
+	int i;
+
+	if (caller->depth >= PROFILE_MAX_DEPTH) return;
+
+	for (i = caller->child; i >= 0; i = prof->nodes[i].sibling) {
+		if (prof->nodes[i].entry == target) break;
+	}
+
+	if (i < 0) {
+		struct profile_node* callee;
+
+		if (prof->nr_nodes == prof->max_nodes) {
+			prof->max_nodes *= 2;
+			prof->nodes = realloc(prof->nodes, prof->max_nodes * sizeof(*prof->nodes));
+			if (!prof->nodes) {
+				fprintf(stderr, "Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			caller = &prof->nodes[prof->current];
+		}
+		i = prof->nr_nodes++;
+		callee = &prof->nodes[i];
+		memset(callee, 0, sizeof(*callee));
+		callee->entry = target;
+		callee->parent = prof->current;
+		callee->child = -1;
+		callee->sibling = caller->child;
+		callee->depth = caller->depth + 1;
+		caller->child = i;
+	}
+
+	prof->nodes[i].calls++;
+	prof->current = i;
+}
+
+/***********************************************************************
+ * profile_retire(prof, pc, instr)
+ *
+ * DESCRIPTION
+ *   Account @instr at @pc, which has just been executed (or retired).
+ */
+static inline void profile_retire(struct profile* prof, unsigned int pc, unsigned int instr)
+{
+	prof->instructions++;
+
+	if (--prof->countdown == 0) {
+		prof->countdown = prof->period;
+		prof->counts[(pc & CORE_MEMORY_MASK) >> 2] += prof->period;
+		prof->nodes[prof->current].self += prof->period;
+	}
+
+	if ((instr >> 26) == isa_table[ISA_JAL].opcode) {
+		__profile_call(prof, ((pc + 4) & 0xf0000000) | (ISA_TARGET(instr) << 2));
+	}
+	else if ((instr & 0xfc1fffff) == isa_table[ISA_JR].funct && ISA_RS(instr) == 31) {
+		if (prof->current > 0) prof->current = prof->nodes[prof->current].parent;
+	}
+}
+
+/* Charge @cycles of stall to the instruction at @pc */
+static inline void profile_stall(struct profile* prof, unsigned int pc, unsigned int cycles)
+{
+	prof->stalls[(pc & CORE_MEMORY_MASK) >> 2] += cycles;
+	prof->nodes[prof->current].self_stalls += cycles;
+	prof->stall_cycles += cycles;
+}
+
+struct __profile_row {
+	unsigned int key;				/* PC or function entry */
+	unsigned long long count;
+	unsigned long long stalls;
+	unsigned long long calls;
+};
+
+static int __profile_compare_rows(const void* a, const void* b)
+{
+	const struct __profile_row* x = a;
+	const struct __profile_row* y = b;
+	unsigned long long wx = x->count + x->stalls;
+	unsigned long long wy = y->count + y->stalls;
+
+	if (wx != wy) return wx > wy ? -1 : 1;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static inline double __profile_percent(const struct profile* prof, unsigned long long weight)
+{
+	unsigned long long total = prof->instructions + prof->stall_cycles;
+
+	return total ? 100.0 * weight / total : 0.0;
+}
+
+/***********************************************************************
+ * profile_report_flat(prof, memory, out, max_rows)
+ *
+ * DESCRIPTION
+ *   Print the @max_rows hottest instructions and the functions sorted by
+ *   instructions plus stall cycles spent in them. @memory is used to
+ *   disassemble the instructions.
+ */
+static inline void profile_report_flat(const struct profile* prof, const unsigned char* memory, FILE* out,
+	int max_rows)
+{
+	struct __profile_row* rows;
+	int nr_rows = 0;
+	char buffer[DISASM_MAX];
+
+	rows = malloc(sizeof(*rows) * (prof->nr_nodes > 4096 ? prof->nr_nodes : 4096));
+
+	fprintf(out, "%llu instructions, %llu stall cycles", prof->instructions, prof->stall_cycles);
+	if (prof->period > 1) fprintf(out, ", sampled every %u instructions", prof->period);
+	fprintf(out, "\n\n%7s %14s %12s  %-10s  %s\n", "%", "instructions", "stalls", "address", "instruction");
+
+	for (unsigned int i = 0; i < PROFILE_NR_PCS; i++) {
+		if (!prof->counts[i] && !prof->stalls[i]) continue;
+
+		if (nr_rows == 4096) {	/* Keep the hottest half */
+			qsort(rows, nr_rows, sizeof(*rows), __profile_compare_rows);
+			nr_rows = 2048;
+		}
+		rows[nr_rows].key = i << 2;
+		rows[nr_rows].count = prof->counts[i];
+		rows[nr_rows].stalls = prof->stalls[i];
+		nr_rows++;
+	}
+	qsort(rows, nr_rows, sizeof(*rows), __profile_compare_rows);
+
+	for (int i = 0; i < nr_rows && i < max_rows; i++) {
+		unsigned int instr = core_load_word(memory, rows[i].key);
+
+		disasm(instr, rows[i].key, buffer);
+		fprintf(out, "%6.2f%% %14llu %12llu  0x%08x  %s\n",
+			__profile_percent(prof, rows[i].count + rows[i].stalls),
+			rows[i].count, rows[i].stalls, rows[i].key, buffer);
+	}
+
+	/* The same function may show up in many contexts */
+	nr_rows = 0;
+	for (int i = 0; i < prof->nr_nodes; i++) {
+		const struct profile_node* node = &prof->nodes[i];
+		int j;
+
+		for (j = 0; j < nr_rows && rows[j].key != node->entry; j++);
+		if (j == nr_rows) {
+			memset(&rows[nr_rows++], 0, sizeof(*rows));
+			rows[j].key = node->entry;
+		}
+		rows[j].count += node->self;
+		rows[j].stalls += node->self_stalls;
+		rows[j].calls += node->calls;
+	}
+	qsort(rows, nr_rows, sizeof(*rows), __profile_compare_rows);
+
+	fprintf(out, "\n%7s %14s %12s %10s  %s\n", "%", "self insts", "self stalls", "calls", "function");
+	for (int i = 0; i < nr_rows && i < max_rows; i++) {
+		fprintf(out, "%6.2f%% %14llu %12llu %10llu  0x%08x\n",
+			__profile_percent(prof, rows[i].count + rows[i].stalls),
+			rows[i].count, rows[i].stalls, rows[i].calls, rows[i].key);
+	}
+
+	free(rows);
+}
+
+/* Children come after their parents in @nodes, so sum up backwards */
+static inline void __profile_sum_inclusive(struct profile* prof)
+{
+	for (int i = 0; i < prof->nr_nodes; i++) {
+		prof->nodes[i].inclusive = prof->nodes[i].self + prof->nodes[i].self_stalls;
+	}
+	for (int i = prof->nr_nodes - 1; i > 0; i--) {
+		prof->nodes[prof->nodes[i].parent].inclusive += prof->nodes[i].inclusive;
+	}
+}
+
+static inline void __profile_print_node(const struct profile* prof, int i, FILE* out)
+{
+	const struct profile_node* node = &prof->nodes[i];
+	int* children;
+	int nr_children = 0;
+
+	fprintf(out, "%6.2f%% %6.2f%% %10llu  %*s0x%08x\n",
+		__profile_percent(prof, node->inclusive),
+		__profile_percent(prof, node->self + node->self_stalls),
+		node->calls, node->depth * 2, "", node->entry);
+
+	for (int child = node->child; child >= 0; child = prof->nodes[child].sibling) nr_children++;
+	if (!nr_children) return;
+
+	/* Hottest callees first */
+	children = malloc(sizeof(*children) * nr_children);
+	nr_children = 0;
+	for (int child = node->child; child >= 0; child = prof->nodes[child].sibling) {
+		int j;
+
+		for (j = nr_children; j > 0 && prof->nodes[children[j - 1]].inclusive < prof->nodes[child].inclusive; j--) {
+			children[j] = children[j - 1];
+		}
+		children[j] = child;
+		nr_children++;
+	}
+	for (int j = 0; j < nr_children; j++) {
+		__profile_print_node(prof, children[j], out);
+	}
+	free(children);
+}
+
+/***********************************************************************
+ * profile_report_tree(prof, out)
+ *
+ * DESCRIPTION
+ *   Print the calling context tree with the inclusive and self shares of
+ *   each node, the hottest callees first and indented under their callers.
+ */
+static inline void profile_report_tree(struct profile* prof, FILE* out)
+{
+	__profile_sum_inclusive(prof);
+
+	fprintf(out, "%7s %7s %10s  %s\n", "total", "self", "calls", "function");
+	__profile_print_node(prof, 0, out);
+}
+
+static inline void __profile_fold(const struct profile* prof, int i, char* path, size_t len, FILE* out)
+{
+	const struct profile_node* node = &prof->nodes[i];
+
+	len += sprintf(path + len, "%s0x%08x", len ? ";" : "", node->entry);
+	if (node->self + node->self_stalls) {
+		fprintf(out, "%s %llu\n", path, node->self + node->self_stalls);
+	}
+	for (int child = node->child; child >= 0; child = prof->nodes[child].sibling) {
+		__profile_fold(prof, child, path, len, out);
+	}
+}
+
+/***********************************************************************
+ * profile_report_folded(prof, out)
+ *
+ * DESCRIPTION
+ *   Print one line per calling context in the folded stack format of
+ *   flamegraph.pl, weighted by instructions plus stall cycles.
+ */
+static inline void profile_report_folded(const struct profile* prof, FILE* out)
+{
+	char path[(PROFILE_MAX_DEPTH + 1) * 11 + 1];
+
+	__profile_fold(prof, 0, path, 0, out);
+}
+
+#endif
@@ -0,0 +1,451 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+
+/**
+ * Record-and-replay log shared by pa2 and pa3. A run is deterministic
+ * except for what comes from outside, so the log keeps exactly that:
+ * commands, program images and input. Every @period instructions (pa2) or
+ * cycles (pa3) the state is hashed into the log, which lets a replay check
+ * that it is still on the recorded path. Every @checkpoint_every-th hash
+ * is a checkpoint that also holds the registers and the memory blocks
+ * changed since the previous checkpoint, so a replay can seek without
+ * executing from the beginning. "Registers" are whatever state words the
+ * simulator passes besides memory; pa2 adds the heap end and the open
+ * files of its system calls (syscall_save() of common/syscall.h).
+ *
+ * The log is a header followed by records of a one-byte tag, a varint
+ * length and the payload. Numbers are varints, hashes and registers are
+ * little endian. Memory is written as the REPLAY_BLOCK-byte blocks that
+ * differ from a base.
+ */
+#define REPLAY_MAGIC		"MIPSRR01"
+#define REPLAY_BLOCK		256
+
+enum replay_tag {
+	REPLAY_COMMAND = 1,		/* Command line (pa2) */
+	REPLAY_IMAGE,			/* Memory written by loading a program */
+	REPLAY_INPUT,			/* Bytes the guest got from outside */
+	REPLAY_HASH,			/* count, hash */
+	REPLAY_CHECKPOINT,		/* count, hash, registers, memory since the last checkpoint */
+};
+
+struct replay {
+	FILE* file;
+	bool recording;
+	char kind;						/* '2' or '3', who made the log */
+	unsigned long long period;
+	unsigned int checkpoint_every;
+	long data_start;				/* Offset of the first record */
+
+	unsigned long long count;		/* Instructions or cycles so far */
+	unsigned long long next;		/* count of the next state hash */
+	unsigned long long nr_hashes;
+	unsigned char* shadow;			/* Memory at the last checkpoint */
+
+	unsigned char* data;			/* Record being built or just read */
+	size_t len;
+	size_t size;
+	size_t pos;						/* Read position in @data */
+	int tag;
+	long offset;					/* Of the record just read */
+};
+
+static inline void __replay_reserve(struct replay* rr, size_t len)
+{
+	if (rr->len + len <= rr->size) return;
+
+	while (rr->len + len > rr->size) rr->size = rr->size ? rr->size * 2 : 4096;
+	rr->data = realloc(rr->data, rr->size);
+	if (!rr->data) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static inline void __replay_put(struct replay* rr, const void* data, size_t len)
+{
+	__replay_reserve(rr, len);
+	memcpy(rr->data + rr->len, data, len);
+	rr->len += len;
+}
+
+static inline void __replay_put_varint(struct replay* rr, unsigned long long value)
+{
+	unsigned char byte;
+
+	do {
+		byte = value & 0x7f;
+		value >>= 7;
+		if (value) byte |= 0x80;
+		__replay_put(rr, &byte, 1);
+	} while (value);
+}
+
+static inline void __replay_put_le(struct replay* rr, unsigned long long value, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		unsigned char byte = value >> (i * 8);
+
+		__replay_put(rr, &byte, 1);
+	}
+}
+
+static inline unsigned long long __replay_get_varint(struct replay* rr)
+{
+	unsigned long long value = 0;
+
+	for (int shift = 0; rr->pos < rr->len && shift < 64; shift += 7) {
+		unsigned char byte = rr->data[rr->pos++];
+
+		value |= (unsigned long long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) break;
+	}
+	return value;
+}
+
+static inline unsigned long long __replay_get_le(struct replay* rr, int bytes)
+{
+	unsigned long long value = 0;
+
+	for (int i = 0; i < bytes && rr->pos < rr->len; i++) {
+		value |= (unsigned long long)rr->data[rr->pos++] << (i * 8);
+	}
+	return value;
+}
+
+static inline void __varint_write(FILE* file, unsigned long long value)
+{
+	do {
+		fputc((value & 0x7f) | (value > 0x7f ? 0x80 : 0), file);
+		value >>= 7;
+	} while (value);
+}
+
+static inline bool __varint_read(FILE* file, unsigned long long* value)
+{
+	int byte;
+
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if ((byte = fgetc(file)) == EOF) return false;
+		*value |= (unsigned long long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+/* Write out the record built in @rr->data */
+static inline void __replay_flush(struct replay* rr, enum replay_tag tag)
+{
+	fputc(tag, rr->file);
+	__varint_write(rr->file, rr->len);
+	fwrite(rr->data, 1, rr->len, rr->file);
+	rr->len = 0;
+}
+
+/***********************************************************************
+ * replay_read(rr)
+ *
+ * DESCRIPTION
+ *   Read the next record of the log into @rr->data.
+ *
+ * RETURN VALUE
+ *   Tag of the record, or -1 at the end of the log
+ */
+static inline int replay_read(struct replay* rr)
+{
+	unsigned long long len;
+	int tag;
+
+	rr->offset = ftell(rr->file);
+	if ((tag = fgetc(rr->file)) == EOF || !__varint_read(rr->file, &len)) return rr->tag = -1;
+
+	rr->len = 0;
+	__replay_reserve(rr, len);
+	if (fread(rr->data, 1, len, rr->file) != len) return rr->tag = -1;
+	rr->len = len;
+	rr->pos = 0;
+
+	return rr->tag = tag;
+}
+
+/* Hash of the registers and the memory, FNV-1a over 64-bit words */
+static inline unsigned long long replay_hash(const unsigned int* regs, int nr_regs, const unsigned char* memory)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for (int i = 0; i < nr_regs; i++) {
+		hash = (hash ^ regs[i]) * 1099511628211ULL;
+	}
+	for (size_t i = 0; i < CORE_MEMORY_SIZE; i += 8) {
+		unsigned long long word;
+
+		memcpy(&word, memory + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Put the blocks of @memory that differ from @base, and bring @base up to date */
+static inline void __replay_put_memory(struct replay* rr, const unsigned char* memory, unsigned char* base)
+{
+	unsigned long long nr_blocks = 0;
+	unsigned long long last = 0;
+
+	for (size_t i = 0; i < CORE_MEMORY_SIZE; i += REPLAY_BLOCK) {
+		if (memcmp(memory + i, base + i, REPLAY_BLOCK)) nr_blocks++;
+	}
+	__replay_put_varint(rr, nr_blocks);
+
+	for (size_t i = 0; i < CORE_MEMORY_SIZE / REPLAY_BLOCK; i++) {
+		const unsigned char* block = memory + i * REPLAY_BLOCK;
+
+		if (!memcmp(block, base + i * REPLAY_BLOCK, REPLAY_BLOCK)) continue;
+
+		__replay_put_varint(rr, i - last);
+		__replay_put(rr, block, REPLAY_BLOCK);
+		memcpy(base + i * REPLAY_BLOCK, block, REPLAY_BLOCK);
+		last = i;
+	}
+}
+
+static inline void __replay_get_memory(struct replay* rr, unsigned char* memory)
+{
+	unsigned long long nr_blocks = __replay_get_varint(rr);
+	unsigned long long block = 0;
+
+	for (unsigned long long i = 0; i < nr_blocks && rr->pos + REPLAY_BLOCK <= rr->len; i++) {
+		block += __replay_get_varint(rr);
+		if (block >= CORE_MEMORY_SIZE / REPLAY_BLOCK) break;
+		memcpy(memory + block * REPLAY_BLOCK, rr->data + rr->pos, REPLAY_BLOCK);
+		rr->pos += REPLAY_BLOCK;
+	}
+}
+
+/***********************************************************************
+ * replay_open(rr, filename, recording, kind, period, memory)
+ *
+ * DESCRIPTION
+ *   Start recording into @filename, hashing the state every @period, or
+ *   open @filename for replay (the period then comes from the log). @kind
+ *   tells pa2 ('2') and pa3 ('3') logs apart. @memory is the memory at
+ *   the start, which the first checkpoint is taken against.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if the log cannot be opened or is not a @kind log
+ */
+static inline int replay_open(struct replay* rr, const char* filename, bool recording, char kind,
+	unsigned long long period, const unsigned char* memory)
+{
+	char magic[sizeof(REPLAY_MAGIC)] = { 0 };
+
+	memset(rr, 0, sizeof(*rr));
+	rr->recording = recording;
+	rr->kind = kind;
+	rr->period = period ? period : 1;
+	rr->checkpoint_every = 8;
+
+	if (!(rr->file = fopen(filename, recording ? "wb" : "rb"))) return -1;
+
+	if (recording) {
+		fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC) - 1, rr->file);
+		fputc(kind, rr->file);
+		__varint_write(rr->file, rr->period);
+		__varint_write(rr->file, rr->checkpoint_every);
+
+		rr->shadow = malloc(CORE_MEMORY_SIZE);
+		if (!rr->shadow) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(rr->shadow, memory, CORE_MEMORY_SIZE);
+	}
+	else {
+		unsigned long long every;
+
+		if (fread(magic, 1, sizeof(REPLAY_MAGIC) - 1, rr->file) != sizeof(REPLAY_MAGIC) - 1 ||
+			strcmp(magic, REPLAY_MAGIC) || fgetc(rr->file) != kind ||
+			!__varint_read(rr->file, &rr->period) || !__varint_read(rr->file, &every) || !rr->period) {
+			fclose(rr->file);
+			rr->file = NULL;
+			return -1;
+		}
+		rr->checkpoint_every = every;
+	}
+	rr->data_start = ftell(rr->file);
+	rr->next = rr->period;
+
+	return 0;
+}
+
+static inline void replay_close(struct replay* rr)
+{
+	if (rr->file) fclose(rr->file);
+	free(rr->shadow);
+	free(rr->data);
+	memset(rr, 0, sizeof(*rr));
+}
+
+/* Log one record of @tag with @len bytes of @data */
+static inline void replay_record(struct replay* rr, enum replay_tag tag, const void* data, size_t len)
+{
+	rr->len = 0;
+	__replay_put(rr, data, len);
+	__replay_flush(rr, tag);
+}
+
+/***********************************************************************
+ * replay_record_image(rr, nr_insts, memory, base)
+ *
+ * DESCRIPTION
+ *   Log that loading a program of @nr_insts instructions (-1 if it could
+ *   not be loaded) turned @base into @memory. @base is brought up to date.
+ */
+static inline void replay_record_image(struct replay* rr, int nr_insts, const unsigned char* memory,
+	unsigned char* base)
+{
+	rr->len = 0;
+	__replay_put_varint(rr, (unsigned int)(nr_insts + 1));
+	__replay_put_memory(rr, memory, base);
+	__replay_flush(rr, REPLAY_IMAGE);
+}
+
+/* Apply the REPLAY_IMAGE record just read to @memory. Returns nr_insts */
+static inline int replay_apply_image(struct replay* rr, unsigned char* memory)
+{
+	int nr_insts;
+
+	rr->pos = 0;
+	nr_insts = (int)__replay_get_varint(rr) - 1;
+	__replay_get_memory(rr, memory);
+
+	return nr_insts;
+}
+
+/***********************************************************************
+ * replay_state(rr, regs, nr_regs, memory)
+ *
+ * DESCRIPTION
+ *   Called when @rr->count reaches @rr->next, or with @rr->count anywhere
+ *   at the end of a run. Log the hash of the state (and a checkpoint from
+ *   time to time) when recording, or check it against the log when
+ *   replaying.
+ *
+ * RETURN VALUE
+ *   false if the replay has left the recorded path
+ */
+static inline bool replay_state(struct replay* rr, const unsigned int* regs, int nr_regs, const unsigned char* memory)
+{
+	unsigned long long hash = replay_hash(regs, nr_regs, memory);
+	bool periodic = rr->count >= rr->next;
+
+	if (periodic) rr->next = rr->count + rr->period;
+
+	if (rr->recording) {
+		bool checkpoint = periodic && ++rr->nr_hashes % rr->checkpoint_every == 0;
+
+		rr->len = 0;
+		__replay_put_varint(rr, rr->count);
+		__replay_put_le(rr, hash, 8);
+		if (checkpoint) {
+			__replay_put_varint(rr, nr_regs);
+			for (int i = 0; i < nr_regs; i++) __replay_put_le(rr, regs[i], 4);
+			__replay_put_memory(rr, memory, rr->shadow);
+		}
+		__replay_flush(rr, checkpoint ? REPLAY_CHECKPOINT : REPLAY_HASH);
+		return true;
+	}
+
+	if (replay_read(rr) != REPLAY_HASH && rr->tag != REPLAY_CHECKPOINT) return false;
+
+	return __replay_get_varint(rr) == rr->count && __replay_get_le(rr, 8) == hash;
+}
+
+/***********************************************************************
+ * replay_input(rr, data, len)
+ *
+ * DESCRIPTION
+ *   Pass @len bytes the guest reads from outside (e.g., through a system
+ *   call) through the log: they are logged when recording, and replaced by
+ *   the logged ones when replaying.
+ *
+ * RETURN VALUE
+ *   false if the log has no input of @len bytes here
+ */
+static inline bool replay_input(struct replay* rr, void* data, size_t len)
+{
+	if (rr->recording) {
+		replay_record(rr, REPLAY_INPUT, data, len);
+		return true;
+	}
+	if (replay_read(rr) != REPLAY_INPUT || rr->len != len) return false;
+
+	memcpy(data, rr->data, len);
+	return true;
+}
+
+/***********************************************************************
+ * replay_seek(rr, target, regs, nr_regs, memory)
+ *
+ * DESCRIPTION
+ *   Jump to the last checkpoint at or before @target. @regs and @memory
+ *   must hold the state at the beginning of the log; they are turned into
+ *   the state at the checkpoint, and the log is positioned right after it.
+ *   Without such a checkpoint the log is positioned at its beginning.
+ *
+ * RETURN VALUE
+ *   true if a checkpoint was found
+ */
+static inline bool replay_seek(struct replay* rr, unsigned long long target, unsigned int* regs, int nr_regs,
+	unsigned char* memory)
+{
+	long found = -1;
+	unsigned long long found_count = 0;
+
+	/* Find the checkpoint first, then apply the memory of all up to it */
+	fseek(rr->file, rr->data_start, SEEK_SET);
+	while (replay_read(rr) >= 0) {
+		unsigned long long count;
+
+		if (rr->tag != REPLAY_CHECKPOINT) continue;
+		if ((count = __replay_get_varint(rr)) > target) break;
+		found = rr->offset;
+		found_count = count;
+	}
+
+	fseek(rr->file, rr->data_start, SEEK_SET);
+	rr->count = 0;
+	rr->next = rr->period;
+	if (found < 0) return false;
+
+	while (replay_read(rr) >= 0 && rr->offset <= found) {
+		int nr;
+
+		if (rr->tag != REPLAY_CHECKPOINT) continue;
+		__replay_get_varint(rr);
+		__replay_get_le(rr, 8);
+		nr = (int)__replay_get_varint(rr);
+		for (int i = 0; i < nr; i++) {
+			unsigned int value = __replay_get_le(rr, 4);
+
+			if (i < nr_regs) regs[i] = value;
+		}
+		__replay_get_memory(rr, memory);
+	}
+
+	fseek(rr->file, found, SEEK_SET);
+	replay_read(rr);
+	rr->count = found_count;
+	rr->next = found_count + rr->period;
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+
+/**
+ * Instruction scheduling for the pa3 pipeline. The program is split into
+ * basic blocks, and each block is list-scheduled over its dependence DAG
+ * so that loads move away from their uses and the producers of branch
+ * operands move up, while the branch (or jump, or halt) ending the block
+ * stays last. Nothing moves across block boundaries, so branch offsets
+ * stay valid. Blocks longer than SCHED_WINDOW instructions are scheduled
+ * a window at a time, which bounds the work per instruction.
+ *
+ * Blocks start at the first instruction, at branch targets, at the
+ * targets of j/jal (assuming the program is loaded at SCHED_BASE as the
+ * simulators do) and after every control transfer. A syscall ends its
+ * block as well, since it may exit and reads and writes memory. Jumps
+ * through jr can only go to the instruction after a jal, which starts a
+ * block anyway.
+ *
+ * Dependences are those through registers (including hi/lo) and memory,
+ * where stores stay ordered with every other access and ll/sc count as
+ * stores. The pipeline model is the one of pa3 and mc: with forwarding a
+ * consumer waits one cycle right after a load and not at all after other
+ * instructions; without forwarding it waits two cycles after anything.
+ * Branches, jumps and syscalls hold fetch for three cycles either way.
+ */
+#define SCHED_BASE	0x1000
+#define SCHED_WINDOW	128		/* Instructions scheduled together at most */
+#define SCHED_DEPTH	5			/* Pipeline stages */
+
+struct sched_model {
+	unsigned int load_use;		/* Stall cycles of a consumer right after a load */
+	unsigned int alu_use;		/* ... right after any other producer */
+	unsigned int control;		/* ... of fetch after a control transfer or a syscall */
+};
+
+static const struct sched_model sched_forwarding = { 1, 0, 3 };
+static const struct sched_model sched_no_forwarding = { 2, 2, 3 };
+
+/* Running cycle count of a program on the pipeline, see sched_timing_retire() */
+struct sched_timing {
+	unsigned long long ready[ISA_REG_LO + 1];	/* Cycle each register can be read at */
+	unsigned long long issued;					/* Cycle the next instruction can issue at */
+};
+
+struct sched_stats {
+	unsigned int blocks;
+	unsigned int moved;				/* Instructions not at their original place */
+	unsigned long long stalls_before;
+	unsigned long long stalls_after;
+};
+
+static inline bool __sched_is_terminator(enum isa_id id)
+{
+	return isa_table[id].layout == LAYOUT_RT_RS_BOFF || isa_table[id].layout == LAYOUT_TARGET ||
+		id == ISA_JR || id == ISA_SYSCALL || id == ISA_HALT || id == ISA_INVALID;
+}
+
+static inline bool __sched_is_load(enum isa_id id)
+{
+	return id == ISA_LW || id == ISA_LBU || id == ISA_LL || id == ISA_LQ;
+}
+
+static inline bool __sched_is_store(enum isa_id id)
+{
+	return id == ISA_SW || id == ISA_LL || id == ISA_SC || id == ISA_SQ;
+}
+
+static inline unsigned int __sched_latency(const struct sched_model* model, unsigned int instr)
+{
+	return __sched_is_load(isa_decode(instr)) ? model->load_use : model->alu_use;
+}
+
+/***********************************************************************
+ * sched_stalls(insts, nr_insts, model)
+ *
+ * DESCRIPTION
+ *   Data stall cycles of going once through @insts in program order.
+ *   Control transfers drain the pipeline (make_stall(IF, 3) is longer
+ *   than any data stall), so the count restarts after each of them.
+ *
+ * RETURN VALUE
+ *   Predicted stall cycles
+ */
+static inline unsigned long long sched_stalls(const unsigned int* insts, int nr_insts, const struct sched_model* model)
+{
+	unsigned long long ready[ISA_REG_LO + 1] = { 0 };
+	unsigned long long now = 0;
+	unsigned long long stalls = 0;
+
+	for (int i = 0; i < nr_insts; i++) {
+		unsigned long long uses = isa_uses(insts[i]);
+		unsigned long long defs = isa_defs(insts[i]);
+		unsigned long long issue = now;
+
+		for (int r = 1; r <= ISA_REG_LO; r++) {
+			if ((uses & ISA_REG(r)) && ready[r] > issue) issue = ready[r];
+		}
+		stalls += issue - now;
+		now = issue + 1;
+
+		for (int r = 1; r <= ISA_REG_LO; r++) {
+			if (defs & ISA_REG(r)) ready[r] = now + __sched_latency(model, insts[i]);
+		}
+		if (__sched_is_terminator(isa_decode(insts[i]))) memset(ready, 0, sizeof(ready));
+	}
+	return stalls;
+}
+
+/***********************************************************************
+ * sched_timing_retire(timing, model, instr)
+ *
+ * DESCRIPTION
+ *   Account for @instr, the next instruction the program executes, in
+ *   @timing (zeroed before the first one). lq and sq take a second cycle
+ *   in the memory stage as in pa3.
+ *
+ * RETURN VALUE
+ *   Cycles the pipeline has taken so far, including filling it
+ */
+static inline unsigned long long sched_timing_retire(struct sched_timing* timing, const struct sched_model* model,
+	unsigned int instr)
+{
+	enum isa_id id = isa_decode(instr);
+	unsigned long long uses = isa_uses(instr);
+	unsigned long long defs = isa_defs(instr);
+	unsigned long long issue = timing->issued;
+
+	for (int r = 1; r <= ISA_REG_LO; r++) {
+		if ((uses & ISA_REG(r)) && timing->ready[r] > issue) issue = timing->ready[r];
+	}
+	timing->issued = issue + 1;
+
+	for (int r = 1; r <= ISA_REG_LO; r++) {
+		if (defs & ISA_REG(r)) timing->ready[r] = timing->issued + __sched_latency(model, instr);
+	}
+	if (id == ISA_LQ || id == ISA_SQ) timing->issued++;
+	if (__sched_is_terminator(id) && id != ISA_HALT) timing->issued += model->control;
+
+	return timing->issued + SCHED_DEPTH - 1;
+}
+
+/* Mark the first instruction of every basic block in @leaders */
+static inline void __sched_find_leaders(const unsigned int* insts, int nr_insts, bool* leaders)
+{
+	memset(leaders, 0, nr_insts * sizeof(*leaders));
+	if (nr_insts) leaders[0] = true;
+
+	for (int i = 0; i < nr_insts; i++) {
+		enum isa_id id = isa_decode(insts[i]);
+		long target = -1;
+
+		if (!__sched_is_terminator(id)) continue;
+
+		if (i + 1 < nr_insts) leaders[i + 1] = true;
+		if (isa_table[id].layout == LAYOUT_RT_RS_BOFF) {
+			target = i + 1 + ISA_SIMM(insts[i]);
+		}
+		else if (isa_table[id].layout == LAYOUT_TARGET) {
+			target = ((long)ISA_TARGET(insts[i]) * 4 - SCHED_BASE) / 4;
+		}
+		if (target >= 0 && target < nr_insts) leaders[target] = true;
+	}
+}
+
+/**
+ * Scratch space of __sched_block() for windows of up to SCHED_WINDOW
+ * instructions. The dependence DAG is kept as successor lists: the edges
+ * of instruction j are [first[j], first[j + 1]) of @succ and @lat.
+ */
+struct sched_scratch {
+	unsigned long long uses[SCHED_WINDOW];
+	unsigned long long defs[SCHED_WINDOW];
+	unsigned int first[SCHED_WINDOW + 1];
+	unsigned char succ[SCHED_WINDOW * (SCHED_WINDOW - 1) / 2];
+	unsigned char lat[SCHED_WINDOW * (SCHED_WINDOW - 1) / 2];	/* Stall cycles if the successor comes right after */
+	unsigned int nr_preds[SCHED_WINDOW];	/* Not placed yet */
+	unsigned int height[SCHED_WINDOW];
+	unsigned long long earliest[SCHED_WINDOW];	/* Issue cycle the placed predecessors allow */
+	unsigned char ready[SCHED_WINDOW];		/* Instructions whose predecessors are all placed */
+	unsigned int placed[SCHED_WINDOW];		/* Instructions in their new order */
+};
+
+/* Whether @j has to stay before @i, both in the window of @sc */
+static inline bool __sched_depends(const struct sched_scratch* sc, const unsigned int* insts, int i, int j)
+{
+	bool mem_i = isa_table[isa_decode(insts[i])].layout == LAYOUT_RT_OFF_RS;
+	bool mem_j = isa_table[isa_decode(insts[j])].layout == LAYOUT_RT_OFF_RS;
+
+	return (sc->defs[j] & sc->uses[i]) || (sc->defs[i] & sc->uses[j]) || (sc->defs[i] & sc->defs[j]) ||
+		(mem_i && mem_j && (__sched_is_store(isa_decode(insts[i])) || __sched_is_store(isa_decode(insts[j]))));
+}
+
+/**
+ * List-schedule the window @insts[0 .. n) in place, n <= SCHED_WINDOW.
+ * Among the instructions whose predecessors are all placed, the one that
+ * can issue earliest goes next, then the one with the longest path to
+ * the end of the window, then the one that came first. A terminator at
+ * the end depends on everything, so it stays last.
+ */
+static inline void __sched_block(unsigned int* insts, int n, const struct sched_model* model, struct sched_scratch* sc)
+{
+	bool last_pinned = __sched_is_terminator(isa_decode(insts[n - 1]));
+	unsigned int nr_edges = 0;
+	int nr_ready = 0;
+	unsigned long long now = 0;
+
+	for (int i = 0; i < n; i++) {
+		sc->uses[i] = isa_uses(insts[i]);
+		sc->defs[i] = isa_defs(insts[i]);
+		sc->nr_preds[i] = 0;
+		sc->earliest[i] = 0;
+	}
+
+	/* Edges from each j to the later instructions that depend on it */
+	for (int j = 0; j < n; j++) {
+		sc->first[j] = nr_edges;
+		for (int i = j + 1; i < n; i++) {
+			if (!(last_pinned && i == n - 1) && !__sched_depends(sc, insts, i, j)) continue;
+
+			sc->succ[nr_edges] = i;
+			sc->lat[nr_edges] = (sc->defs[j] & sc->uses[i]) ? __sched_latency(model, insts[j]) : 0;
+			sc->nr_preds[i]++;
+			nr_edges++;
+		}
+	}
+	sc->first[n] = nr_edges;
+
+	/* Longest path, in cycles, from each instruction to the end of the window */
+	for (int j = n - 1; j >= 0; j--) {
+		sc->height[j] = 1;
+		for (unsigned int e = sc->first[j]; e < sc->first[j + 1]; e++) {
+			unsigned int height = sc->height[sc->succ[e]] + 1 + sc->lat[e];
+
+			if (height > sc->height[j]) sc->height[j] = height;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (!sc->nr_preds[i]) sc->ready[nr_ready++] = i;
+	}
+
+	for (int k = 0; k < n; k++) {
+		int best = 0;
+		unsigned long long best_issue = 0;
+
+		for (int r = 0; r < nr_ready; r++) {
+			int i = sc->ready[r];
+			int b = sc->ready[best];
+			unsigned long long issue = sc->earliest[i] > now ? sc->earliest[i] : now;
+
+			if (r == 0 || issue < best_issue ||
+				(issue == best_issue && (sc->height[i] > sc->height[b] || (sc->height[i] == sc->height[b] && i < b)))) {
+				best = r;
+				best_issue = issue;
+			}
+		}
+
+		{
+			int i = sc->ready[best];
+
+			sc->ready[best] = sc->ready[--nr_ready];
+			sc->placed[k] = insts[i];
+			now = best_issue + 1;
+
+			for (unsigned int e = sc->first[i]; e < sc->first[i + 1]; e++) {
+				int succ = sc->succ[e];
+
+				if (now + sc->lat[e] > sc->earliest[succ]) sc->earliest[succ] = now + sc->lat[e];
+				if (--sc->nr_preds[succ] == 0) sc->ready[nr_ready++] = succ;
+			}
+		}
+	}
+
+	memcpy(insts, sc->placed, n * sizeof(*insts));
+}
+
+static inline void* __sched_oom(void* p)
+{
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/***********************************************************************
+ * sched_program(insts, nr_insts, model, stats)
+ *
+ * DESCRIPTION
+ *   Schedule the instructions of every basic block of @insts in place for
+ *   @model, and fill @stats with the predicted data stalls of one pass
+ *   through the program before and after.
+ */
+static inline void sched_program(unsigned int* insts, int nr_insts, const struct sched_model* model,
+	struct sched_stats* stats)
+{
+	bool* leaders = __sched_oom(calloc(nr_insts + 1, sizeof(*leaders)));
+	unsigned int* original = __sched_oom(malloc((nr_insts + 1) * sizeof(*original)));
+	struct sched_scratch* sc = __sched_oom(malloc(sizeof(*sc)));
+
+	memset(stats, 0, sizeof(*stats));
+	memcpy(original, insts, nr_insts * sizeof(*insts));
+	stats->stalls_before = sched_stalls(insts, nr_insts, model);
+
+	__sched_find_leaders(insts, nr_insts, leaders);
+	for (int start = 0, end; start < nr_insts; start = end) {
+		for (end = start + 1; end < nr_insts && !leaders[end]; end++);
+		stats->blocks++;
+
+		for (int first = start; first < end; first += SCHED_WINDOW) {
+			int n = end - first < SCHED_WINDOW ? end - first : SCHED_WINDOW;
+
+			if (n < 2) continue;
+			__sched_block(insts + first, n, model, sc);
+
+			/* The greedy choice is not always better; keep the window as it was then */
+			if (sched_stalls(insts + first, n, model) >= sched_stalls(original + first, n, model)) {
+				memcpy(insts + first, original + first, n * sizeof(*insts));
+			}
+		}
+	}
+
+	for (int i = 0; i < nr_insts; i++) {
+		if (insts[i] != original[i]) stats->moved++;
+	}
+	stats->stalls_after = sched_stalls(insts, nr_insts, model);
+
+	free(sc);
+	free(leaders);
+	free(original);
+}
+
+#endif
@@ -0,0 +1,357 @@
+#ifndef __SYSCALL_H__
+#define __SYSCALL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "replay.h"
+
+/**
+ * System calls of the guest through the syscall instruction, with the
+ * services and conventions of SPIM: the service number is in $v0, the
+ * arguments in $a0-$a2, and the result comes back in $v0.
+ *
+ *   1 print_int(a0)          4 print_string(a0)      5 read_int
+ *   8 read_string(a0, a1)    9 sbrk(a0)             10 exit
+ *  11 print_char(a0)        12 read_char            13 open(a0, a1)
+ *  14 read(a0, a1, a2)      15 write(a0, a1, a2)    16 close(a0)
+ *  17 exit2(a0)
+ *
+ * Guest file descriptors 0-2 are the console. open takes a path and the
+ * flags of SPIM (0 read, 1 write, 9 append) and returns -1 on failure.
+ *
+ * read and write work on guest memory in place: the range in @memory is
+ * handed to fread()/fwrite() as it is, clipped at the end of memory.
+ * Console output is collected in @buffer and written in one go when the
+ * buffer fills up, before the guest reads from the console (so prompts
+ * show up), and at exit; writes larger than the buffer go out straight
+ * from guest memory.
+ *
+ * With @replay set, whatever the guest gets from outside (input and the
+ * result of open) is logged when recording and taken from the log rather
+ * than from the host when replaying, see replay_input().
+ */
+enum syscall_service {
+	SYSCALL_PRINT_INT = 1,
+	SYSCALL_PRINT_STRING = 4,
+	SYSCALL_READ_INT = 5,
+	SYSCALL_READ_STRING = 8,
+	SYSCALL_SBRK = 9,
+	SYSCALL_EXIT = 10,
+	SYSCALL_PRINT_CHAR = 11,
+	SYSCALL_READ_CHAR = 12,
+	SYSCALL_OPEN = 13,
+	SYSCALL_READ = 14,
+	SYSCALL_WRITE = 15,
+	SYSCALL_CLOSE = 16,
+	SYSCALL_EXIT2 = 17,
+};
+
+#define SYSCALL_MAX_FILES	16
+#define SYSCALL_BUFFER		(1 << 16)
+#define SYSCALL_MAX_PATH	256
+
+#define SYSCALL_V0	2
+#define SYSCALL_A0	4
+#define SYSCALL_A1	5
+#define SYSCALL_A2	6
+
+struct syscalls {
+	FILE* files[SYSCALL_MAX_FILES];	/* by guest fd, 0-2 are the console */
+	bool opened[SYSCALL_MAX_FILES];	/* Replays open nothing on the host */
+	unsigned int brk;				/* Heap end handed out by sbrk */
+	unsigned int brk_limit;
+	struct replay* replay;
+
+	bool exited;
+	int exit_code;
+
+	/* Guest memory the last call filled from outside, for checkers to copy */
+	unsigned int input_addr;
+	unsigned int input_len;
+
+	char buffer[SYSCALL_BUFFER];	/* Console output not written yet */
+	size_t len;
+};
+
+/* Bytes from @addr up to @len that do not run past the end of memory */
+static inline unsigned int __syscall_span(unsigned int addr, unsigned int len)
+{
+	unsigned int room = CORE_MEMORY_SIZE - (addr & CORE_MEMORY_MASK);
+
+	return len < room ? len : room;
+}
+
+static inline bool __syscall_replaying(const struct syscalls* sys)
+{
+	return sys->replay && !sys->replay->recording;
+}
+
+/***********************************************************************
+ * syscall_init(sys, brk, brk_limit)
+ *
+ * DESCRIPTION
+ *   Start with the console only and the heap of sbrk in [@brk, @brk_limit).
+ */
+static inline void syscall_init(struct syscalls* sys, unsigned int brk, unsigned int brk_limit)
+{
+	memset(sys, 0, offsetof(struct syscalls, buffer));
+	sys->files[0] = stdin;
+	sys->files[1] = stdout;
+	sys->files[2] = stderr;
+	for (int fd = 0; fd < 3; fd++) sys->opened[fd] = true;
+	sys->brk = brk;
+	sys->brk_limit = brk_limit;
+	sys->len = 0;
+}
+
+/* Write out the console output collected so far */
+static inline void syscall_flush(struct syscalls* sys)
+{
+	if (sys->len) fwrite(sys->buffer, 1, sys->len, stdout);
+	sys->len = 0;
+	fflush(stdout);
+}
+
+/* Flush, and close the files the guest left open */
+static inline void syscall_close(struct syscalls* sys)
+{
+	syscall_flush(sys);
+	for (int fd = 3; fd < SYSCALL_MAX_FILES; fd++) {
+		if (sys->files[fd]) fclose(sys->files[fd]);
+		sys->files[fd] = NULL;
+		sys->opened[fd] = false;
+	}
+}
+
+/**
+ * State of @sys that the guest can see besides memory, SYSCALL_STATE_WORDS
+ * words of it: the heap end and which fds are open. Replays save it with
+ * the registers in their checkpoints and put it back when they seek, see
+ * syscall_restore().
+ */
+#define SYSCALL_STATE_WORDS	2
+
+static inline void syscall_save(const struct syscalls* sys, unsigned int* words)
+{
+	words[0] = sys->brk;
+	words[1] = 0;
+	for (int fd = 0; fd < SYSCALL_MAX_FILES; fd++) {
+		if (sys->opened[fd]) words[1] |= 1U << fd;
+	}
+}
+
+/* Host files are not opened again; the replay takes what they gave from the log */
+static inline void syscall_restore(struct syscalls* sys, const unsigned int* words)
+{
+	sys->brk = words[0];
+	for (int fd = 3; fd < SYSCALL_MAX_FILES; fd++) {
+		if (sys->files[fd]) fclose(sys->files[fd]);
+		sys->files[fd] = NULL;
+		sys->opened[fd] = (words[1] >> fd) & 1;
+	}
+}
+
+/* Returns what write() returns to the guest */
+static inline int __syscall_output(struct syscalls* sys, int fd, const void* data, size_t len)
+{
+	if (fd == 1) {
+		if (sys->len + len > SYSCALL_BUFFER) syscall_flush(sys);
+		if (len >= SYSCALL_BUFFER) {
+			fwrite(data, 1, len, stdout);
+		}
+		else {
+			memcpy(sys->buffer + sys->len, data, len);
+			sys->len += len;
+		}
+		return (int)len;
+	}
+	if (fd == 2) syscall_flush(sys);	/* Keep the order on a shared terminal */
+
+	if (fd < 0 || fd >= SYSCALL_MAX_FILES || !sys->opened[fd] || fd == 0) return -1;
+	if (!sys->files[fd]) return (int)len;
+	return (int)fwrite(data, 1, len, sys->files[fd]);
+}
+
+/**
+ * Read at most @max bytes from @fd into @dest, up to and including a
+ * newline if @line. Returns the number of bytes, or -1 on a bad @fd or
+ * when the replay log has no input here.
+ */
+static inline int __syscall_input(struct syscalls* sys, int fd, unsigned char* dest, size_t max, bool line)
+{
+	FILE* file;
+	size_t n = 0;
+
+	if (fd < 0 || fd >= SYSCALL_MAX_FILES || !sys->opened[fd] || fd == 1 || fd == 2) return -1;
+
+	if (__syscall_replaying(sys)) {
+		struct replay* rr = sys->replay;
+
+		if (replay_read(rr) != REPLAY_INPUT || rr->len > max) {
+			fprintf(stderr, "replay: no input logged for this syscall\n");
+			return -1;
+		}
+		memcpy(dest, rr->data, rr->len);
+		return (int)rr->len;
+	}
+
+	file = sys->files[fd];
+	if (fd == 0) syscall_flush(sys);
+
+	if (line) {
+		int c;
+
+		while (n < max && (c = getc(file)) != EOF) {
+			dest[n++] = c;
+			if (c == '\n') break;
+		}
+	}
+	else {
+		n = fread(dest, 1, max, file);
+	}
+
+	if (sys->replay) replay_record(sys->replay, REPLAY_INPUT, dest, n);
+	return (int)n;
+}
+
+/* Guest fd for the file whose path is at @path in guest memory, or -1 */
+static inline int __syscall_open(struct syscalls* sys, const unsigned char* memory, unsigned int path,
+	unsigned int flags)
+{
+	char filename[SYSCALL_MAX_PATH];
+	int fd;
+
+	for (fd = 3; fd < SYSCALL_MAX_FILES && sys->opened[fd]; fd++);
+	if (fd == SYSCALL_MAX_FILES) fd = -1;
+
+	if (fd >= 0 && !__syscall_replaying(sys)) {
+		size_t i;
+
+		for (i = 0; i < sizeof(filename) - 1 && memory[(path + i) & CORE_MEMORY_MASK]; i++) {
+			filename[i] = memory[(path + i) & CORE_MEMORY_MASK];
+		}
+		filename[i] = '\0';
+
+		sys->files[fd] = fopen(filename, (flags & 8) ? "ab" : (flags & 1) ? "wb" : "rb");
+		if (!sys->files[fd]) fd = -1;
+	}
+
+	/* Whether the file was there is input as well */
+	if (sys->replay && !replay_input(sys->replay, &fd, sizeof(fd))) fd = -1;
+	if (fd >= 0) sys->opened[fd] = true;
+	return fd;
+}
+
+/***********************************************************************
+ * syscall_execute(sys, registers, memory)
+ *
+ * DESCRIPTION
+ *   Carry out the system call the guest with @registers and @memory asks
+ *   for. Unknown services return -1 in $v0.
+ *
+ * RETURN VALUE
+ *   false if the guest exits, true otherwise
+ */
+static inline bool syscall_execute(struct syscalls* sys, unsigned int* registers, unsigned char* memory)
+{
+	unsigned int a0 = registers[SYSCALL_A0];
+	unsigned int a1 = registers[SYSCALL_A1];
+	unsigned int a2 = registers[SYSCALL_A2];
+	unsigned int result = registers[SYSCALL_V0];
+	char text[32];
+	int n;
+
+	sys->input_len = 0;
+
+	switch (registers[SYSCALL_V0]) {
+	case SYSCALL_PRINT_INT:
+		n = snprintf(text, sizeof(text), "%d", (int)a0);
+		__syscall_output(sys, 1, text, n);
+		break;
+	case SYSCALL_PRINT_STRING:
+	{
+		const unsigned char* start = memory + (a0 & CORE_MEMORY_MASK);
+		const unsigned char* end = memchr(start, '\0', __syscall_span(a0, CORE_MEMORY_SIZE));
+
+		__syscall_output(sys, 1, start, end ? (size_t)(end - start) : __syscall_span(a0, CORE_MEMORY_SIZE));
+		break;
+	}
+	case SYSCALL_PRINT_CHAR:
+		text[0] = a0;
+		__syscall_output(sys, 1, text, 1);
+		break;
+	case SYSCALL_READ_INT:
+		n = __syscall_input(sys, 0, (unsigned char*)text, sizeof(text) - 1, true);
+		text[n > 0 ? n : 0] = '\0';
+		result = strtol(text, NULL, 0);
+		break;
+	case SYSCALL_READ_CHAR:
+		n = __syscall_input(sys, 0, (unsigned char*)text, 1, false);
+		result = n > 0 ? (unsigned char)text[0] : (unsigned int)-1;
+		break;
+	case SYSCALL_READ_STRING:
+		/* Like fgets(): at most a1 - 1 characters and a terminating '\0' */
+		if (!a1) break;
+		n = __syscall_input(sys, 0, memory + (a0 & CORE_MEMORY_MASK), __syscall_span(a0, a1 - 1), true);
+		if (n < 0) n = 0;
+		if ((unsigned int)n < __syscall_span(a0, a1)) memory[(a0 + n) & CORE_MEMORY_MASK] = '\0';
+		sys->input_addr = a0;
+		sys->input_len = __syscall_span(a0, n + 1);
+		break;
+	case SYSCALL_SBRK:
+	{
+		unsigned int size = (a0 + 3) & ~3U;
+
+		result = sys->brk;
+		if ((int)a0 < 0 || sys->brk_limit - sys->brk < size) result = -1;
+		else sys->brk += size;
+		break;
+	}
+	case SYSCALL_OPEN:
+		result = __syscall_open(sys, memory, a0, a1);
+		break;
+	case SYSCALL_READ:
+		n = __syscall_input(sys, (int)a0, memory + (a1 & CORE_MEMORY_MASK), __syscall_span(a1, a2), a0 == 0);
+		result = n;
+		sys->input_addr = a1;
+		sys->input_len = n > 0 ? n : 0;
+		break;
+	case SYSCALL_WRITE:
+		result = __syscall_output(sys, (int)a0, memory + (a1 & CORE_MEMORY_MASK), __syscall_span(a1, a2));
+		break;
+	case SYSCALL_CLOSE:
+		result = -1;
+		if (a0 >= 3 && a0 < SYSCALL_MAX_FILES && sys->opened[a0]) {
+			if (sys->files[a0]) fclose(sys->files[a0]);
+			sys->files[a0] = NULL;
+			sys->opened[a0] = false;
+			result = 0;
+		}
+		break;
+	case SYSCALL_EXIT:
+	case SYSCALL_EXIT2:
+		syscall_flush(sys);
+		sys->exited = true;
+		sys->exit_code = registers[SYSCALL_V0] == SYSCALL_EXIT2 ? (int)a0 : 0;
+		return false;
+	default:
+		result = -1;
+		break;
+	}
+
+	registers[SYSCALL_V0] = result;
+	return true;
+}
+
+/* Hook for mips_core.syscall with a struct syscalls as the data */
+static inline bool syscall_core(struct mips_core* core, void* data)
+{
+	return syscall_execute(data, core->registers, core->memory);
+}
+
+#endif
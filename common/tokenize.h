@@ -0,0 +1,120 @@
+#ifndef __TOKENIZE_H__
+#define __TOKENIZE_H__
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+
+/**
+ * Tokenizer shared by the command parsers of pa0, pa1 and pa2. The line
+ * and the token array both come from a per-line arena, so lines can be of
+ * any length and nothing is allocated per token.
+ */
+#define TOKENIZE_LOWER		0x01	/* Convert the line to lower-cases */
+#define TOKENIZE_COMMENTS	0x02	/* Drop tokens from "//" or "#" onwards */
+
+/***********************************************************************
+ * arena_getline(arena, input)
+ *
+ * DESCRIPTION
+ *   Read one line from @input into @arena, including the trailing '\n'
+ *   if there is one.
+ *
+ * RETURN VALUE
+ *   The line, or NULL at the end of @input
+ */
+static inline char* arena_getline(struct arena* arena, FILE* input)
+{
+	size_t size = 256;
+	size_t len = 0;
+	char* line = arena_alloc(arena, size);
+
+	while (fgets(line + len, (int)(size - len), input)) {
+		len += strlen(line + len);
+		if (len + 1 < size || line[len - 1] == '\n') break;
+
+		line = arena_extend(arena, line, size, size * 2);
+		size *= 2;
+	}
+
+	return len ? line : NULL;
+}
+
+/***********************************************************************
+ * tokenize(arena, line, flags, tokens)
+ *
+ * DESCRIPTION
+ *   Split @line at white spaces in place and put each token into an array
+ *   allocated from @arena. The array is terminated with NULL.
+ *
+ * RETURN VALUE
+ *   Return the number of tokens.
+ */
+static inline int tokenize(struct arena* arena, char* line, unsigned int flags, char*** tokens)
+{
+	int nr_tokens = 0;
+	int i = 0;
+	bool token_started = false;
+
+	for (char* curr = line; *curr != '\0'; curr++) {
+		if (isspace((unsigned char)*curr)) {
+			token_started = false;
+		}
+		else if (!token_started) {
+			nr_tokens++;
+			token_started = true;
+		}
+	}
+
+	*tokens = arena_alloc(arena, sizeof(char*) * (nr_tokens + 1));
+
+	token_started = false;
+	for (char* curr = line; *curr != '\0'; curr++) {
+		if (isspace((unsigned char)*curr)) {
+			*curr = '\0';
+			token_started = false;
+		}
+		else {
+			if (flags & TOKENIZE_LOWER) *curr = tolower((unsigned char)*curr);
+			if (!token_started) {
+				(*tokens)[i++] = curr;
+				token_started = true;
+			}
+		}
+	}
+	(*tokens)[nr_tokens] = NULL;
+
+	if (flags & TOKENIZE_COMMENTS) {
+		for (i = 0; i < nr_tokens; i++) {
+			if (strncmp((*tokens)[i], "//", 2) == 0 || (*tokens)[i][0] == '#') {
+				nr_tokens = i;
+				(*tokens)[i] = NULL;
+			}
+		}
+	}
+
+	return nr_tokens;
+}
+
+/***********************************************************************
+ * read_tokens(arena, input, flags, tokens)
+ *
+ * DESCRIPTION
+ *   Read the next line from @input and tokenize it into @arena. Call
+ *   arena_reset() once the tokens are no longer needed.
+ *
+ * RETURN VALUE
+ *   Number of tokens, or -1 at the end of @input
+ */
+static inline int read_tokens(struct arena* arena, FILE* input, unsigned int flags, char*** tokens)
+{
+	char* line = arena_getline(arena, input);
+
+	if (!line) return -1;
+	return tokenize(arena, line, flags, tokens);
+}
+
+#endif
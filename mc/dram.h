@@ -0,0 +1,257 @@
+#ifndef __DRAM_H__
+#define __DRAM_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * DRAM behind the snooping bus. Memory is split into channels, each with
+ * its own data bus, and each channel into banks that keep one row open in
+ * their row buffer. Addresses are mapped as row:bank:channel:column, so a
+ * row of @row_size bytes is contiguous and consecutive rows rotate over
+ * the channels first and then over the banks.
+ *
+ * An access to the open row only needs the column command (tCAS). A closed
+ * bank needs an activate first (tRCD + tCAS), and another row being open
+ * a precharge before that (tRP + tRCD + tCAS). The data then takes tBURST
+ * cycles on the data bus of the channel. With the closed row policy banks
+ * are precharged right after each access instead.
+ *
+ * Reads are scheduled as soon as they arrive because the caches wait for
+ * them. Writebacks wait in the request queue of the controller until a
+ * read goes to the same bank or the queue fills up. The requests of the
+ * bank are then served first-ready first-come-first-served: those hitting
+ * the open row first, and the oldest among equals. What is still queued
+ * at the end of the run is written by dram_drain().
+ */
+enum dram_policy {
+	DRAM_OPEN_ROW = 0,
+	DRAM_CLOSED_ROW,
+	NR_DRAM_POLICIES,
+};
+
+static const char* const dram_policy_names[NR_DRAM_POLICIES] = {
+	"open", "closed",
+};
+
+#define DRAM_MAX_QUEUE	64
+
+struct dram_config {
+	unsigned int channels;		/* 0 for the flat mem_latency instead */
+	unsigned int banks;			/* Per channel */
+	unsigned int row_size;		/* Bytes */
+	enum dram_policy policy;
+
+	unsigned int tRCD;			/* Activate to column command */
+	unsigned int tCAS;			/* Column command to data */
+	unsigned int tRP;			/* Precharge */
+	unsigned int tBURST;		/* Data bus cycles of one line */
+
+	unsigned int queue_depth;	/* Writebacks the controller holds */
+};
+
+struct dram_bank {
+	bool open;
+	unsigned int row;
+	unsigned long long ready;	/* Cycle the next command may be issued */
+};
+
+struct dram_request {
+	unsigned long long arrival;
+	unsigned int channel;
+	unsigned int bank;
+	unsigned int row;
+};
+
+struct dram {
+	struct dram_config config;
+	struct dram_bank* banks;			/* channels * banks */
+	unsigned long long* data_bus_free;	/* Per channel */
+
+	struct dram_request queue[DRAM_MAX_QUEUE];	/* Oldest first */
+	unsigned int nr_queued;
+
+	/* Statistics */
+	unsigned long long reads;
+	unsigned long long writes;
+	unsigned long long row_hits;
+	unsigned long long row_empty;		/* Bank was precharged */
+	unsigned long long row_conflicts;	/* Another row was open */
+	unsigned long long read_latency;	/* Sum over the reads, arrival to data */
+	unsigned long long queue_full;		/* Writebacks forced out by a full queue */
+};
+
+static inline void dram_init(struct dram* d, const struct dram_config* config)
+{
+	memset(d, 0, sizeof(*d));
+	d->config = *config;
+	d->banks = calloc((size_t)config->channels * config->banks, sizeof(*d->banks));
+	d->data_bus_free = calloc(config->channels, sizeof(*d->data_bus_free));
+	if (!d->banks || !d->data_bus_free) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static inline void dram_destroy(struct dram* d)
+{
+	free(d->banks);
+	free(d->data_bus_free);
+}
+
+/* Cycles of a read hitting the open row on idle banks and buses */
+static inline unsigned int dram_min_latency(const struct dram_config* config)
+{
+	return config->tCAS + config->tBURST;
+}
+
+static inline struct dram_request __dram_map(const struct dram* d, unsigned int addr, unsigned long long now)
+{
+	unsigned int row = addr / d->config.row_size;
+	struct dram_request r = { .arrival = now };
+
+	r.channel = row % d->config.channels;
+	row /= d->config.channels;
+	r.bank = row % d->config.banks;
+	r.row = row / d->config.banks;
+
+	return r;
+}
+
+static inline struct dram_bank* __dram_bank(struct dram* d, const struct dram_request* r)
+{
+	return &d->banks[r->channel * d->config.banks + r->bank];
+}
+
+/* Serve @r on its bank. Returns the cycle its data is through */
+static inline unsigned long long __dram_issue(struct dram* d, const struct dram_request* r)
+{
+	const struct dram_config* config = &d->config;
+	struct dram_bank* bank = __dram_bank(d, r);
+	unsigned long long start = r->arrival > bank->ready ? r->arrival : bank->ready;
+	unsigned long long column = start;
+	unsigned long long data;
+
+	if (bank->open && bank->row == r->row) {
+		d->row_hits++;
+	}
+	else if (bank->open) {
+		d->row_conflicts++;
+		column += config->tRP + config->tRCD;
+	}
+	else {
+		d->row_empty++;
+		column += config->tRCD;
+	}
+
+	/* Time the column command so that the data finds the bus free */
+	data = column + config->tCAS;
+	if (data < d->data_bus_free[r->channel]) {
+		data = d->data_bus_free[r->channel];
+		column = data - config->tCAS;
+	}
+	d->data_bus_free[r->channel] = data + config->tBURST;
+
+	if (config->policy == DRAM_CLOSED_ROW) {
+		bank->open = false;
+		bank->ready = data + config->tBURST + config->tRP;
+	}
+	else {
+		bank->open = true;
+		bank->row = r->row;
+		bank->ready = column + config->tBURST;	/* Column commands pipeline */
+	}
+
+	return data + config->tBURST;
+}
+
+static inline void __dram_dequeue(struct dram* d, unsigned int i)
+{
+	memmove(&d->queue[i], &d->queue[i + 1], (d->nr_queued - i - 1) * sizeof(*d->queue));
+	d->nr_queued--;
+}
+
+/***********************************************************************
+ * dram_read(d, addr, now)
+ *
+ * DESCRIPTION
+ *   Read the line at @addr, which arrives at the controller at @now.
+ *   Writebacks queued for the same bank go first if FR-FCFS says so.
+ *
+ * RETURN VALUE
+ *   Cycle the whole line has arrived
+ */
+static inline unsigned long long dram_read(struct dram* d, unsigned int addr, unsigned long long now)
+{
+	struct dram_request r = __dram_map(d, addr, now);
+	struct dram_bank* bank = __dram_bank(d, &r);
+	unsigned long long done;
+
+	for (;;) {
+		int oldest = -1;
+		int next = -1;
+
+		for (unsigned int i = 0; i < d->nr_queued; i++) {
+			const struct dram_request* w = &d->queue[i];
+
+			if (w->channel != r.channel || w->bank != r.bank) continue;
+			if (bank->open && w->row == bank->row) {
+				next = i;
+				break;
+			}
+			if (oldest < 0) oldest = i;
+		}
+
+		/*
+		 * The read is the youngest: older writes to the open row go first,
+		 * then the read if it hits the row too, and otherwise the oldest
+		 */
+		if (next < 0) {
+			if (bank->open && bank->row == r.row) break;
+			next = oldest;
+		}
+		if (next < 0) break;
+
+		__dram_issue(d, &d->queue[next]);
+		__dram_dequeue(d, next);
+	}
+
+	done = __dram_issue(d, &r);
+	d->reads++;
+	d->read_latency += done - now;
+
+	return done;
+}
+
+/***********************************************************************
+ * dram_write(d, addr, now)
+ *
+ * DESCRIPTION
+ *   Queue the writeback of the line at @addr, which arrives at @now.
+ *   Nobody waits for it; the oldest writeback is written if the queue is
+ *   full.
+ */
+static inline void dram_write(struct dram* d, unsigned int addr, unsigned long long now)
+{
+	d->writes++;
+
+	if (d->nr_queued == d->config.queue_depth) {
+		d->queue_full++;
+		__dram_issue(d, &d->queue[0]);
+		__dram_dequeue(d, 0);
+	}
+	d->queue[d->nr_queued++] = __dram_map(d, addr, now);
+}
+
+/* Write what is left in the queue, oldest first, so that its bank time is counted */
+static inline void dram_drain(struct dram* d)
+{
+	for (unsigned int i = 0; i < d->nr_queued; i++) {
+		__dram_issue(d, &d->queue[i]);
+	}
+	d->nr_queued = 0;
+}
+
+#endif
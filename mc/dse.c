@@ -0,0 +1,369 @@
+/**********************************************************************
+ * dse: design-space exploration over mc configurations
+ *
+ * Run every program on every point of a grid of machine parameters and
+ * print one line per run with the CPI, the time per instruction at the
+ * clock the pipeline depth allows, the L1 miss rates and the host time.
+ * Each axis of the grid is given as -g name=value,value,... with the
+ * values in the syntax of the matching mc option:
+ *
+ *   cores       number of cores (1 by default, a single pipeline)
+ *   l1          sets:ways:line
+ *   mem, c2c, bus, branch
+ *               memory and cache-to-cache latencies, bus occupancy and
+ *               branch penalty in cycles of the 5-stage pipeline
+ *   forwarding  on or off
+ *   pipe        fetch:decode:execute:memory stages
+ *   prefetch    type[:degree[:distance]]
+ *   sb          depth[:drain][:wc], or 0 for none
+ *   dram        channels:banks:row[:policy[:queue]], or off
+ *   timing      tRCD:tCAS:tRP:tBURST
+ *
+ * Programs are loaded once and shared read-only by all the runs; every
+ * machine starts from its own copy. Runs are independent, so they are
+ * spread over host threads, and the table comes out in grid order however
+ * the runs finish.
+ *
+ *   dse [-g name=values]... [-t threads] [-o output] program...
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/loader.h"
+#include "machine.h"
+#include "options.h"
+
+#define DSE_MAX_AXES	16
+
+struct dse_axis {
+	const char* name;
+	char** values;
+	int nr_values;
+};
+
+struct dse_result {
+	unsigned long long cycles;
+	unsigned long long instructions;
+	unsigned long long l1i_accesses, l1i_misses;
+	unsigned long long l1d_accesses, l1d_misses;
+	double seconds;
+};
+
+struct dse {
+	struct dse_axis axes[DSE_MAX_AXES];
+	int nr_axes;
+	size_t nr_points;				/* Configurations in the grid */
+	struct mc_config* configs;		/* Of each point, built before the threads start */
+
+	char* const* programs;
+	unsigned char** images;
+	int nr_programs;
+
+	struct dse_result* results;		/* [point * nr_programs + program] */
+	atomic_size_t next;				/* Next run to take */
+	atomic_size_t nr_done;
+};
+
+static const char* const dse_axis_names[] = {
+	"cores", "l1", "mem", "c2c", "bus", "branch", "forwarding", "pipe", "prefetch", "sb", "dram", "timing",
+};
+
+#define NR_DSE_AXIS_NAMES	(sizeof(dse_axis_names) / sizeof(dse_axis_names[0]))
+
+/* Set the parameter @name of @config to @value. Returns false if @value does not parse */
+static bool __dse_apply(struct mc_config* config, const char* name, const char* value)
+{
+	char buffer[64];
+
+	if (strcmp(name, "cores") == 0) {
+		unsigned int nr_cores;
+
+		if (!parse_number(value, &nr_cores) || nr_cores > MAX_NR_CORES) return false;
+		config->nr_cores = nr_cores;
+	}
+	else if (strcmp(name, "l1") == 0) {
+		return sscanf(value, "%u:%u:%u", &config->l1_sets, &config->l1_ways, &config->line_size) == 3;
+	}
+	else if (strcmp(name, "mem") == 0) {
+		return parse_number(value, &config->mem_latency);
+	}
+	else if (strcmp(name, "c2c") == 0) {
+		return parse_number(value, &config->c2c_latency);
+	}
+	else if (strcmp(name, "bus") == 0) {
+		return parse_number(value, &config->bus_occupancy);
+	}
+	else if (strcmp(name, "branch") == 0) {
+		return parse_number(value, &config->branch_penalty);
+	}
+	else if (strcmp(name, "forwarding") == 0) {
+		if (strcmp(value, "on") && strcmp(value, "off")) return false;
+		config->forwarding = strcmp(value, "on") == 0;
+	}
+	else if (strcmp(name, "pipe") == 0) {
+		return parse_pipe(value, &config->pipe);
+	}
+	else if (strcmp(name, "prefetch") == 0) {
+		return parse_prefetch(value, &config->prefetch);
+	}
+	else if (strcmp(name, "sb") == 0) {
+		config->store_buffer = mc_default_config.store_buffer;
+		if (strcmp(value, "0") == 0) return true;
+
+		snprintf(buffer, sizeof(buffer), "%s", value);	/* strtok()ed */
+		return parse_store_buffer(buffer, &config->store_buffer);
+	}
+	else if (strcmp(name, "dram") == 0) {
+		if (strcmp(value, "off") == 0) {
+			config->dram.channels = 0;
+			return true;
+		}
+		return parse_dram(value, &config->dram);
+	}
+	else if (strcmp(name, "timing") == 0) {
+		return sscanf(value, "%u:%u:%u:%u", &config->dram.tRCD, &config->dram.tCAS, &config->dram.tRP,
+			&config->dram.tBURST) == 4;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+/* Configuration of grid point @point, the last axis varying fastest */
+static void __dse_point(const struct dse* dse, size_t point, struct mc_config* config, int* values)
+{
+	*config = mc_default_config;
+	config->nr_cores = 1;
+
+	for (int i = dse->nr_axes - 1; i >= 0; i--) {
+		const struct dse_axis* axis = &dse->axes[i];
+
+		values[i] = point % axis->nr_values;
+		point /= axis->nr_values;
+	}
+	for (int i = 0; i < dse->nr_axes; i++) {
+		__dse_apply(config, dse->axes[i].name, dse->axes[i].values[values[i]]);
+	}
+}
+
+static void* __oom(void* p)
+{
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static double __elapsed(const struct timespec* start)
+{
+	struct timespec now;
+
+	timespec_get(&now, TIME_UTC);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void* __dse_thread(void* arg)
+{
+	struct dse* dse = arg;
+	size_t nr_runs = dse->nr_points * dse->nr_programs;
+	size_t run;
+
+	while ((run = atomic_fetch_add(&dse->next, 1)) < nr_runs) {
+		struct dse_result* r = &dse->results[run];
+		const struct mc_config* config = &dse->configs[run / dse->nr_programs];
+		struct machine machine;
+		struct timespec start;
+
+		timespec_get(&start, TIME_UTC);
+		machine_init(&machine, config, dse->images[run % dse->nr_programs]);
+		r->cycles = machine_run(&machine);
+		r->seconds = __elapsed(&start);
+
+		for (int i = 0; i < config->nr_cores; i++) {
+			const struct mc_core* c = &machine.cores[i];
+
+			r->instructions += c->instructions;
+			r->l1i_accesses += c->l1i.hits + c->l1i.misses;
+			r->l1i_misses += c->l1i.misses;
+			r->l1d_accesses += c->l1d.hits + c->l1d.misses;
+			r->l1d_misses += c->l1d.misses;
+		}
+		machine_destroy(&machine);
+
+		if ((atomic_fetch_add(&dse->nr_done, 1) + 1) % 100 == 0) {
+			fprintf(stderr, "\r%zu/%zu runs", atomic_load(&dse->nr_done), nr_runs);
+		}
+	}
+	return NULL;
+}
+
+static void __usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-g name=value,...]... [-t threads] [-o output] program...\n", name);
+	fprintf(stderr, "  -g  axis of the grid, one of");
+	for (size_t i = 0; i < NR_DSE_AXIS_NAMES; i++) fprintf(stderr, " %s", dse_axis_names[i]);
+	fprintf(stderr, "\n      with values in the syntax of the mc options\n");
+	fprintf(stderr, "  -t  host threads (default all the processors)\n");
+	fprintf(stderr, "  -o  write the table to output instead of stdout\n");
+}
+
+/* -g name=value,value,... */
+static bool __parse_axis(char* arg, struct dse_axis* axis)
+{
+	char* values = strchr(arg, '=');
+	struct mc_config config = mc_default_config;
+	size_t i;
+
+	if (!values) return false;
+	*values++ = '\0';
+
+	for (i = 0; i < NR_DSE_AXIS_NAMES && strcmp(arg, dse_axis_names[i]); i++);
+	if (i == NR_DSE_AXIS_NAMES) return false;
+	axis->name = dse_axis_names[i];
+
+	for (char* value = strtok(values, ","); value; value = strtok(NULL, ",")) {
+		axis->values = __oom(realloc(axis->values, sizeof(*axis->values) * (axis->nr_values + 1)));
+		axis->values[axis->nr_values++] = value;
+	}
+
+	for (int j = 0; j < axis->nr_values; j++) {
+		if (!__dse_apply(&config, axis->name, axis->values[j])) {
+			fprintf(stderr, "Invalid %s %s\n", axis->name, axis->values[j]);
+			return false;
+		}
+	}
+	return axis->nr_values > 0;
+}
+
+int main(int argc, char* argv[])
+{
+	struct dse dse = { .nr_points = 1 };
+	int nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	FILE* out = stdout;
+	pthread_t* threads;
+	struct timespec start;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:t:o:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			if (dse.nr_axes == DSE_MAX_AXES || !__parse_axis(optarg, &dse.axes[dse.nr_axes])) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			dse.nr_points *= dse.axes[dse.nr_axes++].nr_values;
+			break;
+		case 't':
+		{
+			unsigned int number;
+
+			if (!parse_number(optarg, &number) || number > INT_MAX) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			nr_threads = number;
+			break;
+		}
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				fprintf(stderr, "Unable to open %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			__usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (optind == argc || nr_threads < 1) {
+		__usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Reject the points no machine can be built with before running any */
+	dse.configs = __oom(calloc(dse.nr_points, sizeof(*dse.configs)));
+	for (size_t point = 0; point < dse.nr_points; point++) {
+		int values[DSE_MAX_AXES];
+
+		__dse_point(&dse, point, &dse.configs[point], values);
+		if (!mc_config_valid(&dse.configs[point])) {
+			fprintf(stderr, "Invalid configuration:");
+			for (int i = 0; i < dse.nr_axes; i++) fprintf(stderr, " %s=%s", dse.axes[i].name, dse.axes[i].values[values[i]]);
+			fprintf(stderr, "\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	dse.programs = argv + optind;
+	dse.nr_programs = argc - optind;
+	dse.images = __oom(calloc(dse.nr_programs, sizeof(*dse.images)));
+	for (int i = 0; i < dse.nr_programs; i++) {
+		dse.images[i] = __oom(calloc(1, CORE_MEMORY_SIZE));
+		if (load_image(dse.images[i], ENTRY_PC, dse.programs[i]) < 0) {
+			fprintf(stderr, "No input file %s\n", dse.programs[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	dse.results = __oom(calloc(dse.nr_points * dse.nr_programs, sizeof(*dse.results)));
+	atomic_init(&dse.next, 0);
+	atomic_init(&dse.nr_done, 0);
+	if ((size_t)nr_threads > dse.nr_points * dse.nr_programs) nr_threads = dse.nr_points * dse.nr_programs;
+
+	timespec_get(&start, TIME_UTC);
+	threads = __oom(calloc(nr_threads, sizeof(*threads)));
+	for (int i = 1; i < nr_threads; i++) {
+		/* Runs are pulled from dse.next, so fewer threads still do them all */
+		if (pthread_create(&threads[i], NULL, __dse_thread, &dse) != 0) {
+			nr_threads = i;
+			break;
+		}
+	}
+	__dse_thread(&dse);
+	for (int i = 1; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	fprintf(stderr, "\r%zu runs on %d thread%s in %.3f s\n", dse.nr_points * dse.nr_programs,
+		nr_threads, nr_threads > 1 ? "s" : "", __elapsed(&start));
+
+	/* Tab-separated, one line per run */
+	fprintf(out, "program");
+	for (int i = 0; i < dse.nr_axes; i++) fprintf(out, "\t%s", dse.axes[i].name);
+	fprintf(out, "\tcycles\tinsts\tCPI\ttime\tL1I miss\tL1D miss\thost s\n");
+
+	for (size_t point = 0; point < dse.nr_points; point++) {
+		int values[DSE_MAX_AXES];
+
+		__dse_point(&dse, point, &dse.configs[point], values);
+		for (int p = 0; p < dse.nr_programs; p++) {
+			const struct dse_result* r = &dse.results[point * dse.nr_programs + p];
+			double cpi = r->instructions ? (double)r->cycles / r->instructions : 0.0;
+
+			fprintf(out, "%s", dse.programs[p]);
+			for (int i = 0; i < dse.nr_axes; i++) fprintf(out, "\t%s", dse.axes[i].values[values[i]]);
+			fprintf(out, "\t%llu\t%llu\t%.4f\t%.4f\t%.4f\t%.4f\t%.6f\n", r->cycles, r->instructions,
+				cpi, cpi / pipe_clock(&dse.configs[point].pipe),
+				r->l1i_accesses ? (double)r->l1i_misses / r->l1i_accesses : 0.0,
+				r->l1d_accesses ? (double)r->l1d_misses / r->l1d_accesses : 0.0,
+				r->seconds);
+		}
+	}
+	if (out != stdout) fclose(out);
+
+	for (int i = 0; i < dse.nr_programs; i++) free(dse.images[i]);
+	for (int i = 0; i < dse.nr_axes; i++) free(dse.axes[i].values);
+	free(dse.images);
+	free(dse.configs);
+	free(dse.results);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1263 @@
+#ifndef __MACHINE_H__
+#define __MACHINE_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/core.h"
+#include "../common/interval.h"
+#include "dram.h"
+#include "prefetch.h"
+
+/**
+ * Multi-core machine. Each core is a pa3-style in-order pipeline (IF, ID,
+ * EX, MEM, WB; each but WB may take several stages, see struct
+ * pipe_config) with private L1 instruction and data caches. The
+ * caches are kept coherent with the MESI protocol by snooping a single
+ * shared bus, and all cores share one memory.
+ *
+ * Instructions are executed by core_execute() when they enter the
+ * pipeline, and the pipeline only decides *when* that happens:
+ *
+ *  - Control transfers stall fetching for @branch_penalty cycles like
+ *    make_stall(IF, 3) in pa3.
+ *  - A consumer enters the pipeline only once its source registers can be
+ *    forwarded (or written back, without forwarding).
+ *  - Cache misses stall the pipeline until the bus delivers the line.
+ *  - lq/sq move 16 bytes over the 64-bit L1D port in MC_WIDE_BEATS
+ *    beats, so MEM takes one cycle more for them.
+ */
+#define ENTRY_PC		0x1000		/* Initial value for PC register */
+#define STACK_TOP		0x100000	/* Stacks grow down from the end of memory */
+#define STACK_SIZE		0x4000		/* per core */
+#define MAX_NR_CORES	(CORE_MEMORY_SIZE / 2 / STACK_SIZE)
+
+#define PREFETCH_POLLUTION_ENTRIES	256
+
+#define MC_WIDE_BEATS	2			/* L1D port beats of a 16-byte lq/sq */
+#define MC_MAX_SOURCES	5			/* sq reads its base and four registers */
+
+#define REG_HI			32			/* Scoreboard slots for hi/lo */
+#define REG_LO			33
+#define NR_SCOREBOARD	34
+
+/* When the store buffer writes its entries into the L1 data cache */
+enum sb_drain {
+	SB_DRAIN_EAGER = 0,			/* As soon as the cache is free */
+	SB_DRAIN_LAZY,				/* Only when the buffer is full */
+	NR_SB_DRAINS,
+};
+
+static const char* const sb_drain_names[NR_SB_DRAINS] = {
+	"eager", "lazy",
+};
+
+#define SB_MAX_DEPTH	64
+
+struct sb_config {
+	unsigned int depth;			/* 0 for no store buffer */
+	enum sb_drain drain;
+	bool combine;				/* Merge stores to the line of the youngest entry */
+};
+
+#define PIPE_MAX_STAGES	4		/* of each part */
+
+/* Stages each part of the pipeline takes, pa3 has one of each and a WB */
+struct pipe_config {
+	unsigned int fetch;			/* The L1I access is spread over them */
+	unsigned int decode;		/* Registers are read in the last one */
+	unsigned int execute;		/* Results come out of the last one */
+	unsigned int memory;		/* The L1D access is spread over them */
+};
+
+/**
+ * Clock of a pipeline relative to the 5-stage one. Each part has a logic
+ * delay in cycles of the 5-stage pipeline, and every stage adds the latch
+ * overhead to its share of the logic of its part; the slowest stage sets
+ * the cycle. The cache accesses of IF and MEM are the critical parts, so
+ * splitting only one of them gains nothing.
+ */
+#define PIPE_LATCH_DELAY	0.1
+
+static const double pipe_logic_delay[] = { 0.9, 0.6, 0.7, 0.9 };	/* IF, ID, EX, MEM; WB is short */
+
+static inline double pipe_clock(const struct pipe_config* pipe)
+{
+	const unsigned int stages[] = { pipe->fetch, pipe->decode, pipe->execute, pipe->memory };
+	double cycle = 0;
+
+	for (int i = 0; i < 4; i++) {
+		if (pipe_logic_delay[i] / stages[i] > cycle) cycle = pipe_logic_delay[i] / stages[i];
+	}
+	return (pipe_logic_delay[0] + PIPE_LATCH_DELAY) / (cycle + PIPE_LATCH_DELAY);
+}
+
+struct mc_config {
+	int nr_cores;
+
+	unsigned int l1_sets;			/* L1 geometry, the same for I and D */
+	unsigned int l1_ways;
+	unsigned int line_size;
+
+	/* In cycles of the 5-stage pipeline, as the DRAM timings; see pipe_scale_memory() */
+	unsigned int mem_latency;		/* Line fill from memory without a DRAM model */
+	unsigned int c2c_latency;		/* Line supplied by another L1 */
+	unsigned int upgrade_latency;	/* Invalidating other sharers */
+	unsigned int bus_occupancy;		/* Cycles one transaction holds the bus */
+
+	unsigned int branch_penalty;	/* of the 5-stage pipeline */
+	bool forwarding;
+	struct pipe_config pipe;
+
+	struct prefetch_config prefetch;	/* for the L1 data caches */
+	struct sb_config store_buffer;		/* between MEM and the L1 data cache */
+	struct dram_config dram;
+
+	unsigned long long max_cycles;
+};
+
+static const struct mc_config mc_default_config = {
+	.nr_cores = 4,
+	.l1_sets = 64,
+	.l1_ways = 2,
+	.line_size = 32,
+	.mem_latency = 40,
+	.c2c_latency = 12,
+	.upgrade_latency = 4,
+	.bus_occupancy = 4,
+	.branch_penalty = 3,
+	.forwarding = true,
+	.pipe = { 1, 1, 1, 1 },
+	.prefetch = { PREFETCH_NONE, 2, 1 },
+	.store_buffer = { 0, SB_DRAIN_EAGER, false },
+	.dram = {
+		.channels = 0,
+		.banks = 8,
+		.row_size = 2048,
+		.policy = DRAM_OPEN_ROW,
+		.tRCD = 14,
+		.tCAS = 14,
+		.tRP = 14,
+		.tBURST = 4,
+		.queue_depth = 16,
+	},
+	.max_cycles = 1ULL << 32,
+};
+
+/***********************************************************************
+ * Pipeline variants
+ *
+ * The features that decide which path an access takes are folded into a
+ * variant mask, and the functions on the hot path take it as a constant
+ * argument. They are always inlined, so each instantiation of
+ * __machine_run() below gets its own copy of the cycle loop in which the
+ * checks for disabled features are gone altogether. machine_run() picks
+ * the copy for the configuration from mc_variants[] at runtime.
+ */
+#define MC_INLINE	static inline __attribute__((always_inline))
+
+enum mc_feature {
+	MC_FORWARDING = 1 << 0,
+	MC_STORE_BUFFER = 1 << 1,
+	MC_PREFETCH = 1 << 2,
+	MC_DRAM = 1 << 3,
+	NR_MC_VARIANTS = 1 << 4,
+
+	MC_PARALLEL = 1 << 4,		/* Not in mc_variants[], the parallel engine is generic */
+};
+
+static const char* const mc_feature_names[] = {
+	"forwarding", "store-buffer", "prefetch", "dram",
+};
+
+/* Variant of the serial engine that runs @config */
+static inline unsigned int mc_variant(const struct mc_config* config)
+{
+	return (config->forwarding ? MC_FORWARDING : 0) |
+		(config->store_buffer.depth ? MC_STORE_BUFFER : 0) |
+		(config->prefetch.type != PREFETCH_NONE ? MC_PREFETCH : 0) |
+		(config->dram.channels ? MC_DRAM : 0);
+}
+
+/***********************************************************************
+ * MESI caches
+ */
+enum mesi {
+	MESI_I = 0,
+	MESI_S,
+	MESI_E,
+	MESI_M,
+};
+
+struct cache_line {
+	unsigned int tag;			/* Line address, i.e., addr >> line_shift */
+	unsigned char state;
+	bool prefetched;			/* Brought in by the prefetcher, not used yet */
+	unsigned long long lru;
+	unsigned long long ready_at;	/* Cycle a prefetch fill arrives */
+};
+
+struct cache {
+	unsigned int sets;
+	unsigned int ways;
+	unsigned int line_shift;
+	unsigned long long tick;
+	struct cache_line* lines;
+
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long writebacks;
+	unsigned long long invalidations;	/* Lines lost to other cores */
+};
+
+static inline void cache_init(struct cache* cache, const struct mc_config* config)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->sets = config->l1_sets;
+	cache->ways = config->l1_ways;
+	while ((1u << cache->line_shift) < config->line_size) cache->line_shift++;
+	cache->lines = calloc((size_t)cache->sets * cache->ways, sizeof(*cache->lines));
+	if (!cache->lines) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static inline struct cache_line* cache_lookup(struct cache* cache, unsigned int line_addr)
+{
+	struct cache_line* set = cache->lines + (size_t)(line_addr % cache->sets) * cache->ways;
+
+	for (unsigned int i = 0; i < cache->ways; i++) {
+		if (set[i].state != MESI_I && set[i].tag == line_addr) return &set[i];
+	}
+	return NULL;
+}
+
+/* Pick the LRU way of the set @line_addr maps to */
+static inline struct cache_line* cache_victim(struct cache* cache, unsigned int line_addr)
+{
+	struct cache_line* set = cache->lines + (size_t)(line_addr % cache->sets) * cache->ways;
+	struct cache_line* victim = &set[0];
+
+	for (unsigned int i = 0; i < cache->ways; i++) {
+		if (set[i].state == MESI_I) return &set[i];
+		if (set[i].lru < victim->lru) victim = &set[i];
+	}
+	return victim;
+}
+
+static inline void cache_touch(struct cache* cache, struct cache_line* line)
+{
+	line->lru = ++cache->tick;
+}
+
+/***********************************************************************
+ * Snooping bus
+ */
+enum bus_request {
+	BUS_RD = 0,		/* Read miss */
+	BUS_RDX,		/* Write miss, read for ownership */
+	BUS_UPGR,		/* Write hit on a shared line */
+	BUS_WB,			/* Write back of a modified victim */
+	NR_BUS_REQUESTS,
+};
+
+static const char* const bus_request_names[NR_BUS_REQUESTS] = {
+	"BusRd", "BusRdX", "BusUpgr", "WriteBack",
+};
+
+struct bus {
+	unsigned long long free_at;		/* First cycle the bus is idle */
+
+	unsigned long long requests[NR_BUS_REQUESTS];
+	unsigned long long c2c_transfers;
+	unsigned long long busy_cycles;
+	unsigned long long wait_cycles;	/* Cycles requesters waited for the bus */
+};
+
+/***********************************************************************
+ * Cores and the machine
+ */
+
+/* Store made during a quantum of the parallel engine, see parallel.h */
+struct mc_store {
+	unsigned int addr;
+	unsigned int value;
+};
+
+/* Who put a request on the bus */
+enum bus_source {
+	BUS_FROM_L1I = 0,
+	BUS_FROM_L1D,
+	BUS_FROM_PREFETCH,			/* Nobody waits for it */
+	BUS_FROM_L1D_EXCLUSIVE,		/* Silent E -> M, see __replay_bus_events() */
+	BUS_FROM_PREFETCHED,		/* First use of a prefetched line, a miss if it is gone */
+};
+
+/* Bus transaction whose effect on the other cores is deferred */
+struct mc_bus_event {
+	unsigned long long cycle;
+	unsigned int line_addr;
+	unsigned int seq;			/* Keeps the order of events of one core */
+	unsigned short core;
+	unsigned char request;
+	unsigned char source;
+};
+
+/* Stores to one line waiting to be written into the L1D */
+struct sb_entry {
+	unsigned int line_addr;
+	unsigned int pc;				/* Of the latest store merged in */
+	unsigned long long mask;		/* Bytes of the line written */
+	unsigned long long enqueued;	/* Cycle the first store entered */
+};
+
+struct store_buffer {
+	struct sb_entry entries[SB_MAX_DEPTH];	/* Ring, oldest at @head */
+	unsigned int head;
+	unsigned int count;
+	unsigned long long free_at;		/* Cycle the L1D takes the next entry */
+};
+
+struct mc_core {
+	int id;
+	struct mips_core cpu;
+	struct cache l1i;
+	struct cache l1d;
+
+	bool halted;
+	unsigned long long ready;		/* Cycle the next instruction enters IF */
+	unsigned long long reg_ready[NR_SCOREBOARD];
+
+	/* Statistics */
+	unsigned long long instructions;
+	unsigned long long cycles;		/* Cycle the core halted */
+	unsigned long long branch_stalls;
+	unsigned long long data_stalls;
+	unsigned long long fetch_stalls;
+	unsigned long long mem_stalls;
+	unsigned long long bus_wait;
+	unsigned long long ll_count;
+	unsigned long long sc_failures;
+
+	struct prefetcher prefetcher;
+	unsigned int pollution[PREFETCH_POLLUTION_ENTRIES];	/* Lines evicted by prefetches, + 1 */
+	unsigned long long prefetch_issued;
+	unsigned long long prefetch_useful;		/* Hit by a demand access before eviction */
+	unsigned long long prefetch_late;		/* ... but before the fill arrived */
+	unsigned long long prefetch_unused;		/* Evicted without being used */
+	unsigned long long prefetch_polluting;	/* Demand misses on lines a prefetch evicted */
+
+	struct store_buffer sb;
+	unsigned long long sb_stores;
+	unsigned long long sb_combined;		/* Merged into the youngest entry */
+	unsigned long long sb_forwarded;	/* Loads served by the buffer */
+	unsigned long long sb_conflicts;	/* Loads that had to wait for a partial match to drain */
+	unsigned long long sb_full_stalls;	/* Cycles stores waited for a free entry */
+
+	/* Used only by the parallel engine */
+	bool parked;					/* Waiting at sc for the end of the quantum */
+	unsigned char* private_memory;	/* What this core sees during a quantum */
+	struct mc_store* stores;		/* Made in this quantum */
+	size_t nr_stores;
+	size_t max_stores;
+	struct mc_bus_event* bus_events;
+	size_t nr_bus_events;
+	size_t max_bus_events;
+	unsigned int miss_latency;		/* Assumed for a miss in a quantum */
+	unsigned long long miss_cycles;	/* Taken by the misses replayed so far */
+	unsigned long long nr_misses;
+	long long credit;				/* Cycles charged in excess, not given back yet */
+};
+
+/**
+ * Cycles, from the one an instruction enters IF, worked out from struct
+ * pipe_config. A consumer may enter @*_use cycles after the instruction
+ * that follows its producer could have, which is when the value reaches
+ * the first EX stage of the consumer: by forwarding from the end of EX
+ * (or of MEM, for loads), or through the register file, written in WB
+ * and read in the last ID stage. Branches are resolved as in pa3, later
+ * by the stages IF, ID and EX have in excess of one.
+ */
+struct pipe_timing {
+	unsigned int depth;			/* Stages, WB included */
+	unsigned int mem;			/* First MEM stage */
+	unsigned int alu_use;
+	unsigned int load_use;
+	unsigned int wb_use;		/* without forwarding */
+	unsigned int branch_penalty;
+};
+
+static inline void pipe_timing_init(struct pipe_timing* t, const struct mc_config* config)
+{
+	const struct pipe_config* pipe = &config->pipe;
+
+	t->depth = pipe->fetch + pipe->decode + pipe->execute + pipe->memory + 1;
+	t->mem = pipe->fetch + pipe->decode + pipe->execute;
+	t->alu_use = pipe->execute - 1;
+	t->load_use = pipe->execute - 1 + pipe->memory;
+	t->wb_use = pipe->execute + pipe->memory;
+	t->branch_penalty = config->branch_penalty + (pipe->fetch - 1) + (pipe->decode - 1) + (pipe->execute - 1);
+}
+
+static inline unsigned int __pipe_scale(unsigned int cycles, double clock)
+{
+	return (unsigned int)(cycles * clock + 0.5);
+}
+
+/**
+ * The bus, the other caches and memory do not speed up with the pipeline
+ * clock, so their latencies, given in cycles of the 5-stage pipeline,
+ * take pipe_clock() times as many cycles of a deeper pipeline. This makes
+ * the time per instruction comparable across depths.
+ */
+static inline void pipe_scale_memory(struct mc_config* config)
+{
+	double clock = pipe_clock(&config->pipe);
+
+	config->mem_latency = __pipe_scale(config->mem_latency, clock);
+	config->c2c_latency = __pipe_scale(config->c2c_latency, clock);
+	config->upgrade_latency = __pipe_scale(config->upgrade_latency, clock);
+	config->bus_occupancy = __pipe_scale(config->bus_occupancy, clock);
+	config->dram.tRCD = __pipe_scale(config->dram.tRCD, clock);
+	config->dram.tCAS = __pipe_scale(config->dram.tCAS, clock);
+	config->dram.tRP = __pipe_scale(config->dram.tRP, clock);
+	config->dram.tBURST = __pipe_scale(config->dram.tBURST, clock);
+}
+
+struct machine {
+	struct mc_config config;		/* Memory latencies in cycles of the pipeline */
+	struct pipe_timing pipe;
+	unsigned char* memory;
+	struct mc_core* cores;
+	struct bus bus;
+	struct dram dram;				/* If config.dram.channels */
+	unsigned long long cycle;
+	unsigned long long skipped_cycles;	/* Cycles machine_run() jumped over */
+
+	bool parallel;					/* Snoops are deferred to quantum ends */
+	unsigned long long quantum_end;
+
+	struct interval* interval;		/* Sampled by the serial engine if set */
+};
+
+/***********************************************************************
+ * machine_init(machine, config, image)
+ *
+ * DESCRIPTION
+ *   Build a machine with @config whose memory starts as a copy of @image
+ *   (CORE_MEMORY_SIZE bytes). Every core starts at ENTRY_PC with its own
+ *   stack; $k0 holds the core id and $k1 the number of cores so that the
+ *   guest can split work.
+ */
+static inline void machine_init(struct machine* m, const struct mc_config* config, const unsigned char* image)
+{
+	memset(m, 0, sizeof(*m));
+	m->config = *config;
+	pipe_scale_memory(&m->config);
+	pipe_timing_init(&m->pipe, config);
+	m->memory = malloc(CORE_MEMORY_SIZE);
+	m->cores = calloc(config->nr_cores, sizeof(*m->cores));
+	if (!m->memory || !m->cores) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(m->memory, image, CORE_MEMORY_SIZE);
+
+	for (int i = 0; i < config->nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		c->id = i;
+		c->cpu.memory = m->memory;
+		c->cpu.pc = ENTRY_PC;
+		c->cpu.registers[26] = i;					/* $k0 */
+		c->cpu.registers[27] = config->nr_cores;	/* $k1 */
+		c->cpu.registers[29] = STACK_TOP - i * STACK_SIZE;	/* $sp */
+		cache_init(&c->l1i, config);
+		cache_init(&c->l1d, config);
+		prefetcher_init(&c->prefetcher);
+	}
+
+	if (config->dram.channels) dram_init(&m->dram, &m->config.dram);
+}
+
+static inline void machine_destroy(struct machine* m)
+{
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		free(m->cores[i].l1i.lines);
+		free(m->cores[i].l1d.lines);
+		free(m->cores[i].private_memory);
+		free(m->cores[i].stores);
+		free(m->cores[i].bus_events);
+	}
+	free(m->cores);
+	free(m->memory);
+	if (m->config.dram.channels) dram_destroy(&m->dram);
+}
+
+/**
+ * Put a transaction on the bus at @now. Returns the cycle the data is
+ * available to the requester after waiting for the bus and @latency.
+ */
+static inline unsigned long long bus_transaction(struct machine* m, struct mc_core* c,
+	enum bus_request request, unsigned long long now, unsigned int latency)
+{
+	unsigned long long start = now > m->bus.free_at ? now : m->bus.free_at;
+
+	m->bus.requests[request]++;
+	m->bus.wait_cycles += start - now;
+	m->bus.busy_cycles += m->config.bus_occupancy;
+	m->bus.free_at = start + m->config.bus_occupancy;
+	c->bus_wait += start - now;
+
+	return start + latency;
+}
+
+/* Grow the log @array of @size elements of @elem bytes */
+static inline void* __grow_log(void* array, size_t* size, size_t elem)
+{
+	*size = *size ? *size * 2 : 256;
+	array = realloc(array, *size * elem);
+	if (!array) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return array;
+}
+
+static inline void __log_bus_event(struct mc_core* c, enum bus_request request, unsigned int line_addr,
+	enum bus_source source, unsigned long long now)
+{
+	struct mc_bus_event* event;
+
+	if (c->nr_bus_events == c->max_bus_events) {
+		c->bus_events = __grow_log(c->bus_events, &c->max_bus_events, sizeof(*c->bus_events));
+	}
+	event = &c->bus_events[c->nr_bus_events];
+	event->cycle = now;
+	event->line_addr = line_addr;
+	event->seq = (unsigned int)c->nr_bus_events++;
+	event->core = (unsigned short)c->id;
+	event->request = (unsigned char)request;
+	event->source = (unsigned char)source;
+}
+
+static inline void __log_store(struct mc_core* c, unsigned int addr, unsigned int value)
+{
+	if (c->nr_stores == c->max_stores) {
+		c->stores = __grow_log(c->stores, &c->max_stores, sizeof(*c->stores));
+	}
+	c->stores[c->nr_stores].addr = addr;
+	c->stores[c->nr_stores].value = value;
+	c->nr_stores++;
+}
+
+/* Drop @line from @cache on behalf of another core */
+static inline void snoop_invalidate(struct cache* cache, struct cache_line* line)
+{
+	line->state = MESI_I;
+	line->prefetched = false;
+	cache->invalidations++;
+}
+
+/**
+ * Snoop all the other L1s for @line_addr. Returns true if another cache
+ * holds the line; @supplied is set if one of them sources the data.
+ */
+static inline bool snoop(struct machine* m, struct mc_core* requester, unsigned int line_addr,
+	enum bus_request request, bool* supplied)
+{
+	bool shared = false;
+
+	*supplied = false;
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* other = &m->cores[i];
+		struct cache_line* line;
+
+		if (other == requester) continue;
+
+		/**
+		 * Someone is about to write the line, so the reservation is broken.
+		 * Evicting the line breaks it as well, see __cache_fill(). The
+		 * parallel engine breaks reservations when it commits stores instead.
+		 */
+		if (request != BUS_RD && !m->parallel && other->cpu.link_valid &&
+			(other->cpu.link_addr >> other->l1d.line_shift) == line_addr) {
+			other->cpu.link_valid = false;
+		}
+
+		if ((line = cache_lookup(&other->l1d, line_addr))) {
+			shared = true;
+			if (line->state == MESI_M || line->state == MESI_E) {
+				*supplied = request != BUS_UPGR;
+				if (line->state == MESI_M) other->l1d.writebacks++;
+			}
+			if (request == BUS_RD) {
+				line->state = MESI_S;
+			}
+			else {
+				snoop_invalidate(&other->l1d, line);
+			}
+		}
+		/* Stores invalidate stale instructions as well */
+		if (request != BUS_RD && (line = cache_lookup(&other->l1i, line_addr))) {
+			snoop_invalidate(&other->l1i, line);
+		}
+	}
+	if (*supplied) m->bus.c2c_transfers++;
+
+	return shared;
+}
+
+/* Allocate a line for @line_addr in @cache, writing back a dirty victim */
+MC_INLINE struct cache_line* __cache_fill(struct machine* m, struct mc_core* c, struct cache* cache,
+	unsigned int line_addr, enum mesi state, unsigned long long now, const unsigned int variant)
+{
+	struct cache_line* line = cache_victim(cache, line_addr);
+
+	if (line->state != MESI_I && line->prefetched) c->prefetch_unused++;
+
+	/* Once the line is gone nobody snoops it for us, so drop the reservation as LL/SC does */
+	if (line->state != MESI_I && cache == &c->l1d && c->cpu.link_valid &&
+		(c->cpu.link_addr >> cache->line_shift) == line->tag) {
+		c->cpu.link_valid = false;
+	}
+
+	if (line->state == MESI_M) {
+		cache->writebacks++;
+		if (variant & MC_PARALLEL) {
+			__log_bus_event(c, BUS_WB, line->tag, BUS_FROM_L1D, now);
+		}
+		else {
+			unsigned long long start = bus_transaction(m, c, BUS_WB, now, 0);
+
+			if (variant & MC_DRAM) dram_write(&m->dram, line->tag << cache->line_shift, start);
+		}
+	}
+	line->tag = line_addr;
+	line->state = state;
+	line->prefetched = false;
+	line->ready_at = 0;
+	cache_touch(cache, line);
+
+	return line;
+}
+
+/**
+ * Issue @request for @line_addr at @now and return the cycle it is done.
+ * @shared tells whether other caches keep a copy. With the parallel engine
+ * the other cores cannot be looked at in the middle of a quantum, so a
+ * miss is assumed to take the latency misses of the core took on average
+ * so far on an idle bus, and snooping and bus contention are settled at
+ * the end of the quantum.
+ */
+MC_INLINE unsigned long long __bus_request(struct machine* m, struct mc_core* c, enum bus_request request,
+	unsigned int line_addr, enum bus_source source, unsigned long long now, bool* shared, const unsigned int variant)
+{
+	bool supplied = false;
+	unsigned int latency;
+
+	if (variant & MC_PARALLEL) {
+		__log_bus_event(c, request, line_addr, source, now);
+		*shared = false;
+		return now + (request == BUS_UPGR ? m->config.upgrade_latency : c->miss_latency);
+	}
+
+	*shared = snoop(m, c, line_addr, request, &supplied);
+	if (request == BUS_UPGR) {
+		latency = m->config.upgrade_latency;
+	}
+	else if (supplied) {
+		latency = m->config.c2c_latency;
+	}
+	else if (variant & MC_DRAM) {
+		return dram_read(&m->dram, line_addr << c->l1d.line_shift, bus_transaction(m, c, request, now, 0));
+	}
+	else {
+		latency = m->config.mem_latency;
+	}
+
+	return bus_transaction(m, c, request, now, latency);
+}
+
+/**
+ * Fetch through the L1 instruction cache. Returns the cycle the
+ * instruction is available.
+ */
+MC_INLINE unsigned long long __l1i_access(struct machine* m, struct mc_core* c, unsigned int addr,
+	unsigned long long now, const unsigned int variant)
+{
+	unsigned int line_addr = addr >> c->l1i.line_shift;
+	struct cache_line* line = cache_lookup(&c->l1i, line_addr);
+	unsigned long long done;
+	bool shared;
+
+	if (line) {
+		c->l1i.hits++;
+		cache_touch(&c->l1i, line);
+		return now;
+	}
+
+	c->l1i.misses++;
+	done = __bus_request(m, c, BUS_RD, line_addr, BUS_FROM_L1I, now, &shared, variant);
+	__cache_fill(m, c, &c->l1i, line_addr, MESI_S, now, variant);
+
+	return done;
+}
+
+/**
+ * Prefetch @line_addr into the L1 data cache of @c at @now unless it is
+ * there already. The line is usable once the fill arrives.
+ */
+MC_INLINE void __l1d_prefetch(struct machine* m, struct mc_core* c, unsigned int line_addr,
+	unsigned long long now, const unsigned int variant)
+{
+	struct cache_line* victim;
+	struct cache_line* line;
+	unsigned long long done;
+	bool shared;
+
+	if (cache_lookup(&c->l1d, line_addr)) return;
+
+	/* Remember what we throw out to spot pollution later */
+	victim = cache_victim(&c->l1d, line_addr);
+	if (victim->state != MESI_I && !victim->prefetched) {
+		c->pollution[victim->tag % PREFETCH_POLLUTION_ENTRIES] = victim->tag + 1;
+	}
+
+	c->prefetch_issued++;
+	done = __bus_request(m, c, BUS_RD, line_addr, BUS_FROM_PREFETCH, now, &shared, variant);
+	/* Who else has the line is known only at the end of the quantum, see __replay_bus_events() */
+	line = __cache_fill(m, c, &c->l1d, line_addr, shared || (variant & MC_PARALLEL) ? MESI_S : MESI_E, now,
+		variant);
+	line->prefetched = true;
+	line->ready_at = done;
+}
+
+/**
+ * Load or store through the L1 data cache following MESI. Returns the
+ * cycle the access completes. The prefetcher of @c is trained with the
+ * access of the instruction at @pc afterwards.
+ */
+MC_INLINE unsigned long long __l1d_access(struct machine* m, struct mc_core* c, unsigned int pc,
+	unsigned int addr, bool store, unsigned long long now, const unsigned int variant)
+{
+	unsigned int line_addr = addr >> c->l1d.line_shift;
+	struct cache_line* line = cache_lookup(&c->l1d, line_addr);
+	enum prefetch_event event = PREFETCH_HIT;
+	unsigned long long done = now;
+	bool shared;
+
+	if (line) {
+		c->l1d.hits++;
+		if (line->prefetched) {
+			c->prefetch_useful++;
+			line->prefetched = false;
+			event = PREFETCH_HIT_PREFETCHED;
+			if (variant & MC_PARALLEL) {
+				__log_bus_event(c, store ? BUS_RDX : BUS_RD, line_addr, BUS_FROM_PREFETCHED, now);
+			}
+			if (line->ready_at > now) {
+				c->prefetch_late++;
+				done = line->ready_at;
+			}
+		}
+		if (store && line->state == MESI_S) {	/* Store to a shared line */
+			done = __bus_request(m, c, BUS_UPGR, line_addr, BUS_FROM_L1D, done, &shared, variant);
+		}
+		if (store && line->state == MESI_E && (variant & MC_PARALLEL)) {
+			/* Another core may have read the line in the quantum, so let the replay decide */
+			__log_bus_event(c, BUS_UPGR, line_addr, BUS_FROM_L1D_EXCLUSIVE, done);
+		}
+		if (store) line->state = MESI_M;	/* E -> M is silent */
+		cache_touch(&c->l1d, line);
+	}
+	else {
+		c->l1d.misses++;
+		event = PREFETCH_MISS;
+
+		if (c->pollution[line_addr % PREFETCH_POLLUTION_ENTRIES] == line_addr + 1) {
+			c->prefetch_polluting++;
+			c->pollution[line_addr % PREFETCH_POLLUTION_ENTRIES] = 0;
+		}
+
+		if (store) {
+			done = __bus_request(m, c, BUS_RDX, line_addr, BUS_FROM_L1D, now, &shared, variant);
+			__cache_fill(m, c, &c->l1d, line_addr, MESI_M, now, variant);
+		}
+		else {
+			done = __bus_request(m, c, BUS_RD, line_addr, BUS_FROM_L1D, now, &shared, variant);
+			__cache_fill(m, c, &c->l1d, line_addr, shared ? MESI_S : MESI_E, now, variant);
+		}
+	}
+
+	if (variant & MC_PREFETCH) {
+		unsigned int lines[PREFETCH_MAX_DEGREE];
+		int nr_lines = prefetch_train(&c->prefetcher, &m->config.prefetch, pc, addr, c->l1d.line_shift,
+			event, lines);
+
+		for (int i = 0; i < nr_lines; i++) {
+			__l1d_prefetch(m, c, lines[i], now, variant);
+		}
+	}
+
+	return done;
+}
+
+/***********************************************************************
+ * Store buffer
+ *
+ * Stores leave MEM into a FIFO and are written into the L1D in order,
+ * one at a time, while the pipeline goes on. Loads look at the buffer
+ * first: one covered entirely by a pending store is forwarded from it,
+ * and one overlapping a pending store partially waits until that store
+ * is written. A store finding the buffer full waits for the oldest entry.
+ * ll and sc drain the whole buffer first, like a fence.
+ *
+ * Only timing is modelled; core_step() has updated the memory already, so
+ * the values the cores see are those of sequential consistency.
+ */
+static inline struct sb_entry* __sb_entry(struct store_buffer* sb, unsigned int i)
+{
+	return &sb->entries[(sb->head + i) % SB_MAX_DEPTH];
+}
+
+/* Write the oldest entry into the L1D, not earlier than @now */
+MC_INLINE unsigned long long __sb_write(struct machine* m, struct mc_core* c, unsigned long long now,
+	const unsigned int variant)
+{
+	struct store_buffer* sb = &c->sb;
+	struct sb_entry* e = __sb_entry(sb, 0);
+	unsigned long long start = now;
+	unsigned long long done;
+
+	if (start < e->enqueued) start = e->enqueued;
+	if (start < sb->free_at) start = sb->free_at;
+
+	done = __l1d_access(m, c, e->pc, e->line_addr << c->l1d.line_shift, true, start, variant);
+	sb->free_at = done > start ? done : start + 1;	/* One entry per cycle at most */
+	sb->head = (sb->head + 1) % SB_MAX_DEPTH;
+	sb->count--;
+
+	return sb->free_at;
+}
+
+/* Write the entries the eager policy would have started by @now */
+MC_INLINE void __sb_drain(struct machine* m, struct mc_core* c, unsigned long long now, const unsigned int variant)
+{
+	struct store_buffer* sb = &c->sb;
+
+	if (m->config.store_buffer.drain != SB_DRAIN_EAGER) return;
+
+	while (sb->count &&
+		(sb->free_at > __sb_entry(sb, 0)->enqueued ? sb->free_at : __sb_entry(sb, 0)->enqueued) <= now) {
+		__sb_write(m, c, 0, variant);
+	}
+}
+
+/**
+ * Write every entry of the store buffer of @c into the L1D, starting at
+ * @now. Returns the cycle the buffer is empty.
+ */
+MC_INLINE unsigned long long sb_flush(struct machine* m, struct mc_core* c, unsigned long long now,
+	const unsigned int variant)
+{
+	unsigned long long done = now > c->sb.free_at ? now : c->sb.free_at;
+
+	while (c->sb.count) {
+		done = __sb_write(m, c, now, variant);
+	}
+	return done;
+}
+
+/**
+ * Load or store of @retire at @now through the store buffer of @c.
+ * Returns the cycle the pipeline may go on, as l1d_access() does.
+ */
+MC_INLINE unsigned long long sb_access(struct machine* m, struct mc_core* c, const struct mips_retire* retire,
+	unsigned long long now, const unsigned int variant)
+{
+	const struct sb_config* config = &m->config.store_buffer;
+	struct store_buffer* sb = &c->sb;
+	unsigned int line_addr = retire->mem_addr >> c->l1d.line_shift;
+	unsigned int offset = retire->mem_addr & ((1u << c->l1d.line_shift) - 1);
+	unsigned long long mask = ((1ULL << retire->mem_size) - 1) << offset;
+	unsigned long long done = now;
+	struct sb_entry* e;
+
+	__sb_drain(m, c, now, variant);
+
+	if (retire->id == ISA_LL || retire->id == ISA_SC) {
+		done = sb_flush(m, c, now, variant);
+		return __l1d_access(m, c, retire->pc, retire->mem_addr, retire->mem_store, done, variant);
+	}
+
+	if (!retire->mem_store) {
+		for (int i = (int)sb->count - 1; i >= 0; i--) {
+			e = __sb_entry(sb, i);
+			if (e->line_addr != line_addr || !(e->mask & mask)) continue;
+
+			if ((e->mask & mask) == mask) {
+				c->sb_forwarded++;
+				return now;
+			}
+
+			/* Partly in the buffer, so wait until it gets to the cache */
+			c->sb_conflicts++;
+			while (i-- >= 0) done = __sb_write(m, c, now, variant);
+			break;
+		}
+		return __l1d_access(m, c, retire->pc, retire->mem_addr, false, done, variant);
+	}
+
+	c->sb_stores++;
+
+	if (config->combine && sb->count) {
+		e = __sb_entry(sb, sb->count - 1);
+		if (e->line_addr == line_addr) {
+			e->mask |= mask;
+			e->pc = retire->pc;
+			c->sb_combined++;
+			return now;
+		}
+	}
+
+	if (sb->count == config->depth) {
+		done = __sb_write(m, c, now, variant);
+		c->sb_full_stalls += done - now;
+	}
+
+	e = __sb_entry(sb, sb->count++);
+	e->line_addr = line_addr;
+	e->pc = retire->pc;
+	e->mask = mask;
+	e->enqueued = done;
+
+	return done;
+}
+
+/**
+ * 16-byte access of lq/sq at @now, one per line when the lines are
+ * shorter than that. Returns the cycle the pipeline may go on.
+ */
+MC_INLINE unsigned long long __wide_access(struct machine* m, struct mc_core* c, const struct mips_retire* retire,
+	unsigned long long now, const unsigned int variant)
+{
+	struct mips_retire part = *retire;
+	unsigned int line_size = 1u << c->l1d.line_shift;
+	unsigned long long done = now;
+
+	part.mem_size = retire->mem_size < line_size ? retire->mem_size : line_size;
+	for (unsigned int offset = 0; offset < retire->mem_size; offset += part.mem_size) {
+		part.mem_addr = retire->mem_addr + offset;
+		if (variant & MC_STORE_BUFFER) done = sb_access(m, c, &part, done, variant);
+		else done = __l1d_access(m, c, part.pc, part.mem_addr, part.mem_store, done, variant);
+	}
+	return done + MC_WIDE_BEATS - 1;
+}
+
+/**
+ * Registers @retire reads. hi/lo use the REG_HI/REG_LO scoreboard slots.
+ * Returns the number of sources put into @srcs.
+ */
+static inline int retire_sources(const struct mips_retire* retire, int srcs[MC_MAX_SOURCES])
+{
+	unsigned int instr = retire->instr;
+
+	switch (isa_table[retire->id].layout) {
+	case LAYOUT_RD_RS_RT:
+	case LAYOUT_RS_RT:
+	case LAYOUT_RT_RS_BOFF:
+		srcs[0] = ISA_RS(instr);
+		srcs[1] = ISA_RT(instr);
+		return 2;
+	case LAYOUT_RD_RT_SHAMT:
+		srcs[0] = ISA_RT(instr);
+		return 1;
+	case LAYOUT_RD:
+		srcs[0] = retire->id == ISA_MFHI ? REG_HI : REG_LO;
+		return 1;
+	case LAYOUT_RS:
+	case LAYOUT_RT_RS_SIMM:
+	case LAYOUT_RT_RS_UIMM:
+		srcs[0] = ISA_RS(instr);
+		return 1;
+	case LAYOUT_RT_OFF_RS:
+		srcs[0] = ISA_RS(instr);
+		srcs[1] = ISA_RT(instr);
+		if (retire->id == ISA_SQ) {
+			for (int i = 1; i < 4; i++) srcs[i + 1] = ISA_RT(instr) + i;
+			return 5;
+		}
+		return (retire->id == ISA_SW || retire->id == ISA_SC) ? 2 : 1;
+	default:
+		return 0;
+	}
+}
+
+/***********************************************************************
+ * __core_cycle(m, c, now, variant)
+ *
+ * DESCRIPTION
+ *   Let the next instruction of @c enter the pipeline at @now, which must
+ *   not be earlier than @c->ready. The instruction is executed and
+ *   @c->ready is advanced to the cycle the following one may enter.
+ *   @variant has to match the configuration of @m, see mc_variant().
+ */
+MC_INLINE void __core_cycle(struct machine* m, struct mc_core* c, unsigned long long now, const unsigned int variant)
+{
+	const struct pipe_timing* pipe = &m->pipe;
+	struct mips_retire retire;
+	unsigned long long issue = now;
+	unsigned long long next;
+	unsigned long long fetched;
+	int srcs[MC_MAX_SOURCES];
+	int nr_srcs;
+
+	/* sc has to see the stores of the other cores, see parallel.h */
+	if ((variant & MC_PARALLEL) && !c->parked && (core_fetch(&c->cpu) >> 26) == isa_table[ISA_SC].opcode) {
+		c->parked = true;
+		return;
+	}
+
+	fetched = __l1i_access(m, c, c->cpu.pc, now, variant);
+	c->fetch_stalls += fetched - now;
+	issue = fetched;
+
+	if (!core_step(&c->cpu, &retire)) {
+		c->halted = true;
+		c->cycles = issue + pipe->depth - 1;	/* Drain the pipeline */
+		if (c->sb.count) {
+			unsigned long long done = sb_flush(m, c, issue + pipe->mem, variant);
+
+			if (c->cycles < done) c->cycles = done;
+		}
+		return;
+	}
+	c->instructions++;
+
+	if ((variant & MC_PARALLEL) && retire.mem_store) {
+		if (retire.mem_size > 4) {
+			for (unsigned int offset = 0; offset < retire.mem_size; offset += 4) {
+				__log_store(c, retire.mem_addr + offset, core_load_word(c->cpu.memory, retire.mem_addr + offset));
+			}
+		}
+		else {
+			__log_store(c, retire.mem_addr, retire.mem_value);
+		}
+	}
+
+	/* Wait until the operands can be read (or forwarded) */
+	nr_srcs = retire_sources(&retire, srcs);
+	for (int i = 0; i < nr_srcs; i++) {
+		if (srcs[i] && c->reg_ready[srcs[i]] > issue) {
+			c->data_stalls += c->reg_ready[srcs[i]] - issue;
+			issue = c->reg_ready[srcs[i]];
+		}
+	}
+	next = issue + 1;
+
+	if (retire.mem_size) {
+		unsigned long long at_mem = issue + pipe->mem;
+		unsigned long long done;
+
+		if (retire.id == ISA_LL) c->ll_count++;
+		if (retire.mem_size > 4) {
+			done = __wide_access(m, c, &retire, at_mem, variant);
+		}
+		else if (variant & MC_STORE_BUFFER) {
+			done = sb_access(m, c, &retire, at_mem, variant);
+		}
+		else {
+			done = __l1d_access(m, c, retire.pc, retire.mem_addr, retire.mem_store, at_mem, variant);
+		}
+		if (done > at_mem) {	/* Blocking cache, the whole pipeline waits */
+			c->mem_stalls += done - at_mem;
+			next += done - at_mem;
+		}
+	}
+	else if (retire.id == ISA_SC) {	/* Failed sc writes nothing, so it does not access the cache */
+		c->sc_failures++;
+	}
+
+	if (retire.write_reg > 0) {
+		if (!(variant & MC_FORWARDING)) {
+			c->reg_ready[retire.write_reg] = next + pipe->wb_use;	/* Written in WB, read in ID */
+		}
+		else if (retire.mem_size && !retire.mem_store) {
+			c->reg_ready[retire.write_reg] = next + pipe->load_use;
+		}
+		else {
+			c->reg_ready[retire.write_reg] = next + pipe->alu_use;
+		}
+	}
+	if (retire.id == ISA_LQ) {	/* The other three registers, even with $zero as the first */
+		unsigned int rt = ISA_RT(retire.instr);
+
+		for (unsigned int i = 1; i < 4; i++) {
+			c->reg_ready[rt + i] = next + ((variant & MC_FORWARDING) ? pipe->load_use : pipe->wb_use);
+		}
+	}
+	if (retire.id == ISA_MULT) {
+		c->reg_ready[REG_HI] = c->reg_ready[REG_LO] = next + ((variant & MC_FORWARDING) ? pipe->alu_use : pipe->wb_use);
+	}
+
+	if (isa_table[retire.id].layout == LAYOUT_RT_RS_BOFF || isa_table[retire.id].layout == LAYOUT_TARGET ||
+		retire.id == ISA_JR) {
+		c->branch_stalls += pipe->branch_penalty;
+		next += pipe->branch_penalty;
+	}
+
+	c->ready = next;
+}
+
+/* __core_cycle() with the variant of @m worked out on every call */
+static inline void core_cycle(struct machine* m, struct mc_core* c, unsigned long long now)
+{
+	__core_cycle(m, c, now, mc_variant(&m->config) | (m->parallel ? MC_PARALLEL : 0));
+}
+
+/* Columns of the interval statistics, summed over the cores */
+enum mc_interval_counter {
+	MC_INTERVAL_INSTRUCTIONS = 0,
+	MC_INTERVAL_BRANCH_STALLS,
+	MC_INTERVAL_DATA_STALLS,
+	MC_INTERVAL_FETCH_STALLS,
+	MC_INTERVAL_MEM_STALLS,
+	MC_INTERVAL_L1I_MISSES,
+	MC_INTERVAL_L1D_ACCESSES,
+	MC_INTERVAL_L1D_MISSES,
+	MC_INTERVAL_INVALIDATIONS,
+	MC_INTERVAL_BUS_BUSY,
+	NR_MC_INTERVAL_COUNTERS,
+};
+
+static const char* const mc_interval_names[NR_MC_INTERVAL_COUNTERS] = {
+	"instructions", "branch_stalls", "data_stalls", "fetch_stalls", "mem_stalls",
+	"l1i_misses", "l1d_accesses", "l1d_misses", "invalidations", "bus_busy",
+};
+
+static const struct interval_ratio mc_interval_ratios[] = {
+	{ "IPC", MC_INTERVAL_INSTRUCTIONS, -1 },
+	{ "l1d_miss_rate", MC_INTERVAL_L1D_MISSES, MC_INTERVAL_L1D_ACCESSES },
+};
+
+#define NR_MC_INTERVAL_RATIOS	(sizeof(mc_interval_ratios) / sizeof(mc_interval_ratios[0]))
+
+static inline void machine_interval_counters(const struct machine* m, unsigned long long* values)
+{
+	memset(values, 0, NR_MC_INTERVAL_COUNTERS * sizeof(*values));
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		const struct mc_core* c = &m->cores[i];
+
+		values[MC_INTERVAL_INSTRUCTIONS] += c->instructions;
+		values[MC_INTERVAL_BRANCH_STALLS] += c->branch_stalls;
+		values[MC_INTERVAL_DATA_STALLS] += c->data_stalls;
+		values[MC_INTERVAL_FETCH_STALLS] += c->fetch_stalls;
+		values[MC_INTERVAL_MEM_STALLS] += c->mem_stalls;
+		values[MC_INTERVAL_L1I_MISSES] += c->l1i.misses;
+		values[MC_INTERVAL_L1D_ACCESSES] += c->l1d.hits + c->l1d.misses;
+		values[MC_INTERVAL_L1D_MISSES] += c->l1d.misses;
+		values[MC_INTERVAL_INVALIDATIONS] += c->l1d.invalidations;
+	}
+	values[MC_INTERVAL_BUS_BUSY] = m->bus.busy_cycles;
+}
+
+static inline void __machine_sample(struct machine* m)
+{
+	unsigned long long values[NR_MC_INTERVAL_COUNTERS];
+
+	machine_interval_counters(m, values);
+	interval_sample(m->interval, m->cycle, values);
+}
+
+/***********************************************************************
+ * __machine_run(m, variant)
+ *
+ * DESCRIPTION
+ *   Run all the cores until every one of them halts. In each cycle the
+ *   cores are visited in the order of their ids, which also decides who
+ *   wins a bus race. Cycles in which every core is stalled are not
+ *   visited at all; the loop jumps to the earliest cycle any core can
+ *   issue in, so long stalls cost nothing to simulate. With @m->interval
+ *   set, the jump stops at every multiple of the period as well, where a
+ *   sample is taken, so each row covers exactly one period.
+ *
+ * RETURN VALUE
+ *   Number of cycles simulated
+ */
+MC_INLINE unsigned long long __machine_run(struct machine* m, const unsigned int variant)
+{
+	int nr_running = m->config.nr_cores;
+	unsigned long long next;
+
+	for (m->cycle = 0; nr_running && m->cycle < m->config.max_cycles; m->cycle = next) {
+		next = ~0ULL;
+
+		if (m->interval && m->cycle >= m->interval->next) __machine_sample(m);
+
+		for (int i = 0; i < m->config.nr_cores; i++) {
+			struct mc_core* c = &m->cores[i];
+
+			if (c->halted) continue;
+
+			if (c->ready <= m->cycle) {
+				__core_cycle(m, c, m->cycle, variant);
+				if (c->halted) {
+					nr_running--;
+					continue;
+				}
+			}
+			if (c->ready < next) next = c->ready;
+		}
+
+		if (!nr_running) break;
+		if (next > m->config.max_cycles) next = m->config.max_cycles;	/* Stop where the serial loop would */
+		if (m->interval && next > m->interval->next) next = m->interval->next;
+		m->skipped_cycles += next - m->cycle - 1;
+	}
+
+	/* The last halt still has to drain its pipeline */
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		if (m->cores[i].cycles > m->cycle) m->cycle = m->cores[i].cycles;
+	}
+	if (variant & MC_DRAM) dram_drain(&m->dram);
+	return m->cycle;
+}
+
+#define MC_VARIANT(variant) \
+	static unsigned long long __machine_run_##variant(struct machine* m) \
+	{ \
+		return __machine_run(m, variant); \
+	}
+
+MC_VARIANT(0) MC_VARIANT(1) MC_VARIANT(2) MC_VARIANT(3)
+MC_VARIANT(4) MC_VARIANT(5) MC_VARIANT(6) MC_VARIANT(7)
+MC_VARIANT(8) MC_VARIANT(9) MC_VARIANT(10) MC_VARIANT(11)
+MC_VARIANT(12) MC_VARIANT(13) MC_VARIANT(14) MC_VARIANT(15)
+
+static unsigned long long (* const mc_variants[NR_MC_VARIANTS])(struct machine* m) = {
+	__machine_run_0, __machine_run_1, __machine_run_2, __machine_run_3,
+	__machine_run_4, __machine_run_5, __machine_run_6, __machine_run_7,
+	__machine_run_8, __machine_run_9, __machine_run_10, __machine_run_11,
+	__machine_run_12, __machine_run_13, __machine_run_14, __machine_run_15,
+};
+
+/* The specialized copy of __machine_run() for the configuration of @m */
+static inline unsigned long long machine_run(struct machine* m)
+{
+	return mc_variants[mc_variant(&m->config)](m);
+}
+
+/**
+ * __machine_run() testing the features at every access, as a baseline
+ * for what the specialized copies save.
+ */
+static inline unsigned long long machine_run_generic(struct machine* m)
+{
+	return __machine_run(m, mc_variant(&m->config));
+}
+
+#endif
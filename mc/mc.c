@@ -0,0 +1,371 @@
+/**********************************************************************
+ * mc: multi-core MIPS simulator
+ *
+ * Run the same program on several pa3-style pipelines that share memory
+ * through MESI-coherent L1 caches. Programs use the pa2 load format, and
+ * each core finds its id in $k0 and the number of cores in $k1.
+ *
+ *   mc [-n cores] [-l sets:ways:line] [-m mem] [-c c2c] [-b bus]
+ *      [-p prefetcher[:degree[:distance]]] [-s depth[:drain][:wc]]
+ *      [-d channels:banks:row[:policy[:queue]]] [-T tRCD:tCAS:tRP:tBURST]
+ *      [-P fetch:decode:execute:memory] [-F] [-r] [-t threads] [-q quantum] [-S] [-G]
+ *      [-i cycles:file] program
+ *
+ * Build with -pthread for the parallel engine (-t).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/loader.h"
+#include "machine.h"
+#include "options.h"
+#include "parallel.h"
+
+static void __usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-n cores] [-l sets:ways:line] [-m mem latency] "
+		"[-c c2c latency] [-b bus occupancy] [-p prefetcher[:degree[:distance]]] [-s depth[:drain][:wc]] "
+		"[-d channels:banks:row[:policy[:queue]]] [-T tRCD:tCAS:tRP:tBURST] "
+		"[-P fetch:decode:execute:memory] [-F] [-r] [-t threads] [-q quantum] [-S] [-G] [-i cycles:file] program\n", name);
+	fprintf(stderr, "  -p  L1D prefetcher: none, next-line, stride or stream (default degree 2, distance 1)\n");
+	fprintf(stderr, "  -s  store buffer of depth entries (up to %d), drained eager (default) or lazy,\n"
+		"      wc to combine stores to the same line\n", SB_MAX_DEPTH);
+	fprintf(stderr, "  -d  DRAM instead of the flat memory latency, with an open (default) or closed row policy\n"
+		"      and a queue of up to %d writebacks (default 16)\n", DRAM_MAX_QUEUE);
+	fprintf(stderr, "  -T  DRAM timings in cycles (default 14:14:14:4)\n");
+	fprintf(stderr, "  -P  stages of IF, ID, EX and MEM (1 to %d each, default 1:1:1:1)\n", PIPE_MAX_STAGES);
+	fprintf(stderr, "  -F  disable forwarding\n");
+	fprintf(stderr, "  -r  dump the registers of each core at the end\n");
+	fprintf(stderr, "  -t  run the cores on host threads, synchronizing every quantum cycles (default 1000)\n");
+	fprintf(stderr, "  -S  also run the serial engine and report the speedup of -t\n");
+	fprintf(stderr, "  -G  also run the generic serial loop and report the speedup of the specialized one\n");
+	fprintf(stderr, "  -i  write interval statistics every cycles cycles to file as CSV (serial engine only)\n");
+}
+
+static void __show_registers(const struct mc_core* c)
+{
+	fprintf(stderr, "[core %d] pc: 0x%08x\n", c->id, c->cpu.pc);
+	for (int i = 0; i < 32; i++) {
+		fprintf(stderr, "[%02d:%-4s] 0x%08x    %u\n", i, isa_register_names[i],
+			c->cpu.registers[i], c->cpu.registers[i]);
+	}
+}
+
+static void __print_variant(unsigned int variant)
+{
+	const char* separator = "";
+
+	printf(", variant ");
+	if (!variant) printf("none");
+	for (unsigned int i = 0; i < sizeof(mc_feature_names) / sizeof(mc_feature_names[0]); i++) {
+		if (!(variant & (1U << i))) continue;
+		printf("%s%s", separator, mc_feature_names[i]);
+		separator = "+";
+	}
+}
+
+static void __report(const struct machine* m)
+{
+	unsigned long long instructions = 0;
+
+	printf("%-6s %12s %12s %6s %10s %10s %10s %10s %9s %9s %8s %8s\n",
+		"core", "cycles", "insts", "IPC", "branch", "data", "fetch", "memory",
+		"L1I miss", "L1D miss", "inval", "sc fail");
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		const struct mc_core* c = &m->cores[i];
+		unsigned long long l1i = c->l1i.hits + c->l1i.misses;
+		unsigned long long l1d = c->l1d.hits + c->l1d.misses;
+
+		printf("%-6d %12llu %12llu %6.3f %10llu %10llu %10llu %10llu %8.2f%% %8.2f%% %8llu %8llu\n",
+			c->id, c->cycles, c->instructions,
+			c->cycles ? (double)c->instructions / c->cycles : 0.0,
+			c->branch_stalls, c->data_stalls, c->fetch_stalls, c->mem_stalls,
+			l1i ? 100.0 * c->l1i.misses / l1i : 0.0,
+			l1d ? 100.0 * c->l1d.misses / l1d : 0.0,
+			c->l1d.invalidations, c->sc_failures);
+		instructions += c->instructions;
+	}
+
+	if (m->config.prefetch.type != PREFETCH_NONE) {
+		printf("\nprefetch: %s, degree %u, distance %u\n", prefetch_names[m->config.prefetch.type],
+			m->config.prefetch.degree, m->config.prefetch.distance);
+		printf("%-6s %10s %10s %9s %10s %10s %10s %9s\n",
+			"core", "issued", "useful", "accuracy", "late", "unused", "polluting", "coverage");
+
+		for (int i = 0; i < m->config.nr_cores; i++) {
+			const struct mc_core* c = &m->cores[i];
+			unsigned long long covered = c->prefetch_useful + c->l1d.misses;
+
+			printf("%-6d %10llu %10llu %8.2f%% %10llu %10llu %10llu %8.2f%%\n",
+				c->id, c->prefetch_issued, c->prefetch_useful,
+				c->prefetch_issued ? 100.0 * c->prefetch_useful / c->prefetch_issued : 0.0,
+				c->prefetch_late, c->prefetch_unused, c->prefetch_polluting,
+				covered ? 100.0 * c->prefetch_useful / covered : 0.0);
+		}
+	}
+
+	if (m->config.store_buffer.depth) {
+		printf("\nstore buffer: %u entries, %s drain%s\n", m->config.store_buffer.depth,
+			sb_drain_names[m->config.store_buffer.drain], m->config.store_buffer.combine ? ", write-combining" : "");
+		printf("%-6s %10s %10s %10s %10s %10s\n", "core", "stores", "combined", "forwarded", "conflicts", "full");
+
+		for (int i = 0; i < m->config.nr_cores; i++) {
+			const struct mc_core* c = &m->cores[i];
+
+			printf("%-6d %10llu %10llu %10llu %10llu %10llu\n", c->id,
+				c->sb_stores, c->sb_combined, c->sb_forwarded, c->sb_conflicts, c->sb_full_stalls);
+		}
+	}
+
+	if (m->config.dram.channels) {
+		const struct dram* d = &m->dram;
+		unsigned long long accesses = d->row_hits + d->row_empty + d->row_conflicts;
+
+		printf("\ndram: %u channel%s, %u banks, %u-byte rows, %s row policy\n",
+			d->config.channels, d->config.channels > 1 ? "s" : "", d->config.banks, d->config.row_size,
+			dram_policy_names[d->config.policy]);
+		printf("dram: %llu reads, %llu writes, row hits %.1f%%, empty %.1f%%, conflicts %.1f%%\n",
+			d->reads, d->writes,
+			accesses ? 100.0 * d->row_hits / accesses : 0.0,
+			accesses ? 100.0 * d->row_empty / accesses : 0.0,
+			accesses ? 100.0 * d->row_conflicts / accesses : 0.0);
+		printf("dram: average read latency %.1f cycles, %llu writebacks forced out by a full queue\n",
+			d->reads ? (double)d->read_latency / d->reads : 0.0, d->queue_full);
+	}
+
+	printf("\nbus:");
+	for (int i = 0; i < NR_BUS_REQUESTS; i++) {
+		printf(" %s %llu,", bus_request_names[i], m->bus.requests[i]);
+	}
+	printf(" cache-to-cache %llu\n", m->bus.c2c_transfers);
+	printf("bus: busy %llu cycles (%.1f%%), waited %llu cycles\n",
+		m->bus.busy_cycles, m->cycle ? 100.0 * m->bus.busy_cycles / m->cycle : 0.0,
+		m->bus.wait_cycles);
+	printf("total: %llu cycles, %llu instructions, IPC %.3f\n",
+		m->cycle, instructions, m->cycle ? (double)instructions / m->cycle : 0.0);
+
+	/* Against the 5-stage pipeline, at the clock the depth allows */
+	{
+		const struct pipe_config* pipe = &m->config.pipe;
+		double cpi = instructions ? (double)m->cycle * m->config.nr_cores / instructions : 0.0;
+
+		printf("pipeline: %u stages (IF %u, ID %u, EX %u, MEM %u, WB 1), branch penalty %u, load-use %u\n",
+			m->pipe.depth, pipe->fetch, pipe->decode, pipe->execute, pipe->memory,
+			m->pipe.branch_penalty, m->config.forwarding ? m->pipe.load_use : m->pipe.wb_use);
+		printf("pipeline: clock %.2fx, CPI %.3f, time per instruction %.3f 5-stage cycles\n",
+			pipe_clock(pipe), cpi, cpi / pipe_clock(pipe));
+	}
+}
+
+static double __elapsed(const struct timespec* start)
+{
+	struct timespec now;
+
+	timespec_get(&now, TIME_UTC);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+	static unsigned char image[CORE_MEMORY_SIZE];
+	struct mc_config config = mc_default_config;
+	struct machine machine;
+	bool dump_registers = false;
+	bool compare = false;
+	bool generic = false;
+	unsigned long long interval_period = 0;
+	char* interval_file = NULL;
+	struct interval interval;
+	int nr_threads = 0;
+	unsigned long long quantum = 1000;
+	struct timespec start;
+	double elapsed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:l:m:c:b:p:s:d:T:P:Frt:q:SGi:h")) != -1) {
+		switch (opt) {
+		case 'n':
+		{
+			unsigned int nr_cores;
+
+			if (!parse_number(optarg, &nr_cores) || nr_cores > MAX_NR_CORES) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			config.nr_cores = nr_cores;
+			break;
+		}
+		case 'l':
+			if (sscanf(optarg, "%u:%u:%u", &config.l1_sets, &config.l1_ways, &config.line_size) != 3) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+		case 'c':
+		case 'b':
+			if (!parse_number(optarg, opt == 'm' ? &config.mem_latency :
+				opt == 'c' ? &config.c2c_latency : &config.bus_occupancy)) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			if (!parse_prefetch(optarg, &config.prefetch)) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			if (!parse_store_buffer(optarg, &config.store_buffer)) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'd':
+			if (!parse_dram(optarg, &config.dram)) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'T':
+			if (sscanf(optarg, "%u:%u:%u:%u", &config.dram.tRCD, &config.dram.tCAS, &config.dram.tRP,
+				&config.dram.tBURST) != 4) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			if (!parse_pipe(optarg, &config.pipe)) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			config.forwarding = false;
+			break;
+		case 'r':
+			dump_registers = true;
+			break;
+		case 't':
+		case 'q':
+		{
+			unsigned int number;
+
+			if (!parse_number(optarg, &number) || (opt == 't' && number > INT_MAX)) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			if (opt == 't') nr_threads = number;
+			else quantum = number;
+			break;
+		}
+		case 'S':
+			compare = true;
+			break;
+		case 'G':
+			generic = true;
+			break;
+		case 'i':
+			interval_period = strtoull(optarg, &interval_file, 0);
+			if (!interval_period || *interval_file++ != ':' || !*interval_file) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			__usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || !mc_config_valid(&config) || nr_threads < 0 || !quantum || (compare && !nr_threads) ||
+		(generic && nr_threads) || (interval_file && nr_threads)) {
+		__usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (load_image(image, ENTRY_PC, argv[optind]) < 0) {
+		fprintf(stderr, "No input file %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	machine_init(&machine, &config, image);
+	if (interval_file) {
+		if (!interval_open(&interval, interval_file, interval_period, "cycles", mc_interval_names,
+			NR_MC_INTERVAL_COUNTERS, mc_interval_ratios, NR_MC_INTERVAL_RATIOS)) {
+			fprintf(stderr, "Unable to open %s\n", interval_file);
+			return EXIT_FAILURE;
+		}
+		machine.interval = &interval;
+	}
+	timespec_get(&start, TIME_UTC);
+	if (nr_threads) {
+		machine_run_parallel(&machine, nr_threads, quantum);
+	}
+	else {
+		machine_run(&machine);
+	}
+	elapsed = __elapsed(&start);
+
+	if (interval_file) {
+		unsigned long long values[NR_MC_INTERVAL_COUNTERS];
+
+		machine_interval_counters(&machine, values);
+		interval_close(&interval, machine.cycle, values);
+	}
+
+	if (dump_registers) {
+		for (int i = 0; i < config.nr_cores; i++) {
+			__show_registers(&machine.cores[i]);
+		}
+	}
+	__report(&machine);
+	printf("host: %.3f s, %.0f cycles/s", elapsed, machine.cycle / elapsed);
+	if (nr_threads) {
+		printf(", %d thread%s, quantum %llu", nr_threads, nr_threads > 1 ? "s" : "", quantum);
+	}
+	else {
+		printf(", %llu idle cycles skipped (%.1f%%)", machine.skipped_cycles,
+			machine.cycle ? 100.0 * machine.skipped_cycles / machine.cycle : 0.0);
+		__print_variant(mc_variant(&config));
+	}
+	printf("\n");
+
+	if (compare) {
+		struct machine serial;
+		double serial_elapsed;
+
+		machine_init(&serial, &config, image);
+		timespec_get(&start, TIME_UTC);
+		machine_run(&serial);
+		serial_elapsed = __elapsed(&start);
+
+		printf("serial: %.3f s, %llu cycles; speedup %.2fx, cycle error %+.2f%%\n",
+			serial_elapsed, serial.cycle, serial_elapsed / elapsed,
+			serial.cycle ? 100.0 * ((double)machine.cycle - serial.cycle) / serial.cycle : 0.0);
+		machine_destroy(&serial);
+	}
+
+	if (generic) {
+		struct machine baseline;
+		double generic_elapsed;
+
+		machine_init(&baseline, &config, image);
+		timespec_get(&start, TIME_UTC);
+		machine_run_generic(&baseline);
+		generic_elapsed = __elapsed(&start);
+
+		printf("generic: %.3f s, %llu cycles; speedup %.2fx\n",
+			generic_elapsed, baseline.cycle, generic_elapsed / elapsed);
+		machine_destroy(&baseline);
+	}
+
+	machine_destroy(&machine);
+
+	return EXIT_SUCCESS;
+}
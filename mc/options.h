@@ -0,0 +1,121 @@
+#ifndef __OPTIONS_H__
+#define __OPTIONS_H__
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+
+/**
+ * Parsers of the mc_config options, shared by mc and the design-space
+ * driver (dse).
+ */
+
+/* A whole number, decimal or 0x-prefixed */
+static inline bool parse_number(const char* arg, unsigned int* value)
+{
+	unsigned long number;
+	char* end;
+
+	if (!isdigit((unsigned char)*arg)) return false;	/* strtoul() takes a sign */
+	number = strtoul(arg, &end, 0);
+	if (*end || number > UINT_MAX) return false;
+
+	*value = number;
+	return true;
+}
+
+/* type[:degree[:distance]] */
+static inline bool parse_prefetch(const char* arg, struct prefetch_config* config)
+{
+	size_t len = strcspn(arg, ":");
+	int type;
+
+	for (type = 0; type < NR_PREFETCH_TYPES; type++) {
+		if (strlen(prefetch_names[type]) == len && strncmp(arg, prefetch_names[type], len) == 0) break;
+	}
+	if (type == NR_PREFETCH_TYPES) return false;
+
+	config->type = type;
+	if (arg[len] && sscanf(arg + len, ":%u:%u", &config->degree, &config->distance) < 1) return false;
+
+	return config->degree >= 1 && config->degree <= PREFETCH_MAX_DEGREE && config->distance >= 1;
+}
+
+/* depth[:eager|lazy][:wc] */
+static inline bool parse_store_buffer(char* arg, struct sb_config* config)
+{
+	char* token = strtok(arg, ":");
+
+	config->depth = atoi(token);
+	while ((token = strtok(NULL, ":"))) {
+		int drain;
+
+		for (drain = 0; drain < NR_SB_DRAINS && strcmp(token, sb_drain_names[drain]); drain++);
+
+		if (drain < NR_SB_DRAINS) {
+			config->drain = drain;
+		}
+		else if (strcmp(token, "wc") == 0) {
+			config->combine = true;
+		}
+		else {
+			return false;
+		}
+	}
+
+	return config->depth >= 1 && config->depth <= SB_MAX_DEPTH;
+}
+
+/* channels:banks:row[:open|closed[:queue]] */
+static inline bool parse_dram(const char* arg, struct dram_config* config)
+{
+	char policy[16] = "open";
+	int type;
+
+	if (sscanf(arg, "%u:%u:%u:%15[^:]:%u", &config->channels, &config->banks, &config->row_size, policy,
+		&config->queue_depth) < 3) {
+		return false;
+	}
+	for (type = 0; type < NR_DRAM_POLICIES && strcmp(policy, dram_policy_names[type]); type++);
+	config->policy = type;
+
+	return type < NR_DRAM_POLICIES && config->channels && config->banks && config->row_size &&
+		config->queue_depth >= 1 && config->queue_depth <= DRAM_MAX_QUEUE;
+}
+
+/* fetch:decode:execute:memory */
+static inline bool parse_pipe(const char* arg, struct pipe_config* config)
+{
+	int len = 0;
+
+	return sscanf(arg, "%u:%u:%u:%u%n", &config->fetch, &config->decode, &config->execute, &config->memory,
+		&len) == 4 && !arg[len];
+}
+
+static inline bool __pipe_valid(unsigned int stages)
+{
+	return stages >= 1 && stages <= PIPE_MAX_STAGES;
+}
+
+#define MC_MAX_LATENCY	(1U << 16)	/* of -m, -c, -b and the branch penalty, in cycles */
+
+/* Whether a machine can be built with @config */
+static inline bool mc_config_valid(const struct mc_config* config)
+{
+	return config->nr_cores >= 1 && config->nr_cores <= MAX_NR_CORES &&
+		config->mem_latency <= MC_MAX_LATENCY && config->c2c_latency <= MC_MAX_LATENCY &&
+		config->bus_occupancy <= MC_MAX_LATENCY && config->branch_penalty <= MC_MAX_LATENCY &&
+		__pipe_valid(config->pipe.fetch) && __pipe_valid(config->pipe.decode) &&
+		__pipe_valid(config->pipe.execute) && __pipe_valid(config->pipe.memory) &&
+		config->l1_sets && config->l1_ways && config->line_size >= 4 &&
+		!(config->line_size & (config->line_size - 1)) &&
+		!(config->store_buffer.depth && config->line_size > 64) &&	/* Byte masks of the store buffer */
+		!(config->dram.channels && config->dram.row_size < config->line_size);
+}
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "machine.h"
+
+/**
+ * Parallel engine. Cores are spread over host threads, and the threads
+ * run their cores independently for @quantum cycles before they meet at a
+ * barrier. To keep the result independent of the number of threads and
+ * of how the host schedules them, a quantum never looks at what the other
+ * cores are doing right now:
+ *
+ *  - Every core runs on a private copy of memory, which is the shared
+ *    memory at the start of the quantum plus the core's own stores. The
+ *    stores are logged and committed at the barrier in the order of core
+ *    ids, and each word stored in the quantum is copied back into every
+ *    private copy once, however many times it has been written.
+ *  - Any committed store breaks the ll reservations of the other cores
+ *    on that line. sc needs to see those stores, so a core stops at sc
+ *    and the sc is executed at the barrier on the shared memory, again in
+ *    the order of core ids.
+ *  - Bus transactions are assumed to hit an idle bus in the middle of a
+ *    quantum, and a miss to take as long as the misses of the core did on
+ *    average until then. At the barrier the transactions are replayed in
+ *    cycle order to snoop the other caches, and the requesters are charged
+ *    the bus contention and the difference to the latency they really had.
+ *    A requester charged too much gets the cycles back on its next delays,
+ *    since its pipeline has already used them.
+ *
+ * A shorter quantum is closer to the serial engine, a longer one has fewer
+ * barriers.
+ */
+struct mc_barrier {
+	atomic_int count;
+	atomic_int sense;
+	int nr_threads;
+};
+
+struct parallel_engine {
+	struct machine* m;
+	int nr_threads;
+	unsigned long long quantum;
+	struct mc_barrier barrier;
+	bool done;
+
+	struct mc_bus_event* events;	/* Bus transactions of all the cores */
+	size_t max_events;
+	long long* dram_delays;			/* Per core, charged in this replay */
+
+	unsigned int* dirty;			/* Addresses stored to in the last quantum */
+	size_t nr_dirty;
+	size_t max_dirty;
+	struct dirty_slot {				/* Open addressing set over @dirty */
+		unsigned int addr;
+		unsigned int generation;	/* Valid in the quantum of this generation */
+	}* dirty_set;
+	size_t dirty_set_size;
+	unsigned int generation;
+};
+
+struct parallel_thread {
+	struct parallel_engine* engine;
+	int id;
+	pthread_t thread;
+};
+
+/***********************************************************************
+ * mc_barrier_wait(barrier, sense, serial, arg)
+ *
+ * DESCRIPTION
+ *   Sense-reversing barrier. The last thread to arrive runs @serial(@arg)
+ *   while the others are still waiting, and then releases them. Waiting
+ *   threads spin on @barrier->sense and yield the CPU once in a while so
+ *   that the engine still works when there are more threads than CPUs.
+ */
+static inline void mc_barrier_wait(struct mc_barrier* barrier, int* sense, void (*serial)(void*), void* arg)
+{
+	*sense = !*sense;
+
+	if (atomic_fetch_sub_explicit(&barrier->count, 1, memory_order_acq_rel) == 1) {
+		serial(arg);
+		atomic_store_explicit(&barrier->count, barrier->nr_threads, memory_order_relaxed);
+		atomic_store_explicit(&barrier->sense, *sense, memory_order_release);
+		return;
+	}
+
+	for (unsigned int spins = 0; atomic_load_explicit(&barrier->sense, memory_order_acquire) != *sense; spins++) {
+		if (spins >= 256) sched_yield();
+	}
+}
+
+static inline bool __same_line(const struct machine* m, unsigned int a, unsigned int b)
+{
+	return (a >> m->cores[0].l1d.line_shift) == (b >> m->cores[0].l1d.line_shift);
+}
+
+/* A store of @writer to @addr is now visible, so break the others' links */
+static inline void __break_links(struct machine* m, const struct mc_core* writer, unsigned int addr)
+{
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		if (c != writer && c->cpu.link_valid && __same_line(m, c->cpu.link_addr, addr)) {
+			c->cpu.link_valid = false;
+		}
+	}
+}
+
+static inline struct dirty_slot* __dirty_slot(struct parallel_engine* engine, unsigned int addr)
+{
+	size_t i = (addr * 2654435761u) & (engine->dirty_set_size - 1);
+
+	while (engine->dirty_set[i].generation == engine->generation && engine->dirty_set[i].addr != addr) {
+		i = (i + 1) & (engine->dirty_set_size - 1);
+	}
+	return &engine->dirty_set[i];
+}
+
+/* Remember that @addr has to be copied into the private memories */
+static inline void __mark_dirty(struct parallel_engine* engine, unsigned int addr)
+{
+	struct dirty_slot* slot;
+
+	if ((engine->nr_dirty + 1) * 2 > engine->dirty_set_size) {
+		engine->dirty_set_size = engine->dirty_set_size ? engine->dirty_set_size * 2 : 1024;
+		free(engine->dirty_set);
+		engine->dirty_set = calloc(engine->dirty_set_size, sizeof(*engine->dirty_set));
+		if (!engine->dirty_set) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		engine->generation = 1;
+		for (size_t i = 0; i < engine->nr_dirty; i++) {
+			slot = __dirty_slot(engine, engine->dirty[i]);
+			slot->addr = engine->dirty[i];
+			slot->generation = engine->generation;
+		}
+	}
+
+	slot = __dirty_slot(engine, addr);
+	if (slot->generation == engine->generation) return;
+
+	slot->addr = addr;
+	slot->generation = engine->generation;
+	if (engine->nr_dirty == engine->max_dirty) {
+		engine->dirty = __grow_log(engine->dirty, &engine->max_dirty, sizeof(*engine->dirty));
+	}
+	engine->dirty[engine->nr_dirty++] = addr;
+}
+
+static int __compare_bus_events(const void* a, const void* b)
+{
+	const struct mc_bus_event* x = a;
+	const struct mc_bus_event* y = b;
+
+	if (x->cycle != y->cycle) return x->cycle < y->cycle ? -1 : 1;
+	if (x->core != y->core) return x->core < y->core ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* Whether a snoop took @line_addr out of @cache: an eviction would have replaced the tag */
+static inline bool __snooped_out(const struct cache* cache, unsigned int line_addr)
+{
+	const struct cache_line* set = cache->lines + (size_t)(line_addr % cache->sets) * cache->ways;
+
+	for (unsigned int i = 0; i < cache->ways; i++) {
+		if (set[i].tag == line_addr) return set[i].state == MESI_I;
+	}
+	return false;
+}
+
+/* Delay @c by @delay cycles, or give them back out of the coming delays if negative */
+static inline void __charge_delay(struct mc_core* c, long long delay)
+{
+	delay += c->credit;
+	c->credit = delay < 0 ? delay : 0;
+	if (delay <= 0) return;
+
+	c->mem_stalls += delay;
+	if (c->halted) {
+		c->cycles += delay;
+	}
+	else {
+		c->ready += delay;
+	}
+}
+
+/* Put the bus transactions of the quantum on the bus in the order of time */
+static inline void __replay_bus_events(struct parallel_engine* engine)
+{
+	struct machine* m = engine->m;
+	size_t nr_events = 0;
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		while (nr_events + c->nr_bus_events > engine->max_events) {
+			engine->events = __grow_log(engine->events, &engine->max_events, sizeof(*engine->events));
+		}
+		memcpy(engine->events + nr_events, c->bus_events, c->nr_bus_events * sizeof(*engine->events));
+		nr_events += c->nr_bus_events;
+		c->nr_bus_events = 0;
+	}
+	qsort(engine->events, nr_events, sizeof(*engine->events), __compare_bus_events);
+	memset(engine->dram_delays, 0, m->config.nr_cores * sizeof(*engine->dram_delays));
+
+	for (size_t i = 0; i < nr_events; i++) {
+		struct mc_bus_event* event = &engine->events[i];
+		struct mc_core* c = &m->cores[event->core];
+		unsigned int addr = event->line_addr << c->l1d.line_shift;
+		unsigned long long start;
+		unsigned long long wait;
+		struct cache_line* line;
+		bool supplied;
+		bool shared;
+
+		/*
+		 * The store found the line exclusive and went on without the bus. If
+		 * another core has read the line before it, the line was shared after
+		 * all and the store pays for an upgrade now.
+		 */
+		/*
+		 * The core hit a line it had prefetched. If another core has taken the
+		 * line away in between, it was a miss after all.
+		 */
+		if (event->source == BUS_FROM_PREFETCHED) {
+			if (!__snooped_out(&c->l1d, event->line_addr)) continue;
+
+			c->l1d.hits--;
+			c->l1d.misses++;
+			c->prefetch_useful--;
+		}
+
+		if (event->source == BUS_FROM_L1D_EXCLUSIVE) {
+			if (!snoop(m, c, event->line_addr, BUS_UPGR, &supplied)) continue;
+
+			start = bus_transaction(m, c, BUS_UPGR, event->cycle, m->config.upgrade_latency);
+			wait = start - event->cycle;
+			if ((line = cache_lookup(&c->l1d, event->line_addr))) line->state = MESI_M;
+		}
+		else {
+			start = bus_transaction(m, c, event->request, event->cycle, 0);
+			wait = start - event->cycle;
+			if (event->request == BUS_WB) {
+				if (m->config.dram.channels) dram_write(&m->dram, addr, start);
+				continue;
+			}
+
+			/*
+			 * A read taken exclusive is shared if another core has the line,
+			 * even if it was written since: the store comes later in the log
+			 * and takes the line back. A prefetch is filled S in the quantum
+			 * and becomes E if nobody else has the line.
+			 */
+			shared = snoop(m, c, event->line_addr, event->request, &supplied);
+			if (event->source != BUS_FROM_L1I && (line = cache_lookup(&c->l1d, event->line_addr))) {
+				if (event->request != BUS_RD) {
+					line->state = MESI_M;
+				}
+				else if (shared) {
+					line->state = MESI_S;
+				}
+				else if (event->source == BUS_FROM_PREFETCH && line->state == MESI_S) {
+					line->state = MESI_E;
+				}
+			}
+		}
+
+		/*
+		 * Whatever served the read, the core assumed its average latency.
+		 * With a DRAM the later requests of the core would have come as much
+		 * later, or sooner, too.
+		 */
+		if (event->request != BUS_UPGR) {
+			long long* delay = &engine->dram_delays[c->id];
+			unsigned long long latency;
+
+			if (supplied) {
+				latency = m->config.c2c_latency;
+			}
+			else if (m->config.dram.channels) {
+				unsigned long long at = *delay < 0 && (unsigned long long)-*delay > start ? 0 : start + *delay;
+
+				latency = dram_read(&m->dram, addr, at) - at;
+			}
+			else {
+				latency = m->config.mem_latency;
+			}
+			wait += latency;
+			if (event->source != BUS_FROM_PREFETCH) {
+				*delay += (long long)latency - c->miss_latency;
+				c->miss_cycles += latency;
+				c->nr_misses++;
+			}
+		}
+
+		/* The requester was not delayed in the quantum, so it is now */
+		if (event->source != BUS_FROM_PREFETCH) {
+			long long assumed = event->request != BUS_UPGR && event->source != BUS_FROM_PREFETCHED ? c->miss_latency : 0;
+
+			__charge_delay(c, (long long)wait - assumed);
+		}
+	}
+
+	/* The next quantum assumes what the misses took so far */
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		if (c->nr_misses) c->miss_latency = (unsigned int)((c->miss_cycles + c->nr_misses / 2) / c->nr_misses);
+	}
+}
+
+/**
+ * Runs on the last thread to reach the barrier, while the other threads
+ * wait there. Nothing else touches the machine meanwhile.
+ */
+static void __quantum_end(void* arg)
+{
+	struct parallel_engine* engine = arg;
+	struct machine* m = engine->m;
+	int nr_running = 0;
+
+	engine->nr_dirty = 0;
+	engine->generation++;
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		for (size_t j = 0; j < c->nr_stores; j++) {
+			core_store_word(m->memory, c->stores[j].addr, c->stores[j].value);
+			__break_links(m, c, c->stores[j].addr);
+			__mark_dirty(engine, c->stores[j].addr);
+		}
+		c->nr_stores = 0;
+	}
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		if (!c->parked) continue;
+
+		/* The sc goes to the shared memory and is copied out as a store */
+		c->cpu.memory = m->memory;
+		core_cycle(m, c, c->ready);
+		c->cpu.memory = c->private_memory;
+		c->parked = false;
+
+		if (c->nr_stores) {
+			__break_links(m, c, c->stores[0].addr);
+			__mark_dirty(engine, c->stores[0].addr);
+			c->nr_stores = 0;
+		}
+	}
+
+	__replay_bus_events(engine);
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		if (!m->cores[i].halted) nr_running++;
+	}
+
+	if (!nr_running || m->quantum_end >= m->config.max_cycles) {
+		engine->done = true;
+		return;
+	}
+	m->quantum_end += engine->quantum;
+}
+
+/**
+ * Bring the private memory of @c up to date with the stores committed at
+ * the last barrier. The shared memory is not written during a quantum, so
+ * the threads can do this concurrently.
+ */
+static inline void __sync_private_memory(const struct parallel_engine* engine, struct mc_core* c)
+{
+	for (size_t i = 0; i < engine->nr_dirty; i++) {
+		unsigned int addr = engine->dirty[i];
+
+		core_store_word(c->private_memory, addr, core_load_word(engine->m->memory, addr));
+	}
+}
+
+static void* __parallel_thread(void* arg)
+{
+	struct parallel_thread* thread = arg;
+	struct parallel_engine* engine = thread->engine;
+	struct machine* m = engine->m;
+	int sense = 0;
+
+	while (!engine->done) {
+		/* Thread i runs cores i, i + nr_threads, ... */
+		for (int i = thread->id; i < m->config.nr_cores; i += engine->nr_threads) {
+			struct mc_core* c = &m->cores[i];
+
+			if (c->halted) continue;
+
+			__sync_private_memory(engine, c);
+
+			while (!c->halted && !c->parked && c->ready < m->quantum_end) {
+				core_cycle(m, c, c->ready);
+			}
+		}
+
+		mc_barrier_wait(&engine->barrier, &sense, __quantum_end, engine);
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ * machine_run_parallel(m, nr_threads, quantum)
+ *
+ * DESCRIPTION
+ *   Run all the cores of @m on @nr_threads host threads until every core
+ *   halts, synchronizing every @quantum cycles. The result depends on
+ *   @quantum but not on @nr_threads.
+ *
+ * RETURN VALUE
+ *   Number of cycles simulated
+ */
+static inline unsigned long long machine_run_parallel(struct machine* m, int nr_threads, unsigned long long quantum)
+{
+	struct parallel_engine engine = {
+		.m = m,
+		.nr_threads = nr_threads,
+		.quantum = quantum,
+	};
+	struct parallel_thread* threads;
+
+	if (engine.nr_threads > m->config.nr_cores) engine.nr_threads = m->config.nr_cores;
+	atomic_init(&engine.barrier.count, engine.nr_threads);
+	atomic_init(&engine.barrier.sense, 0);
+	engine.barrier.nr_threads = engine.nr_threads;
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		struct mc_core* c = &m->cores[i];
+
+		c->private_memory = malloc(CORE_MEMORY_SIZE);
+		if (!c->private_memory) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(c->private_memory, m->memory, CORE_MEMORY_SIZE);
+		c->cpu.memory = c->private_memory;
+		c->miss_latency = m->config.dram.channels ? dram_min_latency(&m->config.dram) : m->config.mem_latency;
+	}
+	m->parallel = true;
+	m->quantum_end = quantum;
+	engine.dram_delays = calloc(m->config.nr_cores, sizeof(*engine.dram_delays));
+	threads = calloc(engine.nr_threads, sizeof(*threads));
+	if (!engine.dram_delays || !threads) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 1; i < engine.nr_threads; i++) {
+		threads[i].engine = &engine;
+		threads[i].id = i;
+		pthread_create(&threads[i].thread, NULL, __parallel_thread, &threads[i]);
+	}
+	threads[0].engine = &engine;
+	__parallel_thread(&threads[0]);
+
+	for (int i = 1; i < engine.nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+	}
+	free(threads);
+	free(engine.events);
+	free(engine.dram_delays);
+	free(engine.dirty);
+	free(engine.dirty_set);
+
+	for (int i = 0; i < m->config.nr_cores; i++) {
+		m->cores[i].cpu.memory = m->memory;
+		if (m->cores[i].cycles > m->cycle) m->cycle = m->cores[i].cycles;
+	}
+	if (m->config.dram.channels) dram_drain(&m->dram);
+	m->parallel = false;
+
+	return m->cycle;
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * Hardware prefetchers for the L1 data cache. A prefetcher is trained with
+ * every demand access and answers with the lines it wants to bring in;
+ * issuing them, and telling useful prefetches from useless ones, is up to
+ * the cache (see l1d_access() in machine.h).
+ *
+ *  - next-line: on a miss, or on the first hit to a prefetched line, fetch
+ *    the @degree lines starting @distance lines after it.
+ *  - stride: a reference prediction table indexed by the pc of the load or
+ *    store. Once the same stride is seen twice, fetch @degree strides
+ *    starting @distance strides ahead.
+ *  - stream: stream buffer allocation. A miss that does not belong to a
+ *    stream starts a new one (replacing the least recently used), and
+ *    accesses within a stream keep it up to @distance lines ahead of the
+ *    program, @degree lines at a time. Ascending streams only.
+ */
+enum prefetch_type {
+	PREFETCH_NONE = 0,
+	PREFETCH_NEXT_LINE,
+	PREFETCH_STRIDE,
+	PREFETCH_STREAM,
+	NR_PREFETCH_TYPES,
+};
+
+static const char* const prefetch_names[NR_PREFETCH_TYPES] = {
+	"none", "next-line", "stride", "stream",
+};
+
+#define PREFETCH_MAX_DEGREE		16
+#define PREFETCH_STRIDE_ENTRIES	64
+#define PREFETCH_NR_STREAMS		8
+
+struct prefetch_config {
+	enum prefetch_type type;
+	unsigned int degree;		/* Lines per trigger */
+	unsigned int distance;		/* How far ahead of the demand stream */
+};
+
+enum prefetch_event {
+	PREFETCH_MISS,
+	PREFETCH_HIT,
+	PREFETCH_HIT_PREFETCHED,	/* First demand hit on a prefetched line */
+};
+
+struct prefetcher {
+	struct stride_entry {
+		unsigned int pc;
+		unsigned int last_addr;
+		int stride;
+		int confidence;			/* 0 -- 3, prefetch at 2 or more */
+	} strides[PREFETCH_STRIDE_ENTRIES];
+
+	struct stream {
+		bool valid;
+		unsigned int last;		/* Last line the program touched */
+		unsigned int head;		/* Last line prefetched */
+		unsigned long long lru;
+	} streams[PREFETCH_NR_STREAMS];
+	unsigned long long tick;
+};
+
+static inline void prefetcher_init(struct prefetcher* pf)
+{
+	memset(pf, 0, sizeof(*pf));
+}
+
+static inline int __prefetch_next_line(const struct prefetch_config* config, unsigned int line,
+	enum prefetch_event event, unsigned int* lines)
+{
+	int nr_lines = 0;
+
+	if (event == PREFETCH_HIT) return 0;
+
+	for (unsigned int i = 0; i < config->degree; i++) {
+		lines[nr_lines++] = line + config->distance + i;
+	}
+	return nr_lines;
+}
+
+static inline int __prefetch_stride(struct prefetcher* pf, const struct prefetch_config* config,
+	unsigned int pc, unsigned int addr, unsigned int line_shift, unsigned int* lines)
+{
+	struct stride_entry* e = &pf->strides[(pc >> 2) % PREFETCH_STRIDE_ENTRIES];
+	int stride;
+	int nr_lines = 0;
+
+	if (e->pc != pc) {
+		e->pc = pc;
+		e->last_addr = addr;
+		e->stride = 0;
+		e->confidence = 0;
+		return 0;
+	}
+
+	stride = (int)(addr - e->last_addr);
+	e->last_addr = addr;
+
+	if (stride == e->stride) {
+		if (e->confidence < 3) e->confidence++;
+	}
+	else if (e->confidence > 0) {
+		e->confidence--;
+	}
+	else {
+		e->stride = stride;
+	}
+
+	if (e->confidence < 2 || !e->stride) return 0;
+
+	for (unsigned int i = 0; i < config->degree; i++) {
+		unsigned int line = (addr + (unsigned int)e->stride * (config->distance + i)) >> line_shift;
+
+		/* Small strides land on the same line over and over */
+		if ((!nr_lines || lines[nr_lines - 1] != line) && line != addr >> line_shift) lines[nr_lines++] = line;
+	}
+	return nr_lines;
+}
+
+static inline int __prefetch_stream(struct prefetcher* pf, const struct prefetch_config* config,
+	unsigned int line, enum prefetch_event event, unsigned int* lines)
+{
+	struct stream* s = NULL;
+	int nr_lines = 0;
+
+	for (int i = 0; i < PREFETCH_NR_STREAMS; i++) {
+		struct stream* t = &pf->streams[i];
+
+		if (t->valid && line > t->last && line <= t->head + 1) {
+			s = t;
+			break;
+		}
+	}
+
+	if (!s) {
+		if (event != PREFETCH_MISS) return 0;
+
+		s = &pf->streams[0];
+		for (int i = 0; i < PREFETCH_NR_STREAMS; i++) {
+			if (!pf->streams[i].valid || pf->streams[i].lru < s->lru) s = &pf->streams[i];
+			if (!s->valid) break;
+		}
+		s->valid = true;
+		s->head = line;
+	}
+
+	s->last = line;
+	s->lru = ++pf->tick;
+	if (s->head < line) s->head = line;
+
+	while (s->head < line + config->distance && nr_lines < (int)config->degree) {
+		lines[nr_lines++] = ++s->head;
+	}
+	return nr_lines;
+}
+
+/***********************************************************************
+ * prefetch_train(pf, config, pc, addr, line_shift, event, lines)
+ *
+ * DESCRIPTION
+ *   Tell the prefetcher about a demand access of the instruction at @pc
+ *   to @addr, and collect the line addresses (addr >> @line_shift) to
+ *   prefetch into @lines, which has room for PREFETCH_MAX_DEGREE lines.
+ *
+ * RETURN VALUE
+ *   Number of lines to prefetch
+ */
+static inline int prefetch_train(struct prefetcher* pf, const struct prefetch_config* config, unsigned int pc,
+	unsigned int addr, unsigned int line_shift, enum prefetch_event event, unsigned int* lines)
+{
+	switch (config->type) {
+	case PREFETCH_NEXT_LINE:
+		return __prefetch_next_line(config, addr >> line_shift, event, lines);
+	case PREFETCH_STRIDE:
+		return __prefetch_stride(pf, config, pc, addr, line_shift, lines);
+	case PREFETCH_STREAM:
+		return __prefetch_stream(pf, config, addr >> line_shift, event, lines);
+	default:
+		return 0;
+	}
+}
+
+#endif
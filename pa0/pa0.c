@@ -1,45 +1,45 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
- /* To avoid security error on Visual Studio */
-#define _CRT_SECURE_NO_WARNINGS
-#pragma warning(disable : 4996)
-
-#define MAX_NR_TOKENS 32	/* Maximum number of tokens in a command */
-#define MAX_TOKEN_LEN 64	/* Maximum length of single token */
-#define MAX_COMMAND	256		/* Maximum length of command string */
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
-static int parse_command(char* command, char* tokens[])
-{
-    int nr = 0;
-    const char* separator = " 	";
-
-    for (char* w = strtok(command, separator); w; w = strtok(NULL, separator)) {
-        tokens[nr++] = strdup(w);
-    }
+#include "../common/tokenize.h"
 
-    tokens[nr] = "\0";
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <immintrin.h>
+#define USE_SIMD 1
+#endif
 
-    return nr;
-}
+ /* To avoid security error on Visual Studio */
+#define _CRT_SECURE_NO_WARNINGS
+#pragma warning(disable : 4996)
 
-int intChange(char* ary) {  //정수토큰(문자열)을 정수로 바꾸어주는 함수
+long long intChange(char* ary) {  //정수토큰(문자열)을 정수로 바꾸어주는 함수
     int n = 0;  //ary의 인덱스를 나타내는 변수
-    int result = 0;     //총 결과에 더해줄 수(정수 토큰을 정수로 바꾼 값)
+    unsigned long long result = 0;     //총 결과에 더해줄 수(정수 토큰을 정수로 바꾼 값), 64비트를 넘으면 2^64로 감김
 
     while (ary[n] >= '0' && ary[n] <= '9') {    //ary[n]이 아스키코드로 바꾸었을때 정수인지
             result = result * 10 + (ary[n] - '0');      //아스키코드 이용
             n++;
     }
-    return result;  //변환한 정수 반환
+    return (long long)result;  //변환한 정수 반환
 }
 
-static int do_compute(int nr_tokens, char* tokens[])
+static long long do_compute(int nr_tokens, char* tokens[])
 {
     char mode = '+';    //덧셈과 뺄셈을 결정하는 변수
     int num = 0;    //total에 계속해서 더해줄 값을 나타내는 변수
-    int total = 0;  //결과값을 나타내는 변수
+    unsigned long long total = 0;  //결과값을 나타내는 변수 (int는 21억을 넘으면 감겨서 64비트로 누적)
     for (int i = 0; i < nr_tokens; i++) {
         if (*tokens[i] == '+') { //더하기모드로 변경
             int num = intChange(tokens[i]);
@@ -49,7 +49,7 @@ static int do_compute(int nr_tokens, char* tokens[])
             mode = '-';
         }
         else {  //정수 토큰을 읽었을때 연산을 시행
-            int num = intChange(tokens[i]);
+            unsigned long long num = intChange(tokens[i]);
             if (mode == '+') {
                 total += num;
             }
@@ -58,14 +58,401 @@ static int do_compute(int nr_tokens, char* tokens[])
             }
         }
     }
-    return total;   //결과값 반환
+    return (long long)total;   //결과값 반환
+}
+
+/*
+ * 스트리밍 모드 (pa0 -s [file], pa0 -t [nr_threads] [file])
+ *
+ * 입력 파일 전체를 메모리에 매핑한 뒤 줄 단위로 바로 계산한다. 토큰을 복사하지
+ * 않고 힙 할당도 하지 않으며, 숫자는 SSE4.1로 16자리씩 한 번에 변환한다.
+ * 결과는 do_compute()와 같다. -t를 주면 파일을 줄 경계에서 조각내어 여러 스레드가 계산하고,
+ * 출력은 메인 스레드가 입력 순서대로 내보낸다.
+ */
+
+struct mapped_file {
+    const char* data;
+    size_t size;
+};
+
+static int map_file(const char* filename, struct mapped_file* map)
+{
+#ifdef _WIN32
+    FILE* file = fopen(filename, "rb");  //mmap이 없으면 통째로 읽어들임
+    long size;
+
+    if (!file) return -1;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    map->data = malloc(size ? size : 1);
+    if (!map->data) {
+        fclose(file);
+        return -1;
+    }
+    map->size = fread((char*)map->data, 1, size, file);
+    fclose(file);
+#else
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    map->size = st.st_size;
+    map->data = NULL;
+    if (map->size) {
+        map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map->data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise((void*)map->data, map->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+#endif
+    return 0;
+}
+
+static void unmap_file(struct mapped_file* map)
+{
+#ifdef _WIN32
+    free((void*)map->data);
+#else
+    if (map->size) munmap((void*)map->data, map->size);
+#endif
+}
+
+#ifdef USE_SIMD
+/* n자리 숫자를 16바이트 레지스터의 오른쪽 끝으로 옮기기 위한 셔플 테이블 */
+static signed char align_digits[17][16];
+
+static void init_align_digits(void)
+{
+    for (int n = 0; n <= 16; n++) {
+        for (int i = 0; i < 16; i++) {
+            align_digits[n][i] = (i >= 16 - n) ? (signed char)(i - (16 - n)) : (signed char)0x80;
+        }
+    }
+}
+
+static unsigned int count_digits(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanForward(&index, ~mask) ? index : 32;
+#else
+    return __builtin_ctz(~mask);
+#endif
+}
+
+/* p부터 최대 16자리 숫자를 한 번에 변환. 변환한 자리수를 *len에 저장 */
+static unsigned long long simd_digits(const char* p, unsigned int* len)
+{
+    const __m128i chars = _mm_loadu_si128((const __m128i*)p);
+    const __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(-1)),
+        _mm_cmplt_epi8(values, _mm_set1_epi8(10)));
+    unsigned int n = count_digits(_mm_movemask_epi8(is_digit));
+    __m128i v;
+
+    *len = n;
+    if (n == 0) return 0;
+
+    v = _mm_shuffle_epi8(values, _mm_loadu_si128((const __m128i*)align_digits[n]));
+    v = _mm_maddubs_epi16(v, _mm_set_epi8(1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10));
+    v = _mm_madd_epi16(v, _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100));
+    v = _mm_packus_epi32(v, v);
+    v = _mm_madd_epi16(v, _mm_set_epi16(1, 10000, 1, 10000, 1, 10000, 1, 10000));
+
+    return (unsigned long long)(unsigned int)_mm_cvtsi128_si32(v) * 100000000ULL +
+        (unsigned int)_mm_extract_epi32(v, 1);
+}
+#endif
+
+/* 한 줄의 +/- 연산을 계산. 토큰 규칙은 tokenize() + do_compute()와 같음 */
+static long long stream_compute(const char* p, const char* eol, const char* end)
+{
+    char mode = '+';
+    unsigned long long total = 0;
+
+    (void)end;  //SIMD 빌드에서만 씀
+
+    while (p < eol) {
+        unsigned long long num = 0;
+
+        if (*p == ' ' || *p == '\t') {
+            p++;
+            continue;
+        }
+        if (*p == '+' || *p == '-') {
+            mode = *p;
+        }
+        else {
+#ifdef USE_SIMD
+            unsigned int len = 16;
+            while (len == 16 && end - p >= 16) {
+                unsigned long long chunk = simd_digits(p, &len);
+                for (unsigned int i = 0; i < len; i++) num *= 10;
+                num += chunk;
+                p += len;
+            }
+            if (len == 16)
+#endif
+            while (p < eol && *p >= '0' && *p <= '9') {
+                num = num * 10 + (*p - '0');
+                p++;
+            }
+            total = (mode == '+') ? total + num : total - num;
+        }
+        while (p < eol && *p != ' ' && *p != '\t') p++;  //토큰의 나머지는 무시
+    }
+    return (long long)total;
+}
+
+/* 결과를 모아두는 버퍼. @flush_to가 있으면 가득 찰 때 내보내고, 없으면 늘린다 */
+struct output_buffer {
+    char* data;
+    size_t len;
+    size_t size;
+    FILE* flush_to;
+};
+
+static void put_result(struct output_buffer* out, long long value)
+{
+    char digits[20];
+    int n = 0;
+    unsigned long long v = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+    char* p;
+
+    if (out->len + 24 > out->size) {
+        if (out->flush_to) {
+            fwrite(out->data, 1, out->len, out->flush_to);
+            out->len = 0;
+        }
+        else {
+            char* data;
+
+            out->size = out->size ? out->size * 2 : (1 << 16);
+            data = realloc(out->data, out->size);
+            if (!data) {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            out->data = data;
+        }
+    }
+
+    p = out->data + out->len;
+    if (value < 0) *p++ = '-';
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) *p++ = digits[--n];
+    *p++ = '\n';
+    out->len = p - out->data;
+}
+
+/* [begin, finish) 사이에서 시작하는 줄들을 계산하고 줄 수를 반환 */
+static size_t stream_lines(const char* begin, const char* finish, const char* end, struct output_buffer* out)
+{
+    size_t nr_lines = 0;
+
+    for (const char* p = begin; p < finish; ) {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+
+        put_result(out, stream_compute(p, eol, end));
+        nr_lines++;
+        p = eol + 1;
+    }
+    return nr_lines;
+}
+
+#ifndef _WIN32
+#define CHUNK_SIZE  (1 << 22)   /* 스레드 하나가 한 번에 맡는 입력 크기 */
+
+/*
+ * 조각 i는 [i * CHUNK_SIZE, (i + 1) * CHUNK_SIZE) 안에서 시작하는 줄들이다.
+ * 줄 경계만 보고 정하므로 스레드끼리 조각 경계를 맞출 필요가 없다.
+ */
+static const char* chunk_start(const struct mapped_file* map, size_t i)
+{
+    const char* end = map->data + map->size;
+    const char* p;
+
+    if (i == 0) return map->data;
+    if ((size_t)i * CHUNK_SIZE >= map->size) return end;
+
+    p = memchr(map->data + i * CHUNK_SIZE - 1, '\n', end - (map->data + i * CHUNK_SIZE - 1));
+    return p ? p + 1 : end;
+}
+
+struct parallel_stream {
+    const struct mapped_file* map;
+    size_t nr_chunks;
+    size_t next_chunk;          /* 다음에 계산할 조각 */
+    size_t written;             /* 출력이 끝난 조각 수 */
+    size_t nr_slots;            /* 동시에 들고 있을 수 있는 조각 수 */
+    struct chunk_slot {
+        struct output_buffer out;
+        size_t nr_lines;
+        int done;
+    } *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void* stream_worker(void* arg)
+{
+    struct parallel_stream* ps = arg;
+    const char* end = ps->map->data + ps->map->size;
+
+    while (1) {
+        size_t i;
+        struct chunk_slot* slot;
+
+        pthread_mutex_lock(&ps->lock);
+        i = ps->next_chunk;
+        if (i >= ps->nr_chunks) {
+            pthread_mutex_unlock(&ps->lock);
+            return NULL;
+        }
+        ps->next_chunk++;
+        while (i >= ps->written + ps->nr_slots) {   //출력이 밀려 있으면 메모리를 늘리지 않고 기다림
+            pthread_cond_wait(&ps->cond, &ps->lock);
+        }
+        slot = &ps->slots[i % ps->nr_slots];
+        pthread_mutex_unlock(&ps->lock);
+
+        slot->out.len = 0;
+        slot->nr_lines = stream_lines(chunk_start(ps->map, i), chunk_start(ps->map, i + 1), end, &slot->out);
+
+        pthread_mutex_lock(&ps->lock);
+        slot->done = 1;
+        pthread_cond_broadcast(&ps->cond);
+        pthread_mutex_unlock(&ps->lock);
+    }
+}
+
+static size_t stream_parallel(const struct mapped_file* map, int nr_threads)
+{
+    struct parallel_stream ps = {
+        .map = map,
+        .nr_chunks = (map->size + CHUNK_SIZE - 1) / CHUNK_SIZE,
+        .nr_slots = (size_t)nr_threads * 2,
+    };
+    pthread_t* threads = calloc(nr_threads, sizeof(*threads));
+    size_t nr_lines = 0;
+
+    ps.slots = calloc(ps.nr_slots, sizeof(*ps.slots));
+    if (!threads || !ps.slots) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&ps.lock, NULL);
+    pthread_cond_init(&ps.cond, NULL);
+
+    for (int i = 0; i < nr_threads; i++) {
+        if (pthread_create(&threads[i], NULL, stream_worker, &ps) != 0) {  //만들어진 스레드만으로 계속
+            nr_threads = i;
+            break;
+        }
+    }
+    if (nr_threads == 0) {
+        fprintf(stderr, "Unable to create worker threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* 메인 스레드가 유일한 writer로서 조각을 입력 순서대로 내보냄 */
+    for (size_t i = 0; i < ps.nr_chunks; i++) {
+        struct chunk_slot* slot = &ps.slots[i % ps.nr_slots];
+
+        pthread_mutex_lock(&ps.lock);
+        while (!slot->done) pthread_cond_wait(&ps.cond, &ps.lock);
+        pthread_mutex_unlock(&ps.lock);
+
+        fwrite(slot->out.data, 1, slot->out.len, stderr);
+        nr_lines += slot->nr_lines;
+
+        pthread_mutex_lock(&ps.lock);
+        slot->done = 0;
+        ps.written++;
+        pthread_cond_broadcast(&ps.cond);
+        pthread_mutex_unlock(&ps.lock);
+    }
+
+    for (int i = 0; i < nr_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (size_t i = 0; i < ps.nr_slots; i++) {
+        free(ps.slots[i].out.data);
+    }
+    free(ps.slots);
+    free(threads);
+    pthread_mutex_destroy(&ps.lock);
+    pthread_cond_destroy(&ps.cond);
+
+    return nr_lines;
+}
+#endif
+
+static int stream_main(const char* filename, int nr_threads)
+{
+    struct mapped_file map;
+    static char output[1 << 16];
+    struct output_buffer out = { output, 0, sizeof(output), stderr };
+    size_t nr_lines;
+    struct timespec start, finish;
+    double elapsed;
+
+    if (map_file(filename, &map) < 0) {
+        fprintf(stderr, "Unable to open file %s\n", filename);
+        return EXIT_FAILURE;
+    }
+#ifdef USE_SIMD
+    init_align_digits();
+#endif
+    timespec_get(&start, TIME_UTC);
+
+#ifndef _WIN32
+    if (nr_threads > 1) {
+        nr_lines = stream_parallel(&map, nr_threads);
+    }
+    else
+#endif
+    {
+        nr_threads = 1;
+        nr_lines = stream_lines(map.data, map.data + map.size, map.data + map.size, &out);
+        fwrite(out.data, 1, out.len, stderr);
+    }
+
+    timespec_get(&finish, TIME_UTC);
+    elapsed = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%zu lines in %.3f s (%.0f lines/s, %d thread%s)\n", nr_lines, elapsed,
+        elapsed > 0 ? nr_lines / elapsed : 0.0, nr_threads, nr_threads > 1 ? "s" : "");
+
+    unmap_file(&map);
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char* const argv[])
 {
-    char line[MAX_COMMAND] = { '\0' };
+    struct arena arena = { NULL };  //한 줄을 처리하는 동안 쓰는 메모리, 줄마다 비움
+    char** tokens;
+    int nr_tokens;
     FILE* input = stdin;
 
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        return stream_main(argv[2], 1);
+    }
+    if (argc == 4 && strcmp(argv[1], "-t") == 0) {
+        return stream_main(argv[3], atoi(argv[2]));
+    }
+
     if (argc == 2) {
         input = fopen(argv[1], "r");
         if (!input) {
@@ -74,16 +461,12 @@ int main(int argc, char* const argv[])
         }
     }
 
-    while (fgets(line, sizeof(line), input)) {
-        char* tokens[MAX_NR_TOKENS] = { NULL };
-        int nr_tokens;
-
-        nr_tokens = parse_command(line, tokens);
-
-        fprintf(stderr, "%d\n", do_compute(nr_tokens, tokens));
+    while ((nr_tokens = read_tokens(&arena, input, 0, &tokens)) >= 0) {
+        fprintf(stderr, "%lld\n", do_compute(nr_tokens, tokens));
 
-        /* No worries about the memory leak by strdup() ;-) */
+        arena_reset(&arena);
     }
+    arena_destroy(&arena);
 
     if (input != stdin) fclose(input);
 
@@ -20,60 +20,48 @@
 #include <ctype.h>
 #include <errno.h>
 #pragma warning(disable : 4996)
-unsigned int register_num(char* num);
-static unsigned int r_format(unsigned int opcode, unsigned int rs, unsigned int rt, unsigned int rd, unsigned int shamt, unsigned int func);
-static unsigned int i_format(unsigned int opcode, unsigned int rs, unsigned int rt, int con);
+
+#include "../common/asm.h"
+#include "../common/core.h"
+#include "../common/peephole.h"
+#include "../common/sched.h"
+#include "../common/tokenize.h"
 
  /*====================================================================*/
  /*          ****** DO NOT MODIFY ANYTHING BELOW THIS LINE ******       */
-#define MAX_NR_TOKENS	16	/* Maximum length of tokens in a command */
-#define MAX_TOKEN_LEN	32	/* Maximum length of single token */
-#define MAX_ASSEMBLY	128 /* Maximum length of assembly string */
 
 /***********************************************************************
  * parse_command()
  *
  * DESCRIPTION
- *   Parse @assembly, and put each assembly token into @tokens[].
+ *   Parse @assembly, and put each assembly token into @tokens[], which is
+ *   allocated from @arena together with @assembly itself.
  *
  * RETURN VALUE
  *   Return the number of tokens. Characters in @assembly are converted
  *   to lower-cases.
  *
  */
-static int parse_command(char* assembly, char* tokens[])
+static int parse_command(struct arena* arena, char* assembly, char** tokens[])
 {
-	char* curr = assembly;
-	int token_started = false;
-	int nr_tokens = 0;
-
-	while (*curr != '\0') {
-		if (isspace(*curr)) {
-			*curr = '\0';
-			token_started = false;
-		}
-		else {
-			*curr = tolower(*curr);
-			if (!token_started) {
-				tokens[nr_tokens++] = curr;
-				token_started = true;
-			}
-		}
-		curr++;
-	}
-
-	return nr_tokens;
+	return tokenize(arena, assembly, TOKENIZE_LOWER | TOKENIZE_COMMENTS, tokens);
 }
 
-static unsigned int translate(int nr_tokens, char* tokens[]);
+static bool translate(int nr_tokens, char* tokens[], unsigned int* instruction);
+static bool passes_enabled(void);
+static void passes_add(unsigned int instruction);
+static void passes_flush(bool run);
 
 /***********************************************************************
  * The main function of this program.
  */
 int main(int argc, char* const argv[])
 {
-	char assembly[MAX_ASSEMBLY] = { '\0' };
+	struct arena arena = { NULL };
+	char* assembly;
 	FILE* input = stdin;
+	int line = 0;
+	bool failed = false;
 
 	if (argc > 1) {
 		input = fopen(argv[1], "r");
@@ -93,25 +81,42 @@ int main(int argc, char* const argv[])
 		printf(">> ");
 	}
 
-	while (fgets(assembly, sizeof(assembly), input)) {
-		char* tokens[MAX_NR_TOKENS] = { NULL };
+	while ((assembly = arena_getline(&arena, input))) {
+		char** tokens;
 		int nr_tokens;
 		unsigned int instruction;
 
-		nr_tokens = parse_command(assembly, tokens);
+		line++;
+		nr_tokens = parse_command(&arena, assembly, &tokens);
 
-		if (nr_tokens <= 0) continue;
+		if (nr_tokens <= 0) {
+			arena_reset(&arena);
+			continue;
+		}
 
-		instruction = translate(nr_tokens, tokens);
+		if (!translate(nr_tokens, tokens, &instruction)) {
+			fprintf(stderr, "cannot assemble line %d:", line);
+			for (int i = 0; i < nr_tokens; i++) fprintf(stderr, " %s", tokens[i]);
+			fprintf(stderr, "\n");
+			failed = true;
+		}
+		else if (passes_enabled()) {
+			passes_add(instruction);
+		}
+		else {
+			fprintf(stderr, "0x%08x\n", instruction);
+		}
 
-		fprintf(stderr, "0x%08x\n", instruction);
+		arena_reset(&arena);
 
 		if (input == stdin) printf(">> ");
 	}
+	arena_destroy(&arena);
+	if (passes_enabled()) passes_flush(!failed);
 
 	if (input != stdin) fclose(input);
 
-	return EXIT_SUCCESS;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /* To avoid security error on Visual Studio */
@@ -126,295 +131,169 @@ int main(int argc, char* const argv[])
  *
  * DESCRIPTION
  *   Translate assembly represented in @tokens[] into a MIPS instruction.
- *   This translate should support following 15 assembly commands
+ *   The encodings come from the instruction table in common/isa.h which
+ *   pa2 and pa3 share, so the translator supports every instruction the
+ *   emulators execute:
  *
- *    - add
- *    - addi
- *    - sub
- *    - and
- *    - andi
- *    - or
- *    - ori
- *    - nor
- *    - lw
- *    - sw
- *    - sll
- *    - srl
- *    - sra
- *    - beq
- *    - bne
+ *    - add, sub, and, or, nor, slt
+ *    - sll, srl, sra
+ *    - mult, mfhi, mflo, jr
+ *    - addi, andi, ori, slti
+ *    - lw, sw, lbu
+ *    - beq, bne
+ *    - j, jal
+ *    - syscall, halt
+ *    - paddb, paddh, psubb, psubh, pcmpeqb, pcmpeqh,
+ *      pminub, pmaxub, pminsh, pmaxsh, lq, sq (packed SIMD)
  *
  * RETURN VALUE
- *   Return a 32-bit MIPS instruction
+ *   Return true and put the 32-bit MIPS instruction into @instruction,
+ *   or false if the line cannot be translated
  *
  */
-static unsigned int translate(int nr_tokens, char* tokens[]){
-
-	unsigned int result = 0;
-
-	if (strcmp(tokens[0], "add") == 0) {	//add
-		unsigned int opcode = 0; // 5비트 opcode
-		unsigned int rs = register_num(tokens[2]); // 5비트 rs 레지스터
-		unsigned int rt = register_num(tokens[3]); // 5비트 rt 레지스터
-		unsigned int rd = register_num(tokens[1]); // 5비트 rd 레지스터
-		unsigned int shamt = 0; // 5비트 쉬프트 어마운트
-		unsigned int func = 32; // 6비트 함수 코드 (0x20)
-		result = r_format(opcode, rs, rt, rd, shamt, func);
-	}
+static bool translate(int nr_tokens, char* tokens[], unsigned int* instruction)
+{
+	return assemble(nr_tokens, tokens, instruction);
+}
 
-	if (strcmp(tokens[0], "sub") == 0) {	//sub
-		unsigned int opcode = 0;
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[3]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt = 0;
-		unsigned int func = 34;	//0x22
-		result = r_format(opcode, rs, rt, rd, shamt, func);
-	}
 
-	if (strcmp(tokens[0], "and") == 0) {	//and
-		unsigned int opcode = 0;
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[3]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt = 0;
-		unsigned int func = 36;	//0x24
-		result = r_format(opcode, rs, rt, rd, shamt, func);
-	}
+/***********************************************************************
+ * Optimization passes
+ *
+ *   With PA1_OPTIMIZE or PA1_SCHEDULE set, the instructions are kept until
+ *   the end of the input, optimized and printed then, followed by a report
+ *   on stdout. Nothing is printed if any line fails to translate, since
+ *   the passes would work on a program with a hole in it.
+ *
+ *   PA1_OPTIMIZE runs the peephole optimizer and dead-code elimination of
+ *   common/peephole.h. Its value lists the registers the program leaves
+ *   its results in, e.g., PA1_OPTIMIZE=v0,v1; any other value keeps every
+ *   register live at halt.
+ *
+ *   PA1_SCHEDULE runs the scheduler of common/sched.h for the pa3 pipeline,
+ *   or for the pipeline without forwarding with PA1_SCHEDULE=noforward.
+ *
+ *   The report compares the program before and after on the pa3 timing
+ *   model of common/sched.h when it halts within PASSES_MAX_CYCLES.
+ */
+#define PASSES_MAX_CYCLES	(1ULL << 28)
 
-	if (strcmp(tokens[0], "or") == 0) {	//or
-		unsigned int opcode = 0;
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[3]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt = 0;
-		unsigned int func = 37;	//0x25
-		result = r_format(opcode, rs, rt, rd, shamt, func);
-	}
+static unsigned int* program;
+static int nr_program;
+static int max_program;
 
-	if (strcmp(tokens[0], "nor") == 0) {	//nor
-		unsigned int opcode = 0;
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[3]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt = 0;
-		unsigned int func = 39;	//0x27
-		result = r_format(opcode, rs, rt, rd, shamt, func);
-	}
+static bool passes_enabled(void)
+{
+	static int enabled = -1;
 
-	if (strcmp(tokens[0], "sll") == 0) {	//sll
-		unsigned int opcode = 0;
-		unsigned int rs = 0;
-		unsigned int rt = register_num(tokens[2]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt;
-		if (tokens[3][0] == '0' && tokens[3][1] == 'x') {
-			shamt = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			shamt = atoi(tokens[3]);
-		}
-		
-		unsigned int func = 0;	//0x00
-		result = r_format(opcode, rs, rt, rd, shamt, func);
-	}
+	if (enabled < 0) enabled = getenv("PA1_OPTIMIZE") != NULL || getenv("PA1_SCHEDULE") != NULL;
+	return enabled;
+}
 
-	if (strcmp(tokens[0], "srl") == 0) {	//srl
-		unsigned int opcode = 0;
-		unsigned int rs = 0;
-		unsigned int rt = register_num(tokens[2]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt;
-		if (tokens[3][0] == '0' && tokens[3][1] == 'x') {
-			shamt = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			shamt = atoi(tokens[3]);
+static void passes_add(unsigned int instruction)
+{
+	if (nr_program == max_program) {
+		max_program = max_program ? max_program * 2 : 256;
+		program = realloc(program, max_program * sizeof(*program));
+		if (!program) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
 		}
-
-		unsigned int func = 2;	//0x02
-		result = r_format(opcode, rs, rt, rd, shamt, func);
 	}
+	program[nr_program++] = instruction;
+}
 
-	if (strcmp(tokens[0], "sra") == 0) {	//sra
-		unsigned int opcode = 0;
-		unsigned int rs = 0;
-		unsigned int rt = register_num(tokens[2]);
-		unsigned int rd = register_num(tokens[1]);
-		unsigned int shamt;
-		if (tokens[3][0] == '0' && tokens[3][1] == 'x') {
-			shamt = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			shamt = atoi(tokens[3]);
-		}
-
-		unsigned int func = 3;	//0x03
-		result = r_format(opcode, rs, rt, rd, shamt, func);
+/* Registers listed in @list, or all of them if it is not a list of registers */
+static unsigned long long __live_at_halt(const char* list)
+{
+	unsigned long long live = 0;
+	char name[16];
+
+	while (*list) {
+		size_t len = strcspn(list, ",");
+		int reg;
+
+		if (len >= sizeof(name)) return PEEPHOLE_ALL_LIVE;
+		memcpy(name, list, len);
+		name[len] = '\0';
+		if (!isalpha(name[0]) && name[0] != '$') return PEEPHOLE_ALL_LIVE;	/* "1" is $at otherwise */
+		if ((reg = asm_register(name)) < 0) return PEEPHOLE_ALL_LIVE;
+
+		live |= ISA_REG(reg);
+		list += len;
+		if (*list == ',') list++;
 	}
+	return live ? live : PEEPHOLE_ALL_LIVE;
+}
 
-	if (strcmp(tokens[0], "addi") == 0) {	//addi
-		int con;
-		unsigned int opcode = 8;	//0x08
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[3][1] == '0' && tokens[3][2] == 'x') || (tokens[3][0] == '0' && tokens[3][1] == 'x')) {	//16진수일때
-			con = strtol(tokens[3], NULL, 16);
-		}
-		else {	//10진수일때
-			con = strtol(tokens[3], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
+/* Cycles of @insts on the pa3 timing model, or 0 if it does not halt */
+static unsigned long long __timing_cycles(const unsigned int* insts, int nr_insts, const struct sched_model* model)
+{
+	struct mips_core core = { .pc = SCHED_BASE };
+	struct mips_retire retire;
+	struct sched_timing timing;
+	unsigned long long cycles = 0;
+
+	core.memory = calloc(1, CORE_MEMORY_SIZE);
+	if (!core.memory) return 0;
+	memset(&timing, 0, sizeof(timing));
+	core.registers[29] = CORE_MEMORY_SIZE;	/* $sp at the end of memory, as in mc */
+	for (int i = 0; i < nr_insts && SCHED_BASE + i * 4 < CORE_MEMORY_SIZE; i++) {
+		core_store_word(core.memory, SCHED_BASE + i * 4, insts[i]);
 	}
 
-	if (strcmp(tokens[0], "andi") == 0) {	//andi
-		int con;
-		unsigned int opcode = 12;	//0x0c
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[3][1] == '0' && tokens[3][2] == 'x') || (tokens[3][0] == '0' && tokens[3][1] == 'x')) {
-			con = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			con = strtol(tokens[3], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
+	while (core_step(&core, &retire) && cycles < PASSES_MAX_CYCLES) {
+		cycles = sched_timing_retire(&timing, model, retire.instr);
 	}
+	cycles = retire.id == ISA_HALT && cycles < PASSES_MAX_CYCLES ? sched_timing_retire(&timing, model, retire.instr) : 0;
+	free(core.memory);
 
-	if (strcmp(tokens[0], "ori") == 0) {	//ori
-		int con;
-		unsigned int opcode = 13;	//0x0d
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[3][1] == '0' && tokens[3][2] == 'x') || (tokens[3][0] == '0' && tokens[3][1] == 'x')) {
-			con = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			con = strtol(tokens[3], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
-	}
+	return cycles;
+}
 
-	if (strcmp(tokens[0], "lw") == 0) {	//lw
-		int con;
-		unsigned int opcode = 35;	//0x23
-		unsigned int rs = register_num(tokens[3]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[2][1] == '0' && tokens[2][2] == 'x') || (tokens[2][0] == '0' && tokens[2][1] == 'x')) {
-			con = strtol(tokens[2], NULL, 16);
-		}
-		else {
-			con = strtol(tokens[2], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
+/* Run the passes over the program and print it with the report */
+static void __passes_run(void)
+{
+	const char* optimize = getenv("PA1_OPTIMIZE");
+	const char* schedule = getenv("PA1_SCHEDULE");
+	bool forwarding = !schedule || strcmp(schedule, "noforward") != 0;
+	const struct sched_model* model = forwarding ? &sched_forwarding : &sched_no_forwarding;
+	unsigned long long before = __timing_cycles(program, nr_program, model);
+	unsigned long long after;
+	int nr_insts = nr_program;
+
+	if (optimize) {
+		struct peephole_stats stats;
+
+		nr_program = peephole_program(program, nr_program, __live_at_halt(optimize), &stats);
+		printf("peephole: %d -> %d instructions, %u removed, %u reads propagated, %u reloads forwarded\n",
+			nr_insts, nr_program, stats.removed, stats.propagated, stats.forwarded);
 	}
+	if (schedule) {
+		struct sched_stats stats;
 
-	if (strcmp(tokens[0], "sw") == 0) {	//sw
-		int con;
-		unsigned int opcode = 43;	//0x2b
-		unsigned int rs = register_num(tokens[3]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[2][1] == '0' && tokens[2][2] == 'x') || (tokens[2][0] == '0' && tokens[2][1] == 'x')) {
-			con = strtol(tokens[2], NULL, 16);
-		}
-		else {
-			con = strtol(tokens[2], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
+		sched_program(program, nr_program, model, &stats);
+		printf("schedule: %d instructions in %u blocks, %u moved, predicted stalls %llu -> %llu (%s)\n",
+			nr_program, stats.blocks, stats.moved, stats.stalls_before, stats.stalls_after,
+			forwarding ? "forwarding" : "no forwarding");
 	}
 
-	if (strcmp(tokens[0], "beq") == 0) {	//beq
-		int con;
-		unsigned int opcode = 4;	//0x04
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[3][1] == '0' && tokens[3][2] == 'x') || (tokens[3][0] == '0' && tokens[3][1] == 'x')) {
-			con = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			con = strtol(tokens[3], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
+	for (int i = 0; i < nr_program; i++) {
+		fprintf(stderr, "0x%08x\n", program[i]);
 	}
 
-	if (strcmp(tokens[0], "bne") == 0) {	//bne
-		int con;
-		unsigned int opcode = 5;	//0x05
-		unsigned int rs = register_num(tokens[2]);
-		unsigned int rt = register_num(tokens[1]);
-		if ((tokens[3][1] == '0' && tokens[3][2] == 'x') || (tokens[3][0] == '0' && tokens[3][1] == 'x')) {
-			con = strtol(tokens[3], NULL, 16);
-		}
-		else {
-			con = strtol(tokens[3], NULL, 10);
-		}
-		result = i_format(opcode, rs, rt, con);
+	after = before ? __timing_cycles(program, nr_program, model) : 0;
+	if (before && after) {
+		printf("pa3: %llu -> %llu cycles (%.1f%% fewer)\n", before, after, 100.0 * ((double)before - after) / before);
 	}
-
-	return result;
 }
 
-static unsigned int r_format(unsigned int opcode, unsigned int rs, unsigned int rt, unsigned int rd, unsigned int shamt, unsigned int func) {	//R-Format함수
-
-	unsigned int result = 0;
-
-	// opcode, rs, rt, rd, shamt, func를 result에 추가
-	result = result | (opcode << 26); // opcode추가(27~32)
-	result = result | (rs << 21);     // rs추가(22~26)
-	result = result | (rt << 16);     // rt추가(17~21)
-	result = result | (rd << 11);     // rd추가(12~16)
-	result = result | (shamt << 6);   // shamt추가(7~11)
-	result = result | func;            // func추가(1~6)
-
-	return result;
-}
-
-static unsigned int i_format(unsigned int opcode, unsigned int rs, unsigned int rt, int con) {	//I-Format함수
-
-	unsigned int result = 0;
-	con = con & 0xFFFF; // 하위 16비트만 유효
-	// opcode, rs, rt, con을 result에 추가
-	result = result | (opcode << 26); // opcode추가(27~32)
-	result = result | (rs << 21);     // rs추가(22~26)
-	result = result | (rt << 16);     // rt추가(17~21)
-	result = result | (unsigned int)con;    // con추가(1~16)
-
-	return result;
-}
+/* At the end of the input, run the passes unless a line could not be translated */
+static void passes_flush(bool run)
+{
+	if (run) __passes_run();
 
-// 레지스터 번호를 반환하는 함수
-unsigned int register_num(char* num) {
-	if (strcmp(num, "zero") == 0) return 0;
-	else if (strcmp(num, "at") == 0) return 1;
-	else if (strcmp(num, "v0") == 0) return 2;
-	else if (strcmp(num, "v1") == 0) return 3;
-	else if (strcmp(num, "a0") == 0) return 4;
-	else if (strcmp(num, "a1") == 0) return 5;
-	else if (strcmp(num, "a2") == 0) return 6;
-	else if (strcmp(num, "a3") == 0) return 7;
-	else if (strcmp(num, "t0") == 0) return 8;
-	else if (strcmp(num, "t1") == 0) return 9;
-	else if (strcmp(num, "t2") == 0) return 10;
-	else if (strcmp(num, "t3") == 0) return 11;
-	else if (strcmp(num, "t4") == 0) return 12;
-	else if (strcmp(num, "t5") == 0) return 13;
-	else if (strcmp(num, "t6") == 0) return 14;
-	else if (strcmp(num, "t7") == 0) return 15;
-	else if (strcmp(num, "s0") == 0) return 16;
-	else if (strcmp(num, "s1") == 0) return 17;
-	else if (strcmp(num, "s2") == 0) return 18;
-	else if (strcmp(num, "s3") == 0) return 19;
-	else if (strcmp(num, "s4") == 0) return 20;
-	else if (strcmp(num, "s5") == 0) return 21;
-	else if (strcmp(num, "s6") == 0) return 22;
-	else if (strcmp(num, "s7") == 0) return 23;
-	else if (strcmp(num, "t8") == 0) return 24;
-	else if (strcmp(num, "t9") == 0) return 25;
-	else if (strcmp(num, "k0") == 0) return 26;
-	else if (strcmp(num, "k1") == 0) return 27;
-	else if (strcmp(num, "gp") == 0) return 28;
-	else if (strcmp(num, "sp") == 0) return 29;
-	else if (strcmp(num, "fp") == 0) return 30;
-	else if (strcmp(num, "ra") == 0) return 31;
-	else return -1;
+	free(program);
+	program = NULL;
+	nr_program = max_program = 0;
 }
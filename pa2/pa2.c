@@ -21,6 +21,17 @@
 #include <inttypes.h>
 #include <ctype.h>
 
+#include "../common/asm.h"
+#include "../common/core.h"
+#include "../common/disasm.h"
+#include "../common/interval.h"
+#include "../common/loader.h"
+#include "../common/memtrace.h"
+#include "../common/profile.h"
+#include "../common/replay.h"
+#include "../common/syscall.h"
+#include "../common/tokenize.h"
+
  /*====================================================================*/
  /*          ****** DO NOT MODIFY ANYTHING FROM THIS LINE ******       */
 
@@ -28,14 +39,12 @@
 #define _CRT_SECURE_NO_WARNINGS
 #pragma warning(disable : 4996)
 
-#define MAX_NR_TOKENS	32	/* Maximum length of tokens in a command */
-#define MAX_TOKEN_LEN	64	/* Maximum length of single token */
 #define MAX_COMMAND		256 /* Maximum length of command string */
 
 /**
  * memory[] emulates the memory of the machine
  */
-static unsigned char memory[1 << 20] = {	/* 1MB memory at 0x0000 0000 -- 0x0100 0000 */
+static unsigned char memory[CORE_MEMORY_SIZE] = {	/* 1MB memory at 0x0000 0000 -- 0x0100 0000 */
 	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
 	0xde, 0xad, 0xbe, 0xef, 0x00, 0x00, 0x00, 0x00,
 	'h',  'e',  'l',  'l',  'o',  ' ',  'w',  'o',
@@ -48,15 +57,31 @@ static unsigned char memory[1 << 20] = {	/* 1MB memory at 0x0000 0000 -- 0x0100
 
 #define ENTRY_PC	0x1000	/* Initial value for PC register */
 #define INITIAL_SP	0x8000	/* Initial location for stack pointer */
+#define HEAP_START	0x10000	/* sbrk hands out memory from here */
+
+/**
+ * I/O of the guest through syscall, see common/syscall.h
+ */
+static struct syscalls syscalls;
 
 /**
- * Registers of the machine
+ * Registers of the machine. The general purpose registers, the arithmetic
+ * registers (hi/lo) and the program counter live in @core so that the
+ * instruction semantics in common/core.h can work on them.
  */
-static unsigned int registers[32] = {
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0x10, ENTRY_PC, 0x20, 3, 0xbadacafe, 0xcdcdcdcd, 0xffffffff, 7,
-	0, 0, 0, 0, 0, INITIAL_SP, 0, 0,
+static struct mips_core core = {
+	.registers = {
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0x10, ENTRY_PC, 0x20, 3, 0xbadacafe, 0xcdcdcdcd, 0xffffffff, 7,
+		0, 0, 0, 0, 0, INITIAL_SP, 0, 0,
+	},
+	.hi = 0xbeef500d,
+	.lo = 0xcdcdcdcd,
+	.pc = ENTRY_PC,
+	.memory = memory,
+	.syscall = syscall_core,
+	.syscall_data = &syscalls,
 };
 
 /**
@@ -69,21 +94,660 @@ const char* register_names[] = {
 	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
 };
 
+static unsigned int translate(int, char* []);
+static bool __translate(int, char* [], unsigned int*);
+static bool process_instruction(unsigned int);
+static unsigned int load_program(unsigned int, char* const);
+static void run_program(void);
+static void resume_program(void);
+static void __process_command(int argc, char* argv[]);
+
 /**
- * Arithmetic registers
+ * Instruction trace of run_program(). Lines are collected in @trace_buffer
+ * and written out in bulk since the trace can be millions of lines long.
  */
-static unsigned int hi = 0xbeef500d;
-static unsigned int lo = 0xcdcdcdcd;
+static bool trace_enabled = false;
+static char trace_buffer[1 << 16];
+static size_t trace_len = 0;
+
+static void __flush_trace(void)
+{
+	fwrite(trace_buffer, 1, trace_len, stderr);
+	trace_len = 0;
+}
+
+static void __trace_instruction(unsigned int addr, unsigned int instr)
+{
+	char* p;
+
+	if (trace_len + DISASM_MAX + 32 > sizeof(trace_buffer)) __flush_trace();
+
+	/* Same columns as the disasm command */
+	p = trace_buffer + trace_len;
+	*p++ = '0';
+	*p++ = 'x';
+	for (int shift = 28; shift >= 0; shift -= 4) *p++ = "0123456789abcdef"[(addr >> shift) & 0xf];
+	p = __disasm_str(p, ":  ");
+	for (int shift = 28; shift >= 0; shift -= 4) *p++ = "0123456789abcdef"[(instr >> shift) & 0xf];
+	p = __disasm_str(p, "    ");
+	p += disasm(instr, addr, p);
+	*p++ = '\n';
+	trace_len = p - trace_buffer;
+}
 
 /**
- * Program counter register
+ * Guest profile of run_program(), see common/profile.h
  */
-static unsigned int pc = ENTRY_PC;
+static bool profile_enabled = false;
+static struct profile profile;
 
-static unsigned int translate(int, char* []);
-static bool process_instruction(unsigned int);
-static unsigned int load_program(unsigned int, char* const);
-static void run_program(void);
+static void __profile_command(int argc, char* argv[])
+{
+	FILE* out = stderr;
+
+	if (argc >= 2 && strcmp(argv[1], "on") == 0 && argc <= 3) {
+		unsigned int period = 1;
+		char* end;
+
+		if (argc == 3) {
+			period = strtoul(argv[2], &end, 0);
+			if (*end || !period) {
+				fprintf(stderr, "Invalid period %s\n", argv[2]);
+				return;
+			}
+		}
+		//이미 있는 프로파일은 지금까지 센 것을 그대로 두고 주기만 바꿈
+		if (!profile.counts) profile_init(&profile, ENTRY_PC, period);
+		else if (argc == 3) profile_set_period(&profile, period);
+		profile_enabled = true;
+		return;
+	}
+	if (argc == 2 && strcmp(argv[1], "off") == 0) {
+		profile_enabled = false;
+		return;
+	}
+	if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+		if (profile.counts) {
+			unsigned int period = profile.period;
+
+			profile_destroy(&profile);
+			profile_init(&profile, ENTRY_PC, period);
+		}
+		return;
+	}
+	if (argc < 2 || argc > 3 ||
+		(strcmp(argv[1], "flat") && strcmp(argv[1], "tree") && strcmp(argv[1], "folded"))) {
+		printf("Usage: profile { on [period] | off | reset | flat | tree | folded } [filename]\n");
+		return;
+	}
+
+	if (!profile.counts) {
+		fprintf(stderr, "No profile, use \"profile on\" before run\n");
+		return;
+	}
+	if (argc == 3 && !(out = fopen(argv[2], "w"))) {
+		fprintf(stderr, "Unable to open %s\n", argv[2]);
+		return;
+	}
+
+	if (strcmp(argv[1], "flat") == 0) {
+		profile_report_flat(&profile, memory, out, 20);
+	}
+	else if (strcmp(argv[1], "tree") == 0) {
+		profile_report_tree(&profile, out);
+	}
+	else {
+		profile_report_folded(&profile, out);
+	}
+
+	if (out != stderr) fclose(out);
+}
+
+/**
+ * Memory reference trace of run_program() for tools/stackdist, see
+ * common/memtrace.h. Fetches are traced by resume_program() and data
+ * accesses by process_instruction().
+ */
+static struct memtrace memtrace;
+
+static void __memtrace_command(int argc, char* argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "on") == 0) {
+		memtrace_close(&memtrace);
+		if (!memtrace_open(&memtrace, argv[2])) fprintf(stderr, "Unable to open %s\n", argv[2]);
+	}
+	else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+		if (!memtrace.file) return;
+
+		fprintf(stderr, "Traced %llu fetches, %llu loads and %llu stores\n",
+			memtrace.counts[MEMTRACE_FETCH], memtrace.counts[MEMTRACE_LOAD], memtrace.counts[MEMTRACE_STORE]);
+		memtrace_close(&memtrace);
+	}
+	else {
+		printf("Usage: memtrace { on [filename] | off }\n");
+	}
+}
+
+/**
+ * Interval statistics of run_program(), see common/interval.h. Every
+ * @period instructions a line of what the program did in them goes to
+ * the file, so the phases of a long run show up.
+ */
+enum interval_counter {
+	INTERVAL_LOADS = 0,
+	INTERVAL_STORES,
+	INTERVAL_BRANCHES,
+	INTERVAL_TAKEN,
+	INTERVAL_JUMPS,
+	INTERVAL_SYSCALLS,
+	NR_INTERVAL_COUNTERS,
+};
+
+static const char* const interval_names[NR_INTERVAL_COUNTERS] = {
+	"loads", "stores", "branches", "taken", "jumps", "syscalls",
+};
+
+static const struct interval_ratio interval_ratios[] = {
+	{ "taken_rate", INTERVAL_TAKEN, INTERVAL_BRANCHES },
+};
+
+static struct interval interval;
+static unsigned long long interval_instructions;
+static unsigned long long interval_counts[NR_INTERVAL_COUNTERS];
+
+static void __interval_retire(const struct mips_retire* retire)
+{
+	if (retire->mem_size) interval_counts[retire->mem_store ? INTERVAL_STORES : INTERVAL_LOADS]++;
+	if (isa_table[retire->id].layout == LAYOUT_RT_RS_BOFF) {
+		interval_counts[INTERVAL_BRANCHES]++;
+		if (retire->taken) interval_counts[INTERVAL_TAKEN]++;
+	}
+	else if (isa_table[retire->id].layout == LAYOUT_TARGET || retire->id == ISA_JR) {
+		interval_counts[INTERVAL_JUMPS]++;
+	}
+	else if (retire->id == ISA_SYSCALL) {
+		interval_counts[INTERVAL_SYSCALLS]++;
+	}
+
+	if (++interval_instructions >= interval.next) interval_sample(&interval, interval_instructions, interval_counts);
+}
+
+static void __interval_command(int argc, char* argv[])
+{
+	if ((argc == 3 || argc == 4) && strcmp(argv[1], "on") == 0) {
+		unsigned long long period = 10000;
+		char* end;
+
+		if (argc == 4) {
+			period = strtoull(argv[3], &end, 0);
+			if (*end || !period) {
+				fprintf(stderr, "Invalid period %s\n", argv[3]);
+				return;
+			}
+		}
+		interval_close(&interval, interval_instructions, interval_counts);
+		interval_instructions = 0;
+		memset(interval_counts, 0, sizeof(interval_counts));
+		if (!interval_open(&interval, argv[2], period, "instructions",
+			interval_names, NR_INTERVAL_COUNTERS, interval_ratios, sizeof(interval_ratios) / sizeof(interval_ratios[0]))) {
+			fprintf(stderr, "Unable to open %s\n", argv[2]);
+		}
+	}
+	else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+		interval_close(&interval, interval_instructions, interval_counts);
+	}
+	else {
+		printf("Usage: interval { on filename [period] | off }\n");
+	}
+}
+
+/**
+ * Record and replay, see common/replay.h. With PA2_RECORD set to a file,
+ * the commands, the programs loaded and the state every PA2_REPLAY_PERIOD
+ * instructions are logged. With PA2_REPLAY set, the replay command runs
+ * the logged commands again, and "replay N" stops at the N-th instruction
+ * starting from the nearest checkpoint. The other commands can be used in
+ * between, e.g., to turn on the trace or the profiler for the replay.
+ * The heap end and the open files of the system calls are checkpointed
+ * along with the registers, and starting over resets them.
+ */
+#define NR_REPLAY_REGS	(37 + SYSCALL_STATE_WORDS)	/* registers, hi, lo, pc, link, syscalls */
+
+static struct replay replay;
+static bool replaying = false;			/* Executing the logged commands */
+static bool run_suspended = false;		/* Stopped in the middle of a logged run */
+static unsigned long long replay_stop = ~0ULL;	/* Instruction to stop the replay at */
+static unsigned long long replay_event = ~0ULL;	/* Next count to call __replay_event() at */
+static unsigned char* initial_memory;
+static struct mips_core initial_core;
+
+static void __replay_get_regs(unsigned int* regs)
+{
+	memcpy(regs, core.registers, sizeof(core.registers));
+	regs[32] = core.hi;
+	regs[33] = core.lo;
+	regs[34] = core.pc;
+	regs[35] = core.link_valid;
+	regs[36] = core.link_addr;
+	syscall_save(&syscalls, regs + 37);
+}
+
+static void __replay_set_regs(const unsigned int* regs)
+{
+	memcpy(core.registers, regs, sizeof(core.registers));
+	core.hi = regs[32];
+	core.lo = regs[33];
+	core.pc = regs[34];
+	core.link_valid = regs[35];
+	core.link_addr = regs[36];
+	syscall_restore(&syscalls, regs + 37);
+}
+
+static void __replay_update_event(void)
+{
+	if (replay.recording) {
+		replay_event = replay.next;
+	}
+	else if (replaying) {
+		replay_event = replay.next < replay_stop ? replay.next : replay_stop;
+	}
+	else {
+		replay_event = ~0ULL;
+	}
+}
+
+static void __replay_init(void)
+{
+	const char* record = getenv("PA2_RECORD");
+	const char* filename = record ? record : getenv("PA2_REPLAY");
+	const char* period = getenv("PA2_REPLAY_PERIOD");
+
+	if (!filename) return;
+
+	if (replay_open(&replay, filename, record != NULL, '2', period ? strtoull(period, NULL, 0) : 1 << 20, memory)) {
+		fprintf(stderr, "Unable to %s %s\n", record ? "record to" : "replay", filename);
+		exit(EXIT_FAILURE);
+	}
+	if (!record) {	/* To start over */
+		if (!(initial_memory = malloc(CORE_MEMORY_SIZE))) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(initial_memory, memory, CORE_MEMORY_SIZE);
+		initial_core = core;
+	}
+	__replay_update_event();
+}
+
+static void __replay_diverged(void)
+{
+	fprintf(stderr, "replay: diverged from the log at instruction %llu, pc 0x%08x\n", replay.count, core.pc);
+	replaying = false;
+	run_suspended = false;
+	__replay_update_event();
+}
+
+/* Log or check the state. Returns true if the run has to stop here */
+static bool __replay_event(bool halted)
+{
+	if (replay.count >= replay.next) {
+		unsigned int regs[NR_REPLAY_REGS];
+
+		__replay_get_regs(regs);
+		if (!replay_state(&replay, regs, NR_REPLAY_REGS, memory)) {
+			__replay_diverged();
+			return true;
+		}
+	}
+	__replay_update_event();
+
+	if (replaying && replay.count >= replay_stop && !halted) {
+		run_suspended = true;
+		return true;
+	}
+	return false;
+}
+
+static void __replay_command(int argc, char* argv[])
+{
+	struct arena arena = { NULL };
+	unsigned int regs[NR_REPLAY_REGS];
+	bool end = false;
+
+	if (argc > 2) {
+		printf("Usage: replay [instruction to stop at]\n");
+		return;
+	}
+	if (!replay.file || replay.recording) {
+		fprintf(stderr, "No log to replay, set PA2_REPLAY\n");
+		return;
+	}
+
+	replay_stop = argc == 2 ? strtoull(argv[1], NULL, 0) : ~0ULL;
+	if (argc == 2) {	/* Start over from the checkpoint before the stop */
+		memcpy(memory, initial_memory, CORE_MEMORY_SIZE);
+		core = initial_core;
+		syscall_close(&syscalls);
+		syscall_init(&syscalls, HEAP_START, CORE_MEMORY_SIZE);
+		__replay_get_regs(regs);
+		run_suspended = replay_seek(&replay, replay_stop, regs, NR_REPLAY_REGS, memory);
+		__replay_set_regs(regs);
+	}
+
+	replaying = true;
+	__replay_update_event();
+	if (run_suspended && replay.count < replay_stop) {
+		run_suspended = false;
+		resume_program();
+	}
+
+	while (replaying && !run_suspended && replay.count < replay_stop) {
+		char** tokens;
+		char* command;
+		int nr_tokens;
+
+		if (replay_read(&replay) != REPLAY_COMMAND) {
+			end = replay.tag < 0;
+			if (!end) __replay_diverged();
+			break;
+		}
+		command = arena_alloc(&arena, replay.len + 1);
+		memcpy(command, replay.data, replay.len);
+		command[replay.len] = '\0';
+		nr_tokens = tokenize(&arena, command, TOKENIZE_LOWER | TOKENIZE_COMMENTS, &tokens);
+		__process_command(nr_tokens, tokens);
+		arena_reset(&arena);
+	}
+	arena_destroy(&arena);
+
+	if (replaying) {
+		fprintf(stderr, "replay: at instruction %llu%s\n", replay.count, end ? ", end of the log" : "");
+	}
+	replaying = false;
+	__replay_update_event();
+}
+
+/**
+ * Breakpoints, watchpoints and stepping. Without any of them the program
+ * runs in the plain loop of resume_program(), which checks nothing per
+ * instruction. Breakpoints are a bitmap over the word addresses that is
+ * consulted only when the run resumes and after a branch or a jump
+ * retires: the scan stops at the first breakpoint or at the end of the
+ * block, and that address is kept in @debug_check, so the instructions in
+ * between only compare their pc with it. The scans are cached by the
+ * block start, so a loop scans its blocks once. Watchpoints flag the pages
+ * they are in, and only stores into a flagged page are matched against
+ * the watched words; a match moves @debug_check to the next pc. The
+ * condition of a breakpoint is evaluated when the breakpoint is hit, not
+ * before.
+ */
+#define DEBUG_PAGE_SHIFT	12
+#define DEBUG_MAX_SCAN		256		/* Instructions scanned at once */
+#define DEBUG_SCAN_CACHE	256		/* Blocks whose scans are kept */
+#define MAX_BREAKPOINTS		64
+#define MAX_WATCHPOINTS		16
+
+struct breakpoint {
+	unsigned int pc;
+	int reg;					/* "if reg op value", -1 without a condition */
+	char op[3];
+	unsigned int value;
+	unsigned long long hits;
+};
+
+struct watchpoint {
+	unsigned int addr;			/* Word aligned */
+	unsigned int value;			/* As of the last store */
+};
+
+static unsigned char break_bitmap[CORE_MEMORY_SIZE / 4 / 8];
+static struct breakpoint breakpoints[MAX_BREAKPOINTS];
+static int nr_breakpoints = 0;
+static unsigned char watch_pages[CORE_MEMORY_SIZE >> DEBUG_PAGE_SHIFT];	/* Watchpoints in the page */
+static struct watchpoint watchpoints[MAX_WATCHPOINTS];
+static int nr_watchpoints = 0;
+
+static bool debug_armed = false;		/* Any breakpoint, watchpoint or step */
+static bool stepping = false;
+static unsigned long long step_left;
+static bool watch_fired = false;		/* by the last instruction */
+static unsigned int debug_check = ~0U;		/* Next pc for __debug_stop() to look at */
+static unsigned int debug_resume_pc = ~0U;	/* Stopped here, so do not stop again */
+static unsigned int scan_start[DEBUG_SCAN_CACHE];	/* Block start, ~0U if empty */
+static unsigned int scan_end[DEBUG_SCAN_CACHE];	/* and what __debug_scan() returned for it */
+
+static void __debug_update(void)
+{
+	debug_armed = nr_breakpoints || nr_watchpoints || stepping;
+	debug_check = core.pc;	//다음 명령어부터 다시 확인
+	memset(scan_start, 0xff, sizeof(scan_start));	//브레이크포인트가 바뀌면 다시 스캔
+}
+
+static bool __is_break(unsigned int pc)
+{
+	pc &= CORE_MEMORY_MASK;
+	return break_bitmap[pc >> 5] & (1 << ((pc >> 2) & 7));
+}
+
+static void __set_break(unsigned int pc, bool set)
+{
+	pc &= CORE_MEMORY_MASK;
+	if (set) break_bitmap[pc >> 5] |= 1 << ((pc >> 2) & 7);
+	else break_bitmap[pc >> 5] &= ~(1 << ((pc >> 2) & 7));
+}
+
+/* From the instruction at @pc, the next address to look at again */
+static unsigned int __debug_scan(unsigned int pc)
+{
+	unsigned int slot = (pc >> 2) % DEBUG_SCAN_CACHE;
+	unsigned int start = pc;
+
+	if (scan_start[slot] == pc) return scan_end[slot];
+
+	for (int i = 0; i < DEBUG_MAX_SCAN; i++, pc += 4) {
+		enum isa_id id = isa_decode(core_load_word(memory, pc));
+
+		if (isa_table[id].layout == LAYOUT_RT_RS_BOFF || isa_table[id].layout == LAYOUT_TARGET ||
+			id == ISA_JR || id == ISA_SYSCALL || id == ISA_HALT || id == ISA_INVALID) {
+			break;	/* The fall-through starts a new block */
+		}
+		if (__is_break(pc + 4)) break;
+	}
+	scan_start[slot] = start;
+	scan_end[slot] = pc + 4;
+	return pc + 4;
+}
+
+static bool __break_condition(struct breakpoint* b)
+{
+	unsigned int left;
+
+	if (b->reg < 0) return true;
+
+	left = core.registers[b->reg];
+	if (strcmp(b->op, "==") == 0) return left == b->value;
+	if (strcmp(b->op, "!=") == 0) return left != b->value;
+	if (strcmp(b->op, "<") == 0) return (int)left < (int)b->value;
+	if (strcmp(b->op, "<=") == 0) return (int)left <= (int)b->value;
+	if (strcmp(b->op, ">") == 0) return (int)left > (int)b->value;
+	return (int)left >= (int)b->value;
+}
+
+static struct breakpoint* __find_break(unsigned int pc)
+{
+	for (int i = 0; i < nr_breakpoints; i++) {
+		if (breakpoints[i].pc == pc) return &breakpoints[i];
+	}
+	return NULL;
+}
+
+static void __show_stop(const char* reason)
+{
+	char buffer[DISASM_MAX];
+	unsigned int instr = core_fetch(&core);
+
+	disasm(instr, core.pc, buffer);
+	fprintf(stderr, "%s at 0x%08x:  %08x    %s\n", reason, core.pc, instr, buffer);
+}
+
+/* Whether the run has to stop before the instruction at @pc == @debug_check */
+static bool __debug_stop(unsigned int pc)
+{
+	bool stop = false;
+
+	if (watch_fired) {
+		watch_fired = false;
+		stop = true;
+		__show_stop("Watchpoint");
+	}
+	else if (stepping && step_left-- == 0) {
+		stepping = false;
+		stop = true;
+		__show_stop("Stepped");
+	}
+	else {	//새 블록이거나 블록 안의 브레이크포인트
+		struct breakpoint* b = __is_break(pc) && pc != debug_resume_pc ? __find_break(pc) : NULL;
+
+		if (b && __break_condition(b)) {
+			b->hits++;
+			stop = true;
+			__show_stop("Breakpoint");
+		}
+	}
+
+	if (stop) {
+		debug_resume_pc = pc;
+		__debug_update();
+		return true;
+	}
+	debug_check = stepping ? pc + 4 : __debug_scan(pc);	//분기하면 process_instruction이 옮김
+	debug_resume_pc = ~0U;
+	return false;
+}
+
+/* Called for stores into a page with a watchpoint */
+static void __watch_store(const struct mips_retire* retire)
+{
+	unsigned int addr = retire->mem_addr & CORE_MEMORY_MASK;	/* Watchpoints are kept masked */
+
+	for (int i = 0; i < nr_watchpoints; i++) {
+		struct watchpoint* w = &watchpoints[i];
+		unsigned int value;
+
+		if (addr + retire->mem_size <= w->addr || addr >= w->addr + 4) continue;
+
+		value = core_load_word(memory, w->addr);
+		fprintf(stderr, "[0x%08x] 0x%08x -> 0x%08x by 0x%08x\n", w->addr, w->value, value, retire->pc);
+		w->value = value;
+		watch_fired = true;
+		debug_check = core.pc;	//다음 명령어 전에 멈춤
+	}
+}
+
+static void __break_command(int argc, char* argv[])
+{
+	unsigned int pc;
+	int reg = -1;
+	long value = 0;
+
+	if (argc == 1) {
+		for (int i = 0; i < nr_breakpoints; i++) {
+			const struct breakpoint* b = &breakpoints[i];
+
+			fprintf(stderr, "0x%08x", b->pc);
+			if (b->reg >= 0) fprintf(stderr, " if %s %s 0x%x", register_names[b->reg], b->op, b->value);
+			fprintf(stderr, ", %llu hits\n", b->hits);
+		}
+		return;
+	}
+	if (strcmp(argv[1], "clear") == 0 && argc <= 3) {
+		for (int i = nr_breakpoints - 1; i >= 0; i--) {
+			if (argc == 3 && breakpoints[i].pc != strtoumax(argv[2], NULL, 0)) continue;
+			__set_break(breakpoints[i].pc, false);
+			breakpoints[i] = breakpoints[--nr_breakpoints];
+		}
+		__debug_update();
+		return;
+	}
+	if ((argc != 2 && argc != 6) || (argc == 6 && (strcmp(argv[2], "if") != 0 ||
+		(reg = asm_register(argv[3])) < 0 || !asm_immediate(argv[5], &value) ||
+		!(strcmp(argv[4], "==") == 0 || strcmp(argv[4], "!=") == 0 || strcmp(argv[4], "<") == 0 ||
+		strcmp(argv[4], "<=") == 0 || strcmp(argv[4], ">") == 0 || strcmp(argv[4], ">=") == 0)))) {
+		printf("Usage: break [ pc [if register { == | != | < | <= | > | >= } value] | clear [pc] ]\n");
+		return;
+	}
+
+	pc = strtoumax(argv[1], NULL, 0) & CORE_MEMORY_MASK & ~3U;
+	if (!__find_break(pc)) {
+		if (nr_breakpoints == MAX_BREAKPOINTS) {
+			fprintf(stderr, "Too many breakpoints\n");
+			return;
+		}
+		breakpoints[nr_breakpoints++] = (struct breakpoint){ .pc = pc };
+	}
+	{
+		struct breakpoint* b = __find_break(pc);
+
+		b->reg = reg;
+		b->value = (unsigned int)value;
+		strcpy(b->op, reg >= 0 ? argv[4] : "");
+	}
+	__set_break(pc, true);
+	__debug_update();
+}
+
+static void __watch_command(int argc, char* argv[])
+{
+	unsigned int addr;
+
+	if (argc == 1) {
+		for (int i = 0; i < nr_watchpoints; i++) {
+			fprintf(stderr, "[0x%08x] 0x%08x\n", watchpoints[i].addr, watchpoints[i].value);
+		}
+		return;
+	}
+	if (strcmp(argv[1], "clear") == 0 && argc <= 3) {
+		for (int i = nr_watchpoints - 1; i >= 0; i--) {
+			if (argc == 3 && watchpoints[i].addr != (strtoumax(argv[2], NULL, 0) & CORE_MEMORY_MASK & ~3U)) continue;
+			watch_pages[watchpoints[i].addr >> DEBUG_PAGE_SHIFT]--;
+			watchpoints[i] = watchpoints[--nr_watchpoints];
+		}
+		__debug_update();
+		return;
+	}
+	if (argc != 2) {
+		printf("Usage: watch [ address | clear [address] ]\n");
+		return;
+	}
+	if (nr_watchpoints == MAX_WATCHPOINTS) {
+		fprintf(stderr, "Too many watchpoints\n");
+		return;
+	}
+
+	addr = strtoumax(argv[1], NULL, 0) & CORE_MEMORY_MASK & ~3U;
+	for (int i = 0; i < nr_watchpoints; i++) {
+		if (watchpoints[i].addr == addr) return;
+	}
+	watchpoints[nr_watchpoints++] = (struct watchpoint){ addr, core_load_word(memory, addr) };
+	watch_pages[addr >> DEBUG_PAGE_SHIFT]++;
+	__debug_update();
+}
+
+static void __step_command(int argc, char* argv[])
+{
+	if (argc > 2) {
+		printf("Usage: step [number of instructions]\n");
+		return;
+	}
+
+	step_left = argc == 2 ? strtoull(argv[1], NULL, 0) : 1;
+	stepping = true;
+	__debug_update();
+	resume_program();
+
+	stepping = false;	//halt로 끝났을 수도 있음
+	__debug_update();
+}
 
 static void __show_registers(char* const register_name)
 {
@@ -118,16 +782,16 @@ static void __show_registers(char* const register_name)
 	}
 
 	for (int i = from; i < to; i++) {
-		fprintf(stderr, "[%02d:%2s] 0x%08x    %u\n", i, register_names[i], registers[i], registers[i]);
+		fprintf(stderr, "[%02d:%2s] 0x%08x    %u\n", i, register_names[i], core.registers[i], core.registers[i]);
 	}
 	if (include_pc) {
-		fprintf(stderr, "[  pc ] 0x%08x\n", pc);
+		fprintf(stderr, "[  pc ] 0x%08x\n", core.pc);
 	}
 	if (include_hi) {
-		fprintf(stderr, "[  hi ] 0x%08x    %u\n", hi, hi);
+		fprintf(stderr, "[  hi ] 0x%08x    %u\n", core.hi, core.hi);
 	}
 	if (include_lo) {
-		fprintf(stderr, "[  lo ] 0x%08x    %u\n", lo, lo);
+		fprintf(stderr, "[  lo ] 0x%08x    %u\n", core.lo, core.lo);
 	}
 }
 
@@ -145,6 +809,18 @@ static void __dump_memory(unsigned int addr, size_t length)
 	}
 }
 
+static void __disasm_memory(unsigned int addr, size_t length)
+{
+	char buffer[DISASM_MAX];
+
+	for (size_t i = 0; i < length; i += 4) {
+		unsigned int instr = (memory[addr + i] << 24) | (memory[addr + i + 1] << 16) |
+			(memory[addr + i + 2] << 8) | memory[addr + i + 3];
+		disasm(instr, addr + i, buffer);
+		fprintf(stderr, "0x%08lx:  %08x    %s\n", addr + i, instr, buffer);
+	}
+}
+
 static void __process_command(int argc, char* argv[])
 {
 	if (argc == 0) return;
@@ -185,53 +861,87 @@ static void __process_command(int argc, char* argv[])
 			printf("Usage: dump [start address] [length]\n");
 		}
 	}
-	else {
-		unsigned int instr = strtoumax(argv[0], NULL, 0);
-
-		if (!instr) {
-			instr = translate(argc, argv);
+	else if (strcmp(argv[0], "disasm") == 0) {
+		if (argc == 3) {
+			__disasm_memory(strtoumax(argv[1], NULL, 0), strtoumax(argv[2], NULL, 0));
+		}
+		else {
+			printf("Usage: disasm [start address] [length]\n");
 		}
-		process_instruction(instr);
 	}
-}
-
-static int __parse_command(char* command, int* nr_tokens, char* tokens[])
-{
-	char* curr = command;
-	int token_started = false;
-	*nr_tokens = 0;
-
-	while (*curr != '\0') {
-		if (isspace(*curr)) {
-			*curr = '\0';
-			token_started = false;
+	else if (strcmp(argv[0], "trace") == 0) {
+		if (argc == 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+			trace_enabled = strcmp(argv[1], "on") == 0;
 		}
 		else {
-			if (!token_started) {
-				tokens[*nr_tokens] = curr;
-				*nr_tokens += 1;
-				token_started = true;
-			}
+			printf("Usage: trace { on | off }\n");
+		}
+	}
+	else if (strcmp(argv[0], "memtrace") == 0) {
+		__memtrace_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "profile") == 0) {
+		__profile_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "interval") == 0) {
+		__interval_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "replay") == 0) {
+		__replay_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "break") == 0) {
+		__break_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "watch") == 0) {
+		__watch_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "step") == 0) {
+		__step_command(argc, argv);
+	}
+	else if (strcmp(argv[0], "continue") == 0) {
+		if (argc == 1) {
+			resume_program();
+		}
+		else {
+			printf("Usage: continue\n");
 		}
-		curr++;
 	}
+	else {
+		unsigned int instr;
+		char* end;
 
-	/* Exclude comments from tokens */
-	for (int i = 0; i < *nr_tokens; i++) {
-		if (strncmp(tokens[i], "//", 2) == 0 || strncmp(tokens[i], "#", 1) == 0) {
-			*nr_tokens = i;
-			tokens[i] = NULL;
+		if (asm_lookup(argv[0]) == ISA_INVALID) {	//기계어로 입력한 경우
+			instr = strtoumax(argv[0], &end, 0);
+			if (end == argv[0] || *end) {
+				fprintf(stderr, "Unable to translate %s\n", argv[0]);
+				return;
+			}
+		}
+		else if (!(instr = translate(argc, argv)) && !__translate(argc, argv, &instr)) {	//0은 sll zero zero 0일 수도 있음
+			fprintf(stderr, "Unable to translate %s\n", argv[0]);
+			return;
 		}
+		process_instruction(instr);
 	}
+}
+
+static int __parse_command(struct arena* arena, char* command, int* nr_tokens, char** tokens[])
+{
+	/* Characters are converted to lower-cases and comments are excluded */
+	*nr_tokens = tokenize(arena, command, TOKENIZE_LOWER | TOKENIZE_COMMENTS, tokens);
 
 	return 0;
 }
 
 int main(int argc, char* const argv[])
 {
-	char command[MAX_COMMAND] = { '\0' };
+	struct arena arena = { NULL };	/* Memory for the current command line */
+	char* command;
 	FILE* input = stdin;
 
+	__replay_init();
+	syscall_init(&syscalls, HEAP_START, CORE_MEMORY_SIZE);
+
 	if (argc > 1) {
 		input = fopen(argv[1], "r");
 		if (!input) {
@@ -248,23 +958,30 @@ int main(int argc, char* const argv[])
 		printf(">> ");
 	}
 
-	while (fgets(command, sizeof(command), input)) {
-		char* tokens[MAX_NR_TOKENS] = { NULL };
+	while ((command = arena_getline(&arena, input))) {
+		char** tokens;
 		int nr_tokens = 0;
 
-		for (size_t i = 0; i < strlen(command); i++) {
-			command[i] = tolower(command[i]);
-		}
+		if (replay.recording) replay_record(&replay, REPLAY_COMMAND, command, strlen(command));
 
-		if (__parse_command(command, &nr_tokens, tokens) < 0)
+		if (__parse_command(&arena, command, &nr_tokens, &tokens) < 0) {
+			arena_reset(&arena);
 			continue;
+		}
 
 		__process_command(nr_tokens, tokens);
 
+		arena_reset(&arena);
+
 		if (input == stdin) printf(">> ");
 	}
+	arena_destroy(&arena);
 
 	if (input != stdin) fclose(input);
+	memtrace_close(&memtrace);
+	interval_close(&interval, interval_instructions, interval_counts);
+	syscall_close(&syscalls);
+	replay_close(&replay);
 
 	return EXIT_SUCCESS;
 }
@@ -273,21 +990,80 @@ int main(int argc, char* const argv[])
 /*====================================================================*/
 
 
+/**
+ * Lines that have been translated already. Command scripts tend to repeat
+ * the same assembly (loops unrolled by hand, setup blocks), so each line is
+ * hashed and the translation is looked up before assembling it again.
+ */
+#define NR_ASM_CACHE	1024
+
+static struct {
+	unsigned int hash;
+	unsigned int instr;
+	char line[MAX_COMMAND];
+} asm_cache[NR_ASM_CACHE];
+
 /**********************************************************************
  * translate(nr_tokens, tokens[])
  *
  * DESCRIPTION
- *   Translate the given assembly to a MIPS instruction. This is optional
- *   so you may copy-paste your translation feature from PA1 or just leave
- *   it as is.
+ *   Translate the given assembly to a MIPS instruction. The translation is
+ *   done by the assembler shared with PA1 (common/asm.h), and the result
+ *   is remembered in @asm_cache per line.
  *
  * RETURN VALUE
  *   MIPS instruction for the given assembly
- *   0 if translation is not possible
+ *   0 if translation is not possible; __translate() tells that apart from
+ *   "sll zero zero 0"
  */
 static unsigned int translate(int nr_tokens, char* tokens[])
 {
-	return 0;
+	unsigned int instr;
+
+	return __translate(nr_tokens, tokens, &instr) ? instr : 0;
+}
+
+static bool __translate(int nr_tokens, char* tokens[], unsigned int* instr)
+{
+	char line[MAX_COMMAND];
+	size_t len = 0;
+	unsigned int hash = 2166136261u;	/* FNV-1a */
+
+	for (int i = 0; i < nr_tokens; i++) {
+		for (const char* c = tokens[i]; *c && len < sizeof(line) - 1; c++) {
+			line[len++] = *c;
+			hash = (hash ^ (unsigned char)*c) * 16777619u;
+		}
+		if (len < sizeof(line) - 1) {
+			line[len++] = ' ';
+			hash = (hash ^ ' ') * 16777619u;
+		}
+	}
+	line[len] = '\0';
+
+	if (len == sizeof(line) - 1) {	/* Too long to be a key */
+		return assemble(nr_tokens, tokens, instr);
+	}
+
+	if (asm_cache[hash % NR_ASM_CACHE].hash == hash &&
+		strcmp(asm_cache[hash % NR_ASM_CACHE].line, line) == 0) {
+		*instr = asm_cache[hash % NR_ASM_CACHE].instr;
+		return true;
+	}
+
+	if (!assemble(nr_tokens, tokens, instr)) return false;
+
+	asm_cache[hash % NR_ASM_CACHE].hash = hash;
+	asm_cache[hash % NR_ASM_CACHE].instr = *instr;
+	memcpy(asm_cache[hash % NR_ASM_CACHE].line, line, len + 1);
+	return true;
+}
+
+static void __unknown_instruction(unsigned int instr, const struct mips_retire* retire)
+{
+	if (retire->id == ISA_INVALID && (instr >> 26) == 0) {	//funct가 없는 R-format
+		printf("없는 명령어 입력함\n");
+	}
 }
 
 
@@ -322,271 +1098,55 @@ static unsigned int translate(int nr_tokens, char* tokens[])
  * | `j`    | j-format* | 0x02                    |
  * | `jal`  | j-format* | 0x03                    |
  *
+ *   The semantics are implemented in core_execute() (common/core.h), which
+ *   is shared with the multi-core simulator and the pa3 checker. It also
+ *   covers `mult`, `mfhi`, `mflo`, `lbu`, `ll`, `sc`, `halt` and `syscall`,
+ *   whose services are in common/syscall.h, and the packed-SIMD extension
+ *   of common/isa.h (opcode 0x1c + funct, `lq` 0x36 and `sq` 0x3e).
+ *
  * RETURN VALUE
  *   true if successfully processed the instruction.
  *   false if @instr is unknown instructions
  */
-static bool process_instruction(unsigned int instr) {
-	unsigned int opcode = instr >> 26; //opcode 추출
-	unsigned int funct = instr & 0x3F; //funct 추출
-
-	if (opcode == 0x00) { // R-format 명령어
-
-		switch (funct) {
-		case 0x20: // add
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = registers[rs] + registers[rt];
-			break;
-		}
-		case 0x22: // sub
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = registers[rs] - registers[rt];
-			break;
-		}
-		case 0x24:	//and
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = registers[rs] & registers[rt];
-			break;
-		}
-		case 0x25:	//or
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = registers[rs] | registers[rt];
-			break;
-		}
-		case 0x27:	//nor
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = ~(registers[rs] | registers[rt]);
-			break;
-		}
-		case 0x00:	//sll
-		{
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			unsigned int shamt = (instr >> 6) & 0x1F;	//shamt 추출
-			registers[rd] = registers[rt] << shamt;	//왼쪽으로 쉬프트
-			break;
-		}
-		case 0x02:	//srl
-		{
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			unsigned int shamt = (instr >> 6) & 0x1F;	//shamt 추출
-			registers[rd] = registers[rt] >> shamt;	//오른쪽으로 쉬프트
-			break;
-		}
-		case 0x03:	//sra
-		{
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			unsigned int shamt = (instr >> 6) & 0x1F;	//shamt 추출
-			registers[rd] = (int)registers[rt] >> shamt;	//오른쪽으로 산술쉬프트
-			break;
-		}
-		case 0x2a:	//slt
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			if (((int)registers[rs] & 0x80000000) != ((int)registers[rt] & 0x80000000)) { //부호가 다른 경우
-				if ((int)registers[rs] & 0x80000000) {	//rs가 음수이면 더작음
-					registers[rd] = 1;
-				}
-				else {
-					registers[rd] = 0;
-				}
-			}
-			else { //부호가 같은 경우
-				if ((int)registers[rs] < (int)registers[rt]) {
-					registers[rd] = 1;
-				}
-				else {
-					registers[rd] = 0;
-				}
-			}
-			break;
-		}
-		case 0x18:	//mult
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int64_t result = (int64_t)registers[rs] * (int64_t)registers[rt];	//64비트로 확장
-			hi = (unsigned int)(result >> 32);	//MSB 저장
-			lo = (unsigned int)result;	//LSB 저장
-			break;
-		}
-		case 0x10:	//mfhi
-		{
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = hi;
-			break;
-		}
-		case 0x12:	//mflo
-		{
-			unsigned int rd = (instr >> 11) & 0x1F;	//rd 추출
-			registers[rd] = lo;
-			break;
-		}
-		case 0x08:	//jr
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			pc = registers[rs];  //PC <= rs
-			break;
-		}
-		default:
-		{
-			printf("없는 명령어 입력함\n");
-			return false;
-		}
-		}
-		return true;
-	}
-	else {	//I, J format 명령어
-		switch (opcode) {
-		case 0x08: //addi
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			short cons = (short)(instr & 0xFFFF);	//con 추출
-			registers[rt] = registers[rs] + (int)cons;  // rs와 상수 값을 더하여 rt에 저장
-			break;
-		}
-		break;
-		case 0x0c: //andi
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int cons = (int)(instr & 0xFFFF);	//con 추출
-			registers[rt] = registers[rs] & cons;
-			break;
-		}
-		case 0x0d: //ori
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int cons = (int)(instr & 0xFFFF);	//con 추출
-			registers[rt] = registers[rs] | cons;
-			break;
-		}
-		case 0x23: //lw
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			unsigned int offset = instr & 0xFFFF;	//offset 추출
-			unsigned address = registers[rs] + offset;
-			int data = (memory[address] << 24) | (memory[address + 1] << 16) | (memory[address + 2] << 8) | memory[address + 3];
-			registers[rt] = data;
-			break;
-		}
-		case 0x2b: //sw
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int offset = (instr & 0xFFFF);	//offset 추출
-			if (offset & 0x8000) {	//offset이 음수일 경우
-				offset |= 0xFFFF0000;
-			}
-			// 메모리에 데이터 저장
-			memory[registers[rs] + offset] = (registers[rt] >> 24) & 0xFF;	//상위 8비트
-			memory[registers[rs] + offset + 1] = (registers[rt] >> 16) & 0xFF;	//다음 8비트
-			memory[registers[rs] + offset + 2] = (registers[rt] >> 8) & 0xFF;	//다음 8비트
-			memory[registers[rs] + offset + 3] = registers[rt] & 0xFF;	//하위 8비트
-			break;
-		}
-		case 0x04: //beq
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;    //rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;    //rt 추출
-			int offset = (instr & 0xFFFF);             //오프셋 추출
-			if (offset & 0x8000) {	//음수일 경우
-				offset = offset | 0xFFFF0000;
-			}
-			if (registers[rs] == registers[rt]) {
-				pc = pc + (offset << 2); //점프
-			}
-			break;
-		}
-		case 0x05: //bne
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int offset = (instr & 0xFFFF);	//오프셋 추출
-			if (offset & 0x8000) {	//음수일 경우
-				offset = offset | 0xFFFF0000;
-			}
-			if (registers[rs] != registers[rt]) {
-				pc = pc + (offset << 2); //점프
-			}
-			break;
-		}
-		case 0x0a: //slti
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int cons = (int)(instr & 0xFFFF);	//cons 추출
-			if (cons & 0x8000) {	//음수일 경우
-				cons |= 0xFFFF0000;
-			}
-			if ((int)registers[rs] < cons) {
-				registers[rt] = 1;
-			}
-			else {
-				registers[rt] = 0;
+static bool process_instruction(unsigned int instr)
+{
+	struct mips_retire retire;
+
+	if (core_execute(&core, instr, &retire)) {
+		if (memtrace.file && retire.mem_size) {	//데이터 접근만 기록, fetch는 resume_program에서
+			//lq/sq는 워드마다 하나씩 기록
+			for (unsigned int offset = 0; offset < retire.mem_size; offset += 4) {
+				memtrace_ref(&memtrace, retire.mem_store ? MEMTRACE_STORE : MEMTRACE_LOAD, retire.mem_addr + offset);
 			}
-			break;
 		}
-		case 0x24: //lbu
-		{
-			unsigned int rs = (instr >> 21) & 0x1F;	//rs 추출
-			unsigned int rt = (instr >> 16) & 0x1F;	//rt 추출
-			int offset = (instr & 0xFFFF);	//오프셋 추출
-			if (offset & 0x8000) {
-				offset |= 0xFFFF0000;
+		if (interval.file) __interval_retire(&retire);
+		if (debug_armed) {
+			if (retire.taken) debug_check = core.pc;	//새 블록에서 브레이크포인트 확인
+			if (retire.mem_store && watch_pages[(retire.mem_addr & CORE_MEMORY_MASK) >> DEBUG_PAGE_SHIFT]) {
+				__watch_store(&retire);
 			}
-			registers[rt] = memory[registers[rs] + offset];
-			break;
-		}
-		case 0x02: //j
-		{
-			unsigned int ta = instr & 0x03FFFFFF; //하위 26비트 추출
-			pc = (pc & 0xF0000000) | (ta << 2); //상위 4비트는 현재 PC의 상위 4비트와 동일하게 유지되어야 함
-			break;
-		}
-		case 0x03: //jal
-		{
-			unsigned int ta = instr & 0x03FFFFFF; //하위 26비트 추출
-			registers[31] = pc; //ra <- pc
-			pc = (pc & 0xF0000000) | (ta << 2);	//상위 4비트는 현재 PC의 상위 4비트와 동일하게 유지되어야 함
-			break;
-		}
-		case 0x3f: //halt
-		{
-			return false;
-		}
-		default:
-		{
-			return false;
-		}
 		}
 		return true;
 	}
+
+	__unknown_instruction(instr, &retire);
 	return false;
 }
 
+/* Without any instrumentation, nothing but the instructions runs */
+static void __run_plain(void)
+{
+	struct mips_retire retire;
+	unsigned int instr;
+
+	do {
+		instr = core_fetch(&core);
+		core.pc += 4;
+	} while (core_execute(&core, instr, &retire));
+
+	__unknown_instruction(instr, &retire);
+}
+
 /**********************************************************************
  * load_program(start_addr, filename)
  *
@@ -603,11 +1163,10 @@ static bool process_instruction(unsigned int instr) {
  *   0x8c080000 # this is also a comment
  *
  *   implies three MIPS instructions to load. Each machine instruction may
- *   be followed by comments like the second instruction. Hint: that you can
- *   simply call strtoumax(linebuffer, NULL, 0) to read the machine code while
- *   ignoring the comment parts.
- *
- *	 Refer to the @main() for reading data from files. (fopen, fgets, fclose).
+ *   be followed by comments like the second instruction. A line may also
+ *   be written in assembly (e.g., "addi t0 zero 5"), which is translated
+ *   while loading. The actual loading is done by load_image() in
+ *   common/loader.h so that the other simulators accept the same files.
  *
  * RETURN
  *	 Number of successfully loaded instructions
@@ -615,18 +1174,34 @@ static bool process_instruction(unsigned int instr) {
  */
 static unsigned int load_program(unsigned int start_addr, char* const filename)
 {
-	FILE* file = fopen(filename, "r"); //파일 열기
-	unsigned int addr = start_addr; //시작 주소 설정
-	char line[MAX_COMMAND];
+	unsigned char* before = NULL;
+	int nr_insts;
+
+	if (replaying) {	//파일 대신 로그에 기록된 이미지를 올림
+		if (replay_read(&replay) != REPLAY_IMAGE) {
+			__replay_diverged();
+			return 0;
+		}
+		nr_insts = replay_apply_image(&replay, memory);
+	}
+	else {
+		if (replay.recording) {	//이미지는 로드 전 메모리와의 차이로 기록
+			if (!(before = malloc(CORE_MEMORY_SIZE))) {
+				fprintf(stderr, "Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			memcpy(before, memory, CORE_MEMORY_SIZE);
+		}
+		nr_insts = load_image(memory, start_addr, filename);	//common/loader.h (mc, bench와 같은 로더)
+		if (before) replay_record_image(&replay, nr_insts, memory, before);
+		free(before);
+	}
 
-	while (fgets(line, sizeof(line), file)) {
-		unsigned int instr = strtoul(line, NULL, 16); //명령어 16진수로 변환
-		instr = ((instr & 0xFF) << 24) | ((instr & 0xFF00) << 8) | ((instr >> 8) & 0xFF00) | ((instr >> 24) & 0xFF);	//빅엔디안 방식 저장을 위한 비트마스킹
-		*(unsigned int*)&memory[addr] = instr;
-		addr += 4; //메모리 다음줄 이동
+	if (nr_insts < 0) {
+		fprintf(stderr, "No input file %s\n", filename);
+		return 0;
 	}
-	fclose(file); //파일 닫기
-	return (addr - start_addr) / 4;	//입력된 명령어 개수 반환
+	return nr_insts;	//입력된 명령어 개수 반환
 }
 
 /**********************************************************************
@@ -646,12 +1221,57 @@ static unsigned int load_program(unsigned int start_addr, char* const filename)
  */
 static void run_program(void)
 {
-	pc = ENTRY_PC;
-	while (true) {
-		unsigned int instr = memory[pc + 3] | (memory[pc + 2] << 8) | (memory[pc + 1] << 16) | (memory[pc] << 24);	//빅엔디안으로 명령어불러오기
-		pc += 4;	//pc에 4더해줌(다음 명령어로 이동)
-		if (process_instruction(instr) == false) { //명령어 실행(halt를 만나면 프로그램 종료)
-			break;
+	core.pc = ENTRY_PC;
+	if (profile_enabled) profile_rewind(&profile);
+	resume_program();
+}
+
+/**
+ * Run from @core.pc until halt, or until the replay stops in the middle.
+ * The state is hashed into (or checked against) the log at the end.
+ */
+static void resume_program(void)
+{
+	syscalls.replay = (replay.recording || replaying) ? &replay : NULL;	//입력은 로그를 거침
+
+	__debug_update();	//재개하는 위치도 새 블록, 그 사이 load로 코드가 바뀌었을 수 있음
+
+	if (!debug_armed && !trace_enabled && !profile_enabled && !memtrace.file && !interval.file &&
+		replay_event == ~0ULL) {
+		__run_plain();
+	}
+	else while (true) {
+		unsigned int instr;
+		bool running;
+
+		if (debug_armed && core.pc == debug_check && __debug_stop(core.pc)) {
+			if (trace_enabled) __flush_trace();
+			syscall_flush(&syscalls);
+			return;
 		}
+
+		instr = core_fetch(&core);	//빅엔디안으로 명령어불러오기
+		if (trace_enabled) __trace_instruction(core.pc, instr);
+		if (profile_enabled) profile_retire(&profile, core.pc, instr);
+		if (memtrace.file) memtrace_ref(&memtrace, MEMTRACE_FETCH, core.pc);
+		core.pc += 4;	//pc에 4더해줌(다음 명령어로 이동)
+		running = process_instruction(instr);	//명령어 실행(halt를 만나면 프로그램 종료)
+
+		if (replay_event != ~0ULL && ++replay.count >= replay_event && __replay_event(!running)) {
+			if (trace_enabled) __flush_trace();
+			syscall_flush(&syscalls);
+			return;
+		}
+		if (!running) break;
+	}
+	if (trace_enabled) __flush_trace();
+	syscall_flush(&syscalls);	//모아둔 출력을 한 번에 내보냄
+
+	if (replay.recording || replaying) {	//실행이 끝난 상태도 기록하거나 확인
+		unsigned int regs[NR_REPLAY_REGS];
+
+		__replay_get_regs(regs);
+		if (!replay_state(&replay, regs, NR_REPLAY_REGS, memory)) __replay_diverged();
+		__replay_update_event();
 	}
 }
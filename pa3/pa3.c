@@ -14,8 +14,15 @@
  **********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "types.h"
+#include "../common/disasm.h"
+#include "../common/interval.h"
+#include "../common/profile.h"
+#include "../common/replay.h"
+#include "../common/syscall.h"
 
  /***
   * External entities in other files.
@@ -60,10 +67,430 @@ extern void make_stall(int stage, int cycles);
  * | `jr`   | r-format | 0 + 0x08                |
  * | `j`    | j-format | 0x02                    |
  * | `jal`  | j-format | 0x03                    |
+ * | `syscall` | r-format | 0 + 0x0c             |
+ * | `paddb` ... `pmaxsh` | 0x1c + funct    | packed SIMD, see common/isa.h |
+ * | `lq`   | i-format | 0x36                    |
+ * | `sq`   | i-format | 0x3e                    |
  */
 
+/**
+ * Print retired instructions when PA3_TRACE is set in the environment
+ */
+static void __trace_retire(unsigned int addr, unsigned int instr)
+{
+	static int trace = -1;
+	char buffer[DISASM_MAX];
+
+	if (trace < 0) trace = getenv("PA3_TRACE") != NULL;
+	if (!trace) return;
+
+	disasm(instr, addr, buffer);
+	fprintf(stderr, "0x%08x:  %08x    %s\n", addr, instr, buffer);
+}
+
+/**
+ * Guest profile when PA3_PROFILE is set to flat, tree or folded. The report
+ * goes to PA3_PROFILE_OUT (stderr by default) at exit, and PA3_PROFILE_PERIOD
+ * counts one in that many instructions. See common/profile.h
+ */
+static struct profile* profile = NULL;
+
+static void __profile_report(void)
+{
+	const char* mode = getenv("PA3_PROFILE");
+	const char* filename = getenv("PA3_PROFILE_OUT");
+	FILE* out = filename ? fopen(filename, "w") : stderr;
+
+	if (!out) {
+		fprintf(stderr, "Unable to open %s\n", filename);
+		return;
+	}
+
+	if (strcmp(mode, "tree") == 0) {
+		profile_report_tree(profile, out);
+	}
+	else if (strcmp(mode, "folded") == 0) {
+		profile_report_folded(profile, out);
+	}
+	else {
+		profile_report_flat(profile, memory, out, 20);
+	}
+
+	if (out != stderr) fclose(out);
+}
+
+static struct profile* __profile(void)
+{
+	static int enabled = -1;
+	static struct profile __profile;
+
+	if (enabled < 0) {
+		const char* period = getenv("PA3_PROFILE_PERIOD");
+
+		enabled = getenv("PA3_PROFILE") != NULL;
+		if (enabled) {
+			profile_init(&__profile, 0, period ? strtoul(period, NULL, 0) : 1);
+			profile = &__profile;
+			atexit(__profile_report);
+		}
+	}
+	return profile;
+}
+
+static void __profile_retire(unsigned int addr, unsigned int instr)
+{
+	if (!__profile()) return;
+
+	if (!profile->instructions) profile->nodes[0].entry = addr;	//첫 명령어가 프로그램 시작점
+	profile_retire(profile, addr, instr);
+}
+
+static void __profile_stall(unsigned int addr, int cycles)
+{
+	if (__profile()) profile_stall(profile, addr, cycles);
+}
+
+/**
+ * Interval statistics when PA3_INTERVAL is set to a file: every
+ * PA3_INTERVAL_PERIOD cycles (10000 by default) a CSV line of what the
+ * pipeline did in them, see common/interval.h.
+ */
+enum interval_counter {
+	INTERVAL_INSTRUCTIONS = 0,
+	INTERVAL_LOADS,
+	INTERVAL_STORES,
+	INTERVAL_BRANCHES,
+	INTERVAL_TAKEN,
+	INTERVAL_JUMPS,
+	INTERVAL_CONTROL_STALLS,	/* Cycles IF waited for branches and jumps */
+	INTERVAL_SYSCALL_STALLS,
+	INTERVAL_MEM_STALLS,		/* Second beats of lq/sq */
+	NR_INTERVAL_COUNTERS,
+};
+
+static const char* const interval_names[NR_INTERVAL_COUNTERS] = {
+	"instructions", "loads", "stores", "branches", "taken", "jumps", "control_stalls", "syscall_stalls",
+	"mem_stalls",
+};
+
+static const struct interval_ratio interval_ratios[] = {
+	{ "IPC", INTERVAL_INSTRUCTIONS, -1 },
+	{ "taken_rate", INTERVAL_TAKEN, INTERVAL_BRANCHES },
+};
+
+static int interval_enabled = -1;
+static struct interval interval;
+static unsigned long long interval_cycles;
+static unsigned long long interval_counts[NR_INTERVAL_COUNTERS];
+
+static void __interval_exit(void)
+{
+	interval_close(&interval, interval_cycles, interval_counts);
+}
+
+static void __interval_retire(const struct instruction* instr)
+{
+	interval_counts[INTERVAL_INSTRUCTIONS]++;
+	if (instr->format == j_format || (instr->format == r_format && instr->r_format.funct == 0x08)) {
+		interval_counts[INTERVAL_JUMPS]++;
+	}
+	else if (instr->format == i_format) {
+		switch (instr->opcode) {
+		case 0x23:	//lw
+		case 0x36:	//lq
+			interval_counts[INTERVAL_LOADS]++;
+			break;
+		case 0x2b:	//sw
+		case 0x3e:	//sq
+			interval_counts[INTERVAL_STORES]++;
+			break;
+		case 0x04:	//beq
+		case 0x05:	//bne
+			interval_counts[INTERVAL_BRANCHES]++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* Called at the beginning of every cycle */
+static void __interval_cycle(void)
+{
+	if (interval_enabled < 0) {
+		const char* filename = getenv("PA3_INTERVAL");
+		const char* period = getenv("PA3_INTERVAL_PERIOD");
+
+		interval_enabled = filename != NULL;
+		if (!interval_enabled) return;
+
+		if (!interval_open(&interval, filename, period ? strtoull(period, NULL, 0) : 10000, "cycles",
+			interval_names, NR_INTERVAL_COUNTERS, interval_ratios, sizeof(interval_ratios) / sizeof(interval_ratios[0]))) {
+			fprintf(stderr, "Unable to open %s\n", filename);
+			exit(EXIT_FAILURE);
+		}
+		atexit(__interval_exit);
+	}
+	if (!interval_enabled) return;
+
+	if (interval_cycles >= interval.next) interval_sample(&interval, interval_cycles, interval_counts);
+	interval_cycles++;
+}
+
+static inline void __interval_count(enum interval_counter counter, unsigned int n)
+{
+	if (interval_enabled > 0) interval_counts[counter] += n;
+}
+
+/**
+ * Lockstep co-simulation when PA3_COSIM is set. The functional core of pa2
+ * (common/core.h) starts from the state at the first IF_stage() and executes
+ * one instruction whenever WB_stage() retires one. The first retirement
+ * whose pc, register write or store differs from the reference stops the
+ * simulation with the recent history and the register file of both.
+ */
+#define COSIM_HISTORY	16
+
+static int cosim_enabled = -1;
+static struct mips_core cosim;
+static unsigned char cosim_memory[CORE_MEMORY_SIZE];
+static struct mips_retire cosim_history[COSIM_HISTORY];
+static unsigned long long cosim_retired = 0;
+
+static struct syscalls* __syscalls(void);
+
+/**
+ * The reference does not do I/O again. WB_stage() has carried out the
+ * syscall already, so take its result and the input it put into memory.
+ */
+static bool __cosim_syscall(struct mips_core* core, void* data)
+{
+	struct syscalls* sys = __syscalls();
+
+	(void)data;
+	core->registers[2] = registers[2];
+	if (sys->input_len) {
+		memcpy(core->memory + (sys->input_addr & CORE_MEMORY_MASK), memory + (sys->input_addr & CORE_MEMORY_MASK),
+			sys->input_len);
+	}
+	return !sys->exited;
+}
+
+static void __cosim_start(void)
+{
+	if (cosim_enabled >= 0) return;
+
+	cosim_enabled = getenv("PA3_COSIM") != NULL;
+	if (!cosim_enabled) return;
+
+	memcpy(cosim_memory, memory, CORE_MEMORY_SIZE);
+	memcpy(cosim.registers, registers, sizeof(cosim.registers));
+	cosim.pc = pc;
+	cosim.memory = cosim_memory;
+	cosim.syscall = __cosim_syscall;
+}
+
+static void __cosim_diverged(const struct mips_retire* retire, const char* fmt, unsigned int expected,
+	unsigned int actual)
+{
+	char buffer[DISASM_MAX];
+	unsigned long long from = cosim_retired > COSIM_HISTORY ? cosim_retired - COSIM_HISTORY : 0;
+
+	fprintf(stderr, "\ncosim: divergence at instruction #%llu\n", cosim_retired);
+	disasm(retire->instr, retire->pc, buffer);
+	fprintf(stderr, "  0x%08x:  %08x    %s\n  ", retire->pc, retire->instr, buffer);
+	fprintf(stderr, fmt, expected, actual);
+
+	fprintf(stderr, "\nLast retired instructions (reference):\n");
+	for (unsigned long long i = from; i < cosim_retired; i++) {
+		const struct mips_retire* r = &cosim_history[i % COSIM_HISTORY];
+
+		disasm(r->instr, r->pc, buffer);
+		fprintf(stderr, "  #%-8llu 0x%08x:  %08x    %-28s", i, r->pc, r->instr, buffer);
+		if (r->write_reg > 0) fprintf(stderr, " %s=0x%08x", isa_register_names[r->write_reg], r->write_value);
+		if (r->mem_store) fprintf(stderr, " [0x%08x]=0x%08x", r->mem_addr, r->mem_value);
+		fprintf(stderr, "\n");
+	}
+
+	fprintf(stderr, "\nRegisters that differ (younger instructions in flight may have written some):\n");
+	for (int i = 0; i < 32; i++) {
+		if (cosim.registers[i] == registers[i]) continue;
+		fprintf(stderr, "  [%02d:%-4s] reference 0x%08x, pipeline 0x%08x\n",
+			i, isa_register_names[i], cosim.registers[i], registers[i]);
+	}
+
+	exit(EXIT_FAILURE);
+}
+
+/* Check the instruction WB_stage() has just retired against the reference */
+static void __cosim_retire(unsigned int addr, unsigned int instr)
+{
+	struct mips_retire retire;
+
+	if (cosim_enabled <= 0) return;
+
+	retire.pc = cosim.pc;
+	retire.instr = core_fetch(&cosim);
+
+	if (cosim.pc != addr) {
+		__cosim_diverged(&retire, "pc: expected 0x%08x, retired 0x%08x\n", cosim.pc, addr);
+	}
+	if (retire.instr != instr) {
+		__cosim_diverged(&retire, "instruction: expected %08x, retired %08x\n", retire.instr, instr);
+	}
+
+	cosim.pc += 4;
+	if (!core_execute(&cosim, instr, &retire)) {
+		if (retire.id == ISA_HALT) return;
+		__cosim_diverged(&retire, "unknown instruction %08x (%08x)\n", instr, instr);
+	}
+
+	if (retire.write_reg > 0 && registers[retire.write_reg] != retire.write_value) {
+		cosim.registers[retire.write_reg] = retire.write_value;
+		__cosim_diverged(&retire, "register write: expected 0x%08x, got 0x%08x\n",
+			retire.write_value, registers[retire.write_reg]);
+	}
+	for (unsigned int i = 1; retire.id == ISA_LQ && i < 4; i++) {	//lq의 나머지 세 레지스터
+		unsigned int reg = ISA_RT(instr) + i;
+
+		if (reg && registers[reg] != cosim.registers[reg]) {
+			__cosim_diverged(&retire, "register write: expected 0x%08x, got 0x%08x\n",
+				cosim.registers[reg], registers[reg]);
+		}
+	}
+	for (unsigned int offset = 0; retire.mem_store && offset < retire.mem_size; offset += 4) {	//sq는 16바이트
+		unsigned int store_addr = retire.mem_addr + offset;
+
+		if (core_load_word(memory, store_addr) != core_load_word(cosim_memory, store_addr)) {
+			__cosim_diverged(&retire, "store: expected 0x%08x, memory has 0x%08x\n",
+				core_load_word(cosim_memory, store_addr), core_load_word(memory, store_addr));
+		}
+	}
+
+	cosim_history[cosim_retired++ % COSIM_HISTORY] = retire;
+}
+
+/**
+ * Record and replay, see common/replay.h. With PA3_RECORD set to a file,
+ * the program image and the registers at the first cycle, and the state
+ * every PA3_REPLAY_PERIOD cycles and at exit are logged. With PA3_REPLAY
+ * set, the logged image and registers replace those main.c loaded, and
+ * the state is checked against the log; the first cycle that differs
+ * stops the simulation. Seeking is up to pa2, as the pipeline latches
+ * of pa3 live in main.c.
+ */
+#define NR_REPLAY_REGS	33		/* registers, pc */
+
+static int replay_enabled = -1;
+static struct replay replay;
+
+static void __replay_regs(unsigned int* regs)
+{
+	memcpy(regs, registers, 32 * sizeof(*regs));
+	regs[32] = pc;
+}
+
+static void __replay_check(void)
+{
+	unsigned int regs[NR_REPLAY_REGS];
+
+	__replay_regs(regs);
+	if (!replay_state(&replay, regs, NR_REPLAY_REGS, memory)) {
+		fprintf(stderr, "\nreplay: diverged from the log at cycle %llu, pc 0x%08x\n", replay.count, pc);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void __replay_exit(void)
+{
+	__replay_check();
+	replay_close(&replay);
+}
+
+static void __replay_start(void)
+{
+	const char* record = getenv("PA3_RECORD");
+	const char* filename = record ? record : getenv("PA3_REPLAY");
+	const char* period = getenv("PA3_REPLAY_PERIOD");
+	unsigned char* empty;
+	unsigned int regs[NR_REPLAY_REGS];
+
+	replay_enabled = filename != NULL;
+	if (!replay_enabled) return;
+
+	if (!(empty = calloc(1, CORE_MEMORY_SIZE))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (replay_open(&replay, filename, record != NULL, '3', period ? strtoull(period, NULL, 0) : 1 << 20, memory)) {
+		fprintf(stderr, "Unable to %s %s\n", record ? "record to" : "replay", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	__replay_regs(regs);
+	if (record) {
+		replay_record_image(&replay, 0, memory, empty);
+	}
+	else if (replay_read(&replay) == REPLAY_IMAGE) {	//main.c가 읽은 프로그램 대신 기록된 이미지 사용
+		memset(memory, 0, CORE_MEMORY_SIZE);
+		replay_apply_image(&replay, memory);
+	}
+	if (!replay_input(&replay, regs, sizeof(regs))) {
+		fprintf(stderr, "%s is not a pa3 log\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(registers, regs, 32 * sizeof(*regs));
+	pc = regs[32];
+	free(empty);
+
+	atexit(__replay_exit);
+}
+
+/**
+ * I/O of the guest through syscall, see common/syscall.h. It is carried
+ * out in WB_stage() when everything older has retired, and ID_stage()
+ * holds the younger instructions back until then so that they read the
+ * result in $v0. Since main.c only knows halt, exit ends the process.
+ */
+#define HEAP_START	0x10000	/* sbrk hands out memory from here */
+
+static struct syscalls* __syscalls(void)
+{
+	static bool initialized = false;
+	static struct syscalls syscalls;
+
+	if (!initialized) {
+		syscall_init(&syscalls, HEAP_START, CORE_MEMORY_SIZE);
+		initialized = true;
+	}
+	return &syscalls;
+}
+
+static void __syscall(void)
+{
+	struct syscalls* sys = __syscalls();
+
+	sys->replay = replay_enabled > 0 ? &replay : NULL;
+	if (!syscall_execute(sys, registers, memory)) {
+		syscall_close(sys);
+		exit(sys->exit_code);
+	}
+}
+
+/* Called at the beginning of every cycle */
+static void __replay_cycle(void)
+{
+	if (replay_enabled < 0) __replay_start();
+	if (!replay_enabled) return;
+
+	if (++replay.count >= replay.next) __replay_check();
+}
+
 void IF_stage(struct IF_ID* if_id)
 {
+	__cosim_start();	//첫 사이클의 상태를 co-simulation 기준으로 사용
+
 	/***
 	 * No need to check whether this stage is idle or not for some reasons...
 	 */
@@ -137,8 +564,15 @@ void ID_stage(struct IF_ID* if_id, struct ID_EX* id_ex)
 			id_ex->immediate = (id_ex->next_pc & 0xF0000000) | (id_ex->immediate << 2);	//상위 4비트는 현재 PC의 상위 4비트와 동일하게 유지되어야 함
 		}
 		make_stall(IF, 3);
+		__profile_stall(stages[ID].__pc, 3);	//스톨 사이클을 분기 명령어에 청구
+		__interval_count(INTERVAL_CONTROL_STALLS, 3);
 		return;
 	}
+	if (instr->format == r_format && instr->r_format.funct == 0x0c) {	//syscall, WB에서 실행될 때까지 다음 명령어 대기
+		make_stall(IF, 3);
+		__profile_stall(stages[ID].__pc, 3);
+		__interval_count(INTERVAL_SYSCALL_STALLS, 3);
+	}
 }
 
 void EX_stage(struct ID_EX* id_ex, struct EX_MEM* ex_mem)
@@ -203,6 +637,9 @@ void EX_stage(struct ID_EX* id_ex, struct EX_MEM* ex_mem)
 			ex_mem->next_pc = id_ex->reg1_value;
 		}
 		break;
+		case 0x0c:	//syscall(WB에서 처리, $zero에 0을 씀)
+			ex_mem->alu_out = 0;
+			break;
 		default:
 			break;
 		}
@@ -236,6 +673,17 @@ void EX_stage(struct ID_EX* id_ex, struct EX_MEM* ex_mem)
 			ex_mem->next_pc = id_ex->next_pc + (id_ex->immediate << 2);	//점프뛸 주소
 			ex_mem->alu_out = id_ex->reg1_value - id_ex->reg2_value;
 			break;
+		case 0x36:	//lq, 16바이트 정렬된 주소
+			ex_mem->alu_out = (id_ex->reg1_value + id_ex->immediate) & ~15U;
+			break;
+		case 0x3e:	//sq, 나머지 세 레지스터는 MEM에서 읽음
+			ex_mem->alu_out = (id_ex->reg1_value + id_ex->immediate) & ~15U;
+			ex_mem->write_value = id_ex->reg2_value;
+			break;
+		case 0x1c:	//packed SIMD(paddb 등), r-format처럼 rd에 씀
+			ex_mem->write_reg = id_ex->instr_15_11;
+			ex_mem->alu_out = core_packed(isa_decode(instr->machine_instr), id_ex->reg1_value, id_ex->reg2_value);
+			break;
 		case 0x0a: // slti
 			if ((int)id_ex->reg1_value < (int)id_ex->immediate) {	//immediate값과 rs값 비교
 				ex_mem->alu_out = 1;
@@ -291,14 +739,33 @@ void MEM_stage(struct EX_MEM* ex_mem, struct MEM_WB* mem_wb)
 			memory[ex_mem->alu_out + 2] = (ex_mem->write_value >> 8) & 0xFF;	//다음 8비트
 			memory[ex_mem->alu_out + 3] = ex_mem->write_value & 0xFF;	//하위 8비트
 		}
+		else if (instr->opcode == 0x36 || instr->opcode == 0x3e) {	//lq, sq
+			mem_wb->write_reg = ex_mem->write_reg;
+			mem_wb->alu_out = ex_mem->alu_out;	//나머지 워드는 WB에서 이 주소로 읽음
+			if (instr->opcode == 0x36) {
+				mem_wb->mem_out = core_load_word(memory, ex_mem->alu_out);
+			}
+			else {
+				core_store_word(memory, ex_mem->alu_out, ex_mem->write_value);
+				for (unsigned int i = 1; i < 4; i++) {
+					core_store_word(memory, ex_mem->alu_out + 4 * i, registers[ex_mem->write_reg + i]);
+				}
+			}
+			//64비트 포트라 16바이트는 두 번에 나눠 접근, 뒤따르는 명령어는 한 사이클 대기
+			make_stall(EX, 1);
+			__profile_stall(stages[MEM].__pc, 1);
+			__interval_count(INTERVAL_MEM_STALLS, 1);
+		}
 		else if (instr->opcode == 0x04) {	//beq
 			if (ex_mem->alu_out == 0) {	//rs==rt
 				pc = ex_mem->next_pc;
+				__interval_count(INTERVAL_TAKEN, 1);
 			}
 		}
 		else if (instr->opcode == 0x05) {	//bne
 			if (ex_mem->alu_out != 0) {	//rs!=rt
 				pc = ex_mem->next_pc;
+				__interval_count(INTERVAL_TAKEN, 1);
 			}
 		}
 		else {
@@ -316,11 +783,19 @@ void WB_stage(struct MEM_WB* mem_wb)
 {
 	struct instruction* instr = &stages[WB].instruction;
 
+	__replay_cycle();	//WB_stage()가 매 사이클 가장 먼저 불림
+	__interval_cycle();
+
 	if (is_noop(WB)) return;
 
+	__trace_retire(stages[WB].__pc, instr->machine_instr);
+	__profile_retire(stages[WB].__pc, instr->machine_instr);
+	if (interval_enabled > 0) __interval_retire(instr);
+
 	switch (instr->format) {
 	case r_format:  // r-format 명령어
 		registers[mem_wb->write_reg] = mem_wb->alu_out;
+		if (instr->r_format.funct == 0x0c) __syscall();	//앞선 명령어가 모두 끝난 뒤 실행
 		break;
 	case i_format:  // i-format 명령어
 		if (instr->opcode == 0x23) {	//lw
@@ -329,6 +804,15 @@ void WB_stage(struct MEM_WB* mem_wb)
 		else if(instr->opcode == 0x2b){	//sw
 			break;
 		}
+		else if (instr->opcode == 0x36) {	//lq, 그 사이 MEM에서 저장한 것은 아직 없음
+			if (mem_wb->write_reg) registers[mem_wb->write_reg] = mem_wb->mem_out;
+			for (unsigned int i = 1; i < 4; i++) {
+				registers[mem_wb->write_reg + i] = core_load_word(memory, mem_wb->alu_out + 4 * i);
+			}
+		}
+		else if (instr->opcode == 0x3e) {	//sq
+			break;
+		}
 		else if (instr->opcode == 0x04) {	//beq
 			break;
 		}
@@ -342,4 +826,6 @@ void WB_stage(struct MEM_WB* mem_wb)
 	case j_format:  //j-format 명령어
 		break;
 	}
+
+	__cosim_retire(stages[WB].__pc, instr->machine_instr);
 }
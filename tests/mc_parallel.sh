@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Run the bench kernels on the parallel engine of mc with -S and fail if
+# the cycles drift from the serial engine by more than the bound.
+#
+#   sh tests/mc_parallel.sh [max error %]
+#
+# memcpy is left out: four cores writing the same lines invalidate each
+# other on every store, which the parallel engine sees once a quantum
+# only (see mc/README.md). sort races on its array, so the cores do not
+# even run the same instructions.
+
+cd "$(dirname "$0")/.." || exit 1
+
+bound=${1:-5}
+mc=$(mktemp)
+trap 'rm -f "$mc"' EXIT
+gcc -O2 -pthread -o "$mc" mc/mc.c || exit 1
+
+status=0
+check()
+{
+	kernel=$1
+	shift
+	error=$("$mc" -n 4 -t 2 -S "$@" "bench/$kernel.s" | sed -n 's/.*cycle error \([-+0-9.]*\)%.*/\1/p')
+
+	if [ -z "$error" ] || awk -v e="$error" -v b="$bound" 'BEGIN { exit !(e > b || e < -b) }'; then
+		echo "FAIL $kernel $*: cycle error ${error:-?}%"
+		status=1
+	else
+		echo "ok   $kernel $*: cycle error $error%"
+	fi
+}
+
+for kernel in list matmul strings; do
+	check $kernel
+	check $kernel -q 100
+done
+
+# The useless prefetches of list keep the bus busy, which a quantum of
+# 1000 cycles running on an idle bus overshoots
+for prefetcher in next-line stride stream; do
+	check matmul -p $prefetcher
+	check strings -p $prefetcher
+	check list -q 100 -p $prefetcher
+done
+
+exit $status
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Translate small programs with the peephole optimizer of pa1 and fail if
+# the optimized code differs from the expected one.
+#
+#   sh tests/peephole.sh
+
+cd "$(dirname "$0")/.." || exit 1
+
+pa1=$(mktemp)
+trap 'rm -f "$pa1"' EXIT
+gcc -O2 -o "$pa1" pa1/pa1.c 2>/dev/null || exit 1
+
+status=0
+check()
+{
+	name=$1
+	live=$2
+	program=$3
+	expected=$4
+	output=$(printf "$program" | PA1_OPTIMIZE=$live "$pa1" 2>&1 >/dev/null | tr '\n' ' ')
+
+	if [ "$output" != "$expected" ]; then
+		echo "FAIL $name: $output, expected $expected"
+		status=1
+	else
+		echo "ok   $name"
+	fi
+}
+
+# The move into the stored register is propagated and then dropped
+check "sw source" s0 \
+	'or t1 s0 zero\nsw t1 0 a0\nhalt\n' \
+	'0xac900000 0xfc000000 '
+
+# sc writes its rt, so a move into it must not be propagated into the sc
+check "sc result" s0,t0,t1 \
+	'll t0 0 a0\nor t1 s0 zero\nsc t1 0 a0\nbeq t1 zero -4\nhalt\n' \
+	'0xc0880000 0x02004825 0xe0890000 0x1009fffc 0xfc000000 '
+
+# Comments are dropped as in common/loader.h, not translated into 0s
+check "comment" s0 \
+	'or t1 s0 zero # copy\nsw t1 0 a0 // store\nhalt\n' \
+	'0xac900000 0xfc000000 '
+
+# A line that cannot be translated fails the run and is never optimized
+output=$(printf 'addi t0 zero 1\nfoo t0\nhalt\n' | PA1_OPTIMIZE=t0 "$pa1" 2>&1 >/dev/null)
+if [ $? -eq 0 ] || [ "$output" != "cannot assemble line 2: foo t0" ]; then
+	echo "FAIL bad line: $output"
+	status=1
+else
+	echo "ok   bad line"
+fi
+
+exit $status
@@ -0,0 +1,279 @@
+/**********************************************************************
+ * stackdist: miss ratios of every cache size and associativity at once
+ *
+ * Read a memory reference trace of pa2 (the memtrace command, see
+ * common/memtrace.h) and compute the LRU stack distance of each reference
+ * within its set, for every number of sets from 1 up to what the largest
+ * cache needs. An A-way LRU cache with S sets hits exactly the references
+ * whose distance in the S-set configuration is below A, so one pass per
+ * S gives the miss ratio of all the associativities (Mattson et al.).
+ *
+ * Distances are counted with a Fenwick tree over the references of each
+ * set in time order, holding a 1 at the latest reference of every line;
+ * the distance of a reference is the number of ones after the previous
+ * reference to its line. The set-index configurations are independent
+ * and run on separate threads.
+ *
+ *   stackdist [-l line] [-c max cache size] [-w max ways] [-k inst|data|unified] [-t threads] trace
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../common/memtrace.h"
+
+struct stackdist_config {
+	unsigned int sets;
+	unsigned int max_distance;		/* Lines that map to one set */
+
+	unsigned long long* hist;		/* [d] references at distance d, max_distance of them */
+	unsigned long long cold;		/* First references */
+};
+
+struct stackdist {
+	const unsigned int* lines;		/* Line address of each reference */
+	size_t nr_refs;
+	unsigned int nr_lines;			/* Lines in the memory */
+
+	struct stackdist_config* configs;
+	unsigned int nr_configs;
+	atomic_uint next;				/* Next configuration to take */
+};
+
+static void* __oom(void* p)
+{
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static inline void __fenwick_add(unsigned int* tree, size_t size, size_t i, int delta)
+{
+	for (; i <= size; i += i & -i) tree[i] += delta;
+}
+
+static inline unsigned int __fenwick_sum(const unsigned int* tree, size_t i)
+{
+	unsigned int sum = 0;
+
+	for (; i; i -= i & -i) sum += tree[i];
+	return sum;
+}
+
+/**
+ * Stack distances of @sd->lines in @config. Each set gets the range of
+ * positions [start[set], start[set + 1]) of the tree, so a range query
+ * never counts another set.
+ */
+static void __stackdist_run(const struct stackdist* sd, struct stackdist_config* config)
+{
+	size_t* cursor = __oom(calloc(config->sets + 1, sizeof(*cursor)));
+	unsigned int* tree = __oom(calloc(sd->nr_refs + 1, sizeof(*tree)));
+	unsigned int* last = __oom(calloc(sd->nr_lines, sizeof(*last)));	/* Position + 1 */
+	unsigned int mask = config->sets - 1;
+
+	for (size_t i = 0; i < sd->nr_refs; i++) cursor[(sd->lines[i] & mask) + 1]++;
+	for (unsigned int set = 0; set < config->sets; set++) cursor[set + 1] += cursor[set];
+
+	for (size_t i = 0; i < sd->nr_refs; i++) {
+		unsigned int line = sd->lines[i];
+		unsigned int pos = ++cursor[line & mask];	/* 1-based */
+
+		if (last[line]) {
+			unsigned int distance = __fenwick_sum(tree, pos - 1) - __fenwick_sum(tree, last[line]);
+
+			config->hist[distance]++;
+			__fenwick_add(tree, sd->nr_refs, last[line], -1);
+		}
+		else {
+			config->cold++;
+		}
+		__fenwick_add(tree, sd->nr_refs, pos, 1);
+		last[line] = pos;
+	}
+
+	free(cursor);
+	free(tree);
+	free(last);
+}
+
+static void* __stackdist_thread(void* arg)
+{
+	struct stackdist* sd = arg;
+	unsigned int i;
+
+	while ((i = atomic_fetch_add(&sd->next, 1)) < sd->nr_configs) {
+		__stackdist_run(sd, &sd->configs[i]);
+	}
+	return NULL;
+}
+
+/* Misses of an @ways-way cache with the sets of @config */
+static unsigned long long __stackdist_misses(const struct stackdist* sd, const struct stackdist_config* config,
+	unsigned int ways)
+{
+	unsigned long long hits = 0;
+
+	for (unsigned int d = 0; d < ways && d < config->max_distance; d++) hits += config->hist[d];
+	return sd->nr_refs - hits;
+}
+
+static void __print_size(unsigned int bytes)
+{
+	char buffer[16];
+
+	if (bytes >= 1024) snprintf(buffer, sizeof(buffer), "%uKB", bytes / 1024);
+	else snprintf(buffer, sizeof(buffer), "%uB", bytes);
+	printf("%8s", buffer);
+}
+
+static void __usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-l line] [-c max cache size] [-w max ways] [-k inst|data|unified] [-t threads] trace\n",
+		name);
+}
+
+int main(int argc, char* argv[])
+{
+	static const char* const kinds[] = { "inst", "data", "unified" };
+	unsigned int line_size = 32;
+	unsigned int max_size = 64 * 1024;
+	unsigned int max_ways = 16;
+	int kind = 1;
+	int nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long counts[NR_MEMTRACE_KINDS] = { 0 };
+	struct stackdist sd = { NULL };
+	unsigned int line_shift = 0;
+	unsigned int* refs;
+	unsigned int* lines;
+	size_t nr_refs;
+	pthread_t* threads;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:c:w:k:t:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			line_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			max_ways = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			for (kind = 0; kind < 3 && strcmp(optarg, kinds[kind]); kind++);
+			if (kind == 3) {
+				__usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		default:
+			__usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		__usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (line_size < 4 || (line_size & (line_size - 1)) || max_size < line_size || (max_size & (max_size - 1)) ||
+		max_size > CORE_MEMORY_SIZE || !max_ways) {
+		fprintf(stderr, "The line and the cache sizes must be powers of two, and the cache up to %uKB\n",
+			CORE_MEMORY_SIZE / 1024);
+		return EXIT_FAILURE;
+	}
+	if (nr_threads < 1) nr_threads = 1;
+
+	refs = memtrace_load(argv[optind], &nr_refs);
+	if (!refs) {
+		fprintf(stderr, "No trace in %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	/* Keep the references the cache sees, as line addresses */
+	while ((1U << line_shift) < line_size) line_shift++;
+	lines = refs;
+	for (size_t i = 0; i < nr_refs; i++) {
+		enum memtrace_kind k = MEMTRACE_KIND(refs[i]);
+
+		counts[k]++;
+		if (kind == 2 || (kind == 0) == (k == MEMTRACE_FETCH)) lines[sd.nr_refs++] = MEMTRACE_ADDR(refs[i]) >> line_shift;
+	}
+	sd.lines = lines;
+	sd.nr_lines = CORE_MEMORY_SIZE >> line_shift;
+
+	printf("%zu references: %llu fetches, %llu loads, %llu stores\n", nr_refs,
+		counts[MEMTRACE_FETCH], counts[MEMTRACE_LOAD], counts[MEMTRACE_STORE]);
+	printf("%s cache, %u-byte lines: %zu references\n", kinds[kind], line_size, sd.nr_refs);
+	if (!sd.nr_refs) {
+		free(refs);
+		return EXIT_SUCCESS;
+	}
+
+	/* One configuration per number of sets, 1 (fully associative) to max_size / line_size */
+	for (unsigned int sets = 1; sets <= max_size / line_size; sets <<= 1) sd.nr_configs++;
+	sd.configs = __oom(calloc(sd.nr_configs, sizeof(*sd.configs)));
+	for (unsigned int i = 0; i < sd.nr_configs; i++) {
+		struct stackdist_config* config = &sd.configs[i];
+
+		config->sets = 1U << i;
+		config->max_distance = sd.nr_lines / config->sets;
+		config->hist = __oom(calloc(config->max_distance, sizeof(*config->hist)));
+	}
+	atomic_init(&sd.next, 0);
+
+	if ((unsigned int)nr_threads > sd.nr_configs) nr_threads = sd.nr_configs;
+	threads = __oom(calloc(nr_threads, sizeof(*threads)));
+	for (int i = 1; i < nr_threads; i++) {
+		/* The configurations are pulled from sd.next, so fewer threads still cover them all */
+		if (pthread_create(&threads[i], NULL, __stackdist_thread, &sd) != 0) {
+			nr_threads = i;
+			break;
+		}
+	}
+	__stackdist_thread(&sd);
+	for (int i = 1; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	/* Miss ratios by cache size (rows) and associativity (columns) */
+	printf("\n%8s", "size");
+	for (unsigned int ways = 1; ways <= max_ways; ways <<= 1) printf("  %5u-way", ways);
+	printf("  %9s\n", "full");
+
+	for (unsigned int size = line_size; size <= max_size; size <<= 1) {
+		unsigned int nr_lines = size / line_size;
+
+		__print_size(size);
+		for (unsigned int ways = 1; ways <= max_ways; ways <<= 1) {
+			unsigned int sets = nr_lines / ways;
+			const struct stackdist_config* config = &sd.configs[0];
+
+			if (ways > nr_lines) {
+				printf("  %9s", "-");
+				continue;
+			}
+			while (config->sets < sets) config++;
+			printf("  %9.4f", (double)__stackdist_misses(&sd, config, ways) / sd.nr_refs);
+		}
+		printf("  %9.4f\n", (double)__stackdist_misses(&sd, &sd.configs[0], nr_lines) / sd.nr_refs);
+	}
+	printf("\ncold misses: %llu (%.4f)\n", sd.configs[0].cold, (double)sd.configs[0].cold / sd.nr_refs);
+
+	for (unsigned int i = 0; i < sd.nr_configs; i++) free(sd.configs[i].hist);
+	free(sd.configs);
+	free(refs);
+
+	return EXIT_SUCCESS;
+}